@@ -0,0 +1,581 @@
+#include <array>
+#include <deque>
+#include <chrono>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <cstdio>
+#include <cstdint>
+#include <sstream>
+#include <algorithm>
+
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "flags.h"
+#include "ensure.h"
+#include "buffer.h"
+#include "address.h"
+#include "metrics.h"
+#include "database.h"
+#include "request_handler.h"
+
+namespace {
+    using clock_type = std::chrono::steady_clock;
+    using event_id = Database::event_id;
+    using reservation_id = Database::reservation_id;
+    using cookie_t = Database::cookie_t;
+
+    /** Request types sent by the generator, in the order of weights of the mix */
+    enum RequestType : size_t {
+        EVENTS_REQUEST = 0,
+        RESERVATION_REQUEST = 1,
+        TICKETS_REQUEST = 2,
+        REQUEST_TYPES = 3
+    };
+
+    constexpr std::array<const char*, REQUEST_TYPES> TYPE_NAMES = {"GET_EVENTS", "GET_RESERVATION", "GET_TICKETS"};
+
+    constexpr size_t MAX_DATAGRAM = RequestHandler::MAX_DATAGRAM;
+
+    constexpr uint16_t DEFAULT_PORT = 2022;
+
+    /** Maximal number of requests in flight per client, sent with a single sendmmsg */
+    constexpr size_t MAX_DEPTH = 64;
+
+    constexpr size_t RESERVATION_LEN = RequestHandler::RESERVATION_LEN;
+    constexpr size_t BAD_REQUEST_LEN = RequestHandler::BAD_REQUEST_LEN;
+    constexpr size_t TICKETS_HEADER_LEN = RequestHandler::TICKETS_HEADER_LEN;
+
+    /** Offset of the cookie in RESERVATION: type, reservation, event and tickets precede it */
+    constexpr size_t RESERVATION_COOKIE_OFFSET = 11;
+
+    /** Reservations kept by a client for later GET_TICKETS, further ones are forgotten */
+    constexpr size_t MAX_HELD_RESERVATIONS = 64;
+
+    constexpr size_t MAX_EPOLL_EVENTS = 256;
+
+    struct Settings {
+        sockaddr_storage server{}; /** IPv4 or IPv6 address of the server */
+        size_t clients = 16; /** Simulated clients of a single thread */
+        size_t depth = 1; /** Requests in flight per client */
+        double rate = 0; /** Requests per second of a single thread, 0 in the closed loop */
+        std::chrono::milliseconds timeout{1000};
+        clock_type::time_point start, end;
+        std::array<uint32_t, REQUEST_TYPES> mix = {1, 1, 1};
+        event_id events = 0;
+        Database::tickets_t tickets = 1;
+    };
+
+    /** Statistics of a single request type of a single thread */
+    struct TypeStats {
+        Counter sent;
+        Counter answered;
+        Counter bad_requests; /** Requests answered with BAD_REQUEST */
+        Counter timeouts; /** Requests unanswered after the timeout */
+        Counter unexpected; /** Responses matching no request in flight */
+        LatencyHistogram latency; /** From the intended sending time, so a late client does not hide queueing */
+
+        void merge(const TypeStats& other) {
+            sent.add(other.sent.get());
+            answered.add(other.answered.get());
+            bad_requests.add(other.bad_requests.get());
+            timeouts.add(other.timeouts.get());
+            unexpected.add(other.unexpected.get());
+            latency.merge(other.latency);
+        }
+    };
+
+    using stats_t = std::array<TypeStats, REQUEST_TYPES>;
+
+    struct Pending {
+        uint64_t serial; /** Number of requests the client sent before this one */
+        RequestType type;
+        uint32_t target; /** Event or reservation, echoed in the response */
+        clock_type::time_point intended;
+    };
+
+    struct HeldReservation {
+        reservation_id id;
+        cookie_t cookie;
+    };
+
+    /**
+     * Simulated client: a connected socket with up to a fixed number of requests in flight.
+     * The protocol has no request identifiers, and a worker may answer out of order, e.g.
+     * reservations deferred by an admission queue after later requests. A response is
+     * therefore matched with the oldest request in flight it answers by its type and the
+     * event or reservation it echoes; GET_EVENTS echoes nothing and answers the oldest one.
+     */
+    struct Client {
+        int socket_fd = -1;
+        uint64_t serial = 0;
+        std::deque<Pending> pending; /** In the order they were sent */
+        std::vector<HeldReservation> held;
+    };
+
+    struct Timeout {
+        size_t client;
+        uint64_t serial;
+        clock_type::time_point deadline;
+    };
+
+    /** Clients of a single thread, multiplexed with epoll, sending and receiving in batches */
+    class LoadThread {
+    public:
+        LoadThread(const Settings& settings, uint64_t seed)
+                : settings(settings), clients(settings.clients), random(seed),
+                  mix(settings.mix.begin(), settings.mix.end()),
+                  slots(settings.depth * MAX_DATAGRAM), vectors(settings.depth), messages(settings.depth) {
+            epoll_fd = epoll_create1(0);
+            ensure(epoll_fd >= 0, "Failed to create an epoll instance");
+
+            for (size_t i = 0; i < clients.size(); i++) {
+                this->open_socket(i);
+            }
+
+            for (size_t i = 0; i < settings.depth; i++) {
+                vectors[i] = {this->slot(i), MAX_DATAGRAM};
+                messages[i].msg_hdr.msg_iov = &vectors[i];
+                messages[i].msg_hdr.msg_iovlen = 1;
+            }
+        }
+
+        LoadThread(const LoadThread&) = delete;
+        LoadThread& operator=(const LoadThread&) = delete;
+
+        ~LoadThread() {
+            for (auto& client : clients) {
+                close(client.socket_fd);
+            }
+
+            close(epoll_fd);
+        }
+
+        void run() {
+            std::array<epoll_event, MAX_EPOLL_EVENTS> ready{};
+
+            while (true) {
+                auto now = clock_type::now();
+
+                if (now >= settings.end)
+                    return;
+
+                this->send_requests(now);
+
+                int count = epoll_wait(epoll_fd, ready.data(), static_cast<int>(ready.size()), this->wait_time(now));
+                ensure(count >= 0 || errno == EINTR, "Failed to wait for responses");
+
+                for (int i = 0; i < count; i++) {
+                    this->receive_responses(ready[i].data.u64, clock_type::now());
+                }
+
+                this->expire_requests(clock_type::now());
+            }
+        }
+
+        const stats_t& statistics() const {
+            return stats;
+        }
+
+    private:
+        const Settings& settings;
+        std::vector<Client> clients;
+        std::mt19937_64 random;
+        std::discrete_distribution<size_t> mix;
+        stats_t stats;
+
+        int epoll_fd = -1;
+        std::deque<Timeout> timeouts; /** Sorted by deadline, as all requests share the timeout */
+        uint64_t issued = 0; /** Requests sent in the open loop */
+
+        std::vector<char> slots; /** Buffers of a batch of datagrams, MAX_DATAGRAM octets each */
+        std::vector<iovec> vectors;
+        std::vector<mmsghdr> messages;
+
+        char* slot(size_t index) {
+            return slots.data() + index * MAX_DATAGRAM;
+        }
+
+        /** Opens a new socket of a client, so responses to requests sent before never reach it */
+        void open_socket(size_t index) {
+            Client& client = clients[index];
+
+            if (client.socket_fd >= 0) {
+                close(client.socket_fd);
+            }
+
+            client.socket_fd = socket(settings.server.ss_family, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+            ensure(client.socket_fd >= 0, "Failed to create a client socket");
+
+            const auto* server = reinterpret_cast<const sockaddr*>(&settings.server);
+            ensure(connect(client.socket_fd, server, address_length(settings.server)) != -1,
+                   "Failed to connect to the server");
+
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.u64 = index;
+            ensure(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client.socket_fd, &event) != -1, "Failed to watch a socket");
+        }
+
+        /** Time of the n-th request in the open loop */
+        clock_type::time_point scheduled(uint64_t request) const {
+            auto offset = std::chrono::duration<double>(static_cast<double>(request) / settings.rate);
+            return settings.start + std::chrono::duration_cast<clock_type::duration>(offset);
+        }
+
+        /**
+         * In the closed loop every client keeps its requests in flight. In the open loop
+         * requests are due at a fixed rate and a request which finds no free client waits,
+         * keeping its intended time, so the latency includes the waiting.
+         */
+        void send_requests(clock_type::time_point now) {
+            for (size_t i = 0; i < clients.size(); i++) {
+                size_t free = settings.depth - clients[i].pending.size();
+
+                if (settings.rate > 0) {
+                    uint64_t due = 0;
+                    while (due < free && this->scheduled(issued + due) <= now) {
+                        due++;
+                    }
+
+                    free = due;
+                }
+
+                if (free > 0) {
+                    this->send_batch(i, free, now);
+                }
+            }
+        }
+
+        void send_batch(size_t index, size_t count, clock_type::time_point now) {
+            Client& client = clients[index];
+
+            for (size_t i = 0; i < count; i++) {
+                auto intended = settings.rate > 0 ? this->scheduled(issued + i) : now;
+                vectors[i].iov_len = this->write_request(client, this->slot(i), intended);
+                messages[i].msg_hdr.msg_name = nullptr;
+                messages[i].msg_hdr.msg_namelen = 0;
+            }
+
+            int sent = sendmmsg(client.socket_fd, messages.data(), static_cast<unsigned>(count), 0);
+            ensure(sent >= 0 || errno == EAGAIN || errno == ECONNREFUSED, "Failed to send requests");
+            sent = std::max(sent, 0);
+
+            /* Requests written but not sent are forgotten, with the reservations they would buy */
+            client.pending.resize(client.pending.size() - (count - static_cast<size_t>(sent)));
+
+            for (int i = 0; i < sent; i++) {
+                const Pending& request = client.pending[client.pending.size() - sent + i];
+                stats[request.type].sent.add();
+                timeouts.push_back({index, request.serial, now + settings.timeout});
+            }
+
+            if (settings.rate > 0) {
+                issued += static_cast<uint64_t>(sent);
+            }
+
+            for (size_t i = 0; i < count; i++) {
+                vectors[i].iov_len = MAX_DATAGRAM;
+            }
+        }
+
+        /** Writes the next request of the mix, GET_TICKETS becomes GET_RESERVATION if nothing is held */
+        size_t write_request(Client& client, char* buffer, clock_type::time_point intended) {
+            auto type = static_cast<RequestType>(mix(random));
+
+            if (type == TICKETS_REQUEST && client.held.empty()) {
+                type = RESERVATION_REQUEST;
+            }
+
+            Pending request{client.serial++, type, 0, intended};
+            size_t length;
+
+            if (type == EVENTS_REQUEST) {
+                length = buffer_write(buffer, RequestHandler::GET_EVENTS);
+            } else if (type == RESERVATION_REQUEST) {
+                request.target = static_cast<event_id>(random() % settings.events);
+                length = buffer_write(buffer, RequestHandler::GET_RESERVATION, request.target, settings.tickets);
+            } else {
+                HeldReservation reservation = client.held.back();
+                client.held.pop_back();
+                request.target = reservation.id;
+                length = buffer_write(buffer, RequestHandler::GET_TICKETS, reservation.id, reservation.cookie);
+            }
+
+            client.pending.push_back(request);
+            return length;
+        }
+
+        void receive_responses(size_t index, clock_type::time_point now) {
+            Client& client = clients[index];
+
+            while (!client.pending.empty()) {
+                for (auto& message : messages) {
+                    message.msg_hdr.msg_name = nullptr;
+                    message.msg_hdr.msg_namelen = 0;
+                }
+
+                int received = recvmmsg(client.socket_fd, messages.data(), static_cast<unsigned>(messages.size()),
+                                        MSG_DONTWAIT, nullptr);
+
+                if (received < 0) { /* Refused requests are left to time out */
+                    ensure(errno == EAGAIN || errno == ECONNREFUSED, "Failed to receive responses");
+                    return;
+                }
+
+                for (int i = 0; i < received; i++) {
+                    const char* response = this->slot(i);
+                    size_t length = messages[i].msg_len;
+                    auto answered = std::find_if(client.pending.begin(), client.pending.end(), [&](const Pending& r) {
+                        return LoadThread::answers(r, response, length);
+                    });
+
+                    /* Counted as the oldest request in flight, which it may have been meant for */
+                    if (answered == client.pending.end()) {
+                        stats[client.pending.empty() ? EVENTS_REQUEST : client.pending.front().type].unexpected.add();
+                        continue;
+                    }
+
+                    Pending request = *answered;
+                    client.pending.erase(answered);
+                    this->accept_response(client, request, response);
+
+                    auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(now - request.intended);
+                    stats[request.type].answered.add();
+                    stats[request.type].latency.record(static_cast<uint64_t>(std::max<int64_t>(latency.count(), 0)));
+                }
+
+                if (static_cast<size_t>(received) < messages.size())
+                    return;
+            }
+        }
+
+        /** Whether a response answers a request, by its type and echoed identifier */
+        static bool answers(const Pending& request, const char* response, size_t length) {
+            if (length == 0)
+                return false;
+
+            auto type = static_cast<uint8_t>(response[0]);
+
+            if (type == RequestHandler::BAD_REQUEST)
+                return request.type != EVENTS_REQUEST && length == BAD_REQUEST_LEN
+                       && buffer_read<uint32_t>(response, 1) == request.target;
+
+            switch (request.type) {
+                case EVENTS_REQUEST:
+                    return type == RequestHandler::EVENTS;
+                case RESERVATION_REQUEST:
+                    return type == RequestHandler::RESERVATION && length == RESERVATION_LEN
+                           && buffer_read<event_id>(response, 1 + sizeof(reservation_id)) == request.target;
+                default:
+                    return type == RequestHandler::TICKETS && length >= TICKETS_HEADER_LEN
+                           && buffer_read<reservation_id>(response, 1) == request.target;
+            }
+        }
+
+        /** Counts a response which answers a request, keeping reservations for GET_TICKETS */
+        void accept_response(Client& client, const Pending& request, const char* response) {
+            auto type = static_cast<uint8_t>(response[0]);
+
+            if (type == RequestHandler::BAD_REQUEST) {
+                stats[request.type].bad_requests.add();
+            } else if (type == RequestHandler::RESERVATION && client.held.size() < MAX_HELD_RESERVATIONS) {
+                client.held.push_back({buffer_read<reservation_id>(response, 1),
+                                       buffer_read<cookie_t>(response, RESERVATION_COOKIE_OFFSET)});
+            }
+        }
+
+        /** Drops the requests in flight of a client, its new socket gets no late responses of them */
+        void reset_client(size_t index) {
+            Client& client = clients[index];
+
+            for (const auto& request : client.pending) {
+                stats[request.type].timeouts.add();
+            }
+
+            client.pending.clear();
+            this->open_socket(index);
+        }
+
+        void expire_requests(clock_type::time_point now) {
+            while (!timeouts.empty() && timeouts.front().deadline <= now) {
+                Timeout timeout = timeouts.front();
+                timeouts.pop_front();
+                Client& client = clients[timeout.client];
+
+                /* Skip requests already answered or dropped */
+                if (!client.pending.empty() && client.pending.front().serial <= timeout.serial) {
+                    this->reset_client(timeout.client);
+                }
+            }
+        }
+
+        /** Milliseconds until the next request is due, a timeout passes or the run ends */
+        int wait_time(clock_type::time_point now) const {
+            auto next = settings.end;
+
+            if (!timeouts.empty()) {
+                next = std::min(next, timeouts.front().deadline);
+            }
+
+            if (settings.rate > 0) {
+                next = std::min(next, this->scheduled(issued));
+            }
+
+            auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(next - now).count();
+            return static_cast<int>(std::max<int64_t>(wait, 0));
+        }
+    };
+
+    /** Parses weights of GET_EVENTS, GET_RESERVATION and GET_TICKETS separated by colons, e.g. 1:8:1 */
+    std::array<uint32_t, REQUEST_TYPES> parse_mix(const std::string& text) {
+        std::array<uint32_t, REQUEST_TYPES> mix{};
+        std::istringstream input(text);
+        std::string weight;
+        size_t type = 0;
+
+        while (std::getline(input, weight, ':')) {
+            ensure(type < REQUEST_TYPES, "Request mix", text, "has more than", REQUEST_TYPES, "weights");
+            char* end;
+            mix[type++] = static_cast<uint32_t>(strtoul(weight.c_str(), &end, IN_BASE));
+            ensure(!weight.empty() && *end == 0, "Illegal weight", weight, "in request mix");
+        }
+
+        ensure(type == REQUEST_TYPES, "Request mix", text, "needs", REQUEST_TYPES, "weights");
+        ensure(mix[0] + mix[1] + mix[2] > 0, "Request mix", text, "has no positive weight");
+
+        return mix;
+    }
+
+    /** Counts all events with GET_EVENTS_PAGE, so GET_RESERVATION can target any of them */
+    event_id discover_events(const sockaddr_storage& server, std::chrono::milliseconds timeout) {
+        int socket_fd = socket(server.ss_family, SOCK_DGRAM, 0);
+        ensure(socket_fd >= 0, "Failed to create a socket");
+
+        timeval wait{timeout.count() / 1000, static_cast<suseconds_t>(timeout.count() % 1000 * 1000)};
+        setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &wait, sizeof(wait));
+        ensure(connect(socket_fd, reinterpret_cast<const sockaddr*>(&server), address_length(server)) != -1,
+               "Failed to connect to the server");
+
+        std::vector<char> buffer(MAX_DATAGRAM);
+        event_id cursor = 0, events = 0;
+
+        while (cursor != Database::END_OF_EVENTS) {
+            size_t length = buffer_write(buffer.data(), RequestHandler::GET_EVENTS_PAGE, cursor);
+            ensure(send(socket_fd, buffer.data(), length, 0) == static_cast<ssize_t>(length), "Failed to list events");
+
+            ssize_t received = recv(socket_fd, buffer.data(), buffer.size(), 0);
+            ensure(received >= 5 && static_cast<uint8_t>(buffer[0]) == RequestHandler::EVENTS_PAGE,
+                   "No EVENTS_PAGE response from the server");
+
+            cursor = buffer_read<event_id>(buffer.data(), 1);
+
+            /* Event: identifier, tickets, description length and description */
+            for (size_t offset = 5; offset < static_cast<size_t>(received); events++) {
+                ensure(offset + sizeof(event_id) + sizeof(Database::tickets_t) < static_cast<size_t>(received),
+                       "Truncated EVENTS_PAGE response");
+                offset += sizeof(event_id) + sizeof(Database::tickets_t) + sizeof(Database::desclen_t)
+                          + static_cast<uint8_t>(buffer[offset + sizeof(event_id) + sizeof(Database::tickets_t)]);
+            }
+        }
+
+        close(socket_fd);
+        return events;
+    }
+
+    double to_micros(uint64_t nanoseconds) {
+        return static_cast<double>(nanoseconds) / 1000;
+    }
+
+    void print_row(const char* name, const TypeStats& stats, double elapsed) {
+        uint64_t answered = stats.answered.get();
+        double bad_rate = answered > 0 ? 100.0 * static_cast<double>(stats.bad_requests.get()) / answered : 0;
+
+        printf("%-16s %10lu %10lu %10.0f %8.2f%% %9lu %10lu %9.1f %9.1f %9.1f\n", name, stats.sent.get(), answered,
+               static_cast<double>(answered) / elapsed, bad_rate, stats.timeouts.get(), stats.unexpected.get(),
+               to_micros(stats.latency.quantile(0.5)), to_micros(stats.latency.quantile(0.99)),
+               to_micros(stats.latency.quantile(0.999)));
+    }
+
+    void print_report(const std::vector<std::unique_ptr<LoadThread>>& threads, double elapsed) {
+        stats_t total_by_type;
+        TypeStats total;
+
+        for (const auto& thread : threads) {
+            for (size_t type = 0; type < REQUEST_TYPES; type++) {
+                total_by_type[type].merge(thread->statistics()[type]);
+                total.merge(thread->statistics()[type]);
+            }
+        }
+
+        printf("%-16s %10s %10s %10s %9s %9s %10s %9s %9s %9s\n", "type", "sent", "answered", "qps", "bad",
+               "timeouts", "unexpected", "p50_us", "p99_us", "p999_us");
+
+        for (size_t type = 0; type < REQUEST_TYPES; type++) {
+            print_row(TYPE_NAMES[type], total_by_type[type], elapsed);
+        }
+
+        print_row("total", total, elapsed);
+    }
+}
+
+int main(int argc, char** argv) {
+    flag_map flags = create_flag_map(argc, argv, "apwcbdrmneo");
+    Settings settings;
+
+    settings.server = listen_address(get_flag<std::string>(flags, "-a").value_or("127.0.0.1"),
+                                     get_flag<uint16_t>(flags, "-p").value_or(DEFAULT_PORT));
+
+    auto threads = get_flag<uint16_t>(flags, "-w").value_or(1);
+    auto clients = get_flag<uint32_t>(flags, "-c").value_or(16);
+    auto duration = get_flag<uint32_t>(flags, "-d").value_or(10);
+    auto rate = get_flag<uint32_t>(flags, "-r").value_or(0);
+
+    ensure(threads > 0 && clients >= threads, "There must be at least one client per thread");
+    settings.clients = clients / threads;
+    settings.depth = get_flag<uint16_t>(flags, "-b").value_or(1);
+    ensure(is_between<size_t>(settings.depth, 1, MAX_DEPTH), "Requests in flight must be from 1 to", MAX_DEPTH);
+    settings.rate = static_cast<double>(rate) / threads;
+    settings.timeout = std::chrono::milliseconds(get_flag<uint32_t>(flags, "-o").value_or(1000));
+    settings.tickets = get_flag<Database::tickets_t>(flags, "-n").value_or(1);
+
+    if (auto mix = get_flag<std::string>(flags, "-m"); mix.has_value()) {
+        settings.mix = parse_mix(mix.value());
+    }
+
+    settings.events = get_flag<event_id>(flags, "-e").value_or(0);
+    if (settings.events == 0) {
+        settings.events = discover_events(settings.server, settings.timeout);
+    }
+    ensure(settings.events > 0 || settings.mix[RESERVATION_REQUEST] + settings.mix[TICKETS_REQUEST] == 0,
+           "The server has no events to reserve");
+
+    std::vector<std::unique_ptr<LoadThread>> workers;
+    std::random_device seed;
+    for (size_t i = 0; i < threads; i++) {
+        workers.push_back(std::make_unique<LoadThread>(settings, (static_cast<uint64_t>(seed()) << 32) | i));
+    }
+
+    settings.start = clock_type::now();
+    settings.end = settings.start + std::chrono::seconds(duration);
+
+    std::vector<std::thread> running;
+    for (auto& worker : workers) {
+        running.emplace_back(&LoadThread::run, worker.get());
+    }
+
+    for (auto& thread : running) {
+        thread.join();
+    }
+
+    print_report(workers, std::chrono::duration<double>(clock_type::now() - settings.start).count());
+
+    return EXIT_SUCCESS;
+}
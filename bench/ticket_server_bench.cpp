@@ -0,0 +1,367 @@
+#include <string>
+#include <vector>
+#include <random>
+#include <cstdint>
+
+#include <arpa/inet.h>
+#include <benchmark/benchmark.h>
+
+#include "slab.h"
+#include "ensure.h"
+#include "buffer.h"
+#include "catalog.h"
+#include "tickets.h"
+#include "metrics.h"
+#include "database.h"
+#include "allocations.h"
+#include "request_handler.h"
+
+namespace {
+    constexpr size_t DESCRIPTION_LEN = 80;
+    constexpr uint16_t TICKETS_PER_EVENT = 65535;
+    constexpr uint32_t TIMEOUT = 86400;
+
+    /** Events as in test_limits: descriptions of DESCRIPTION_LEN octets and the maximal ticket count */
+    Catalog make_catalog(size_t events) {
+        Catalog catalog;
+
+        for (size_t event = 0; event < events; event++) {
+            std::string description = "event " + std::to_string(event);
+            description.resize(DESCRIPTION_LEN, '.');
+
+            catalog.descriptions.insert(catalog.descriptions.end(), description.begin(), description.end());
+            catalog.offsets.push_back(static_cast<uint32_t>(catalog.descriptions.size()));
+            catalog.tickets.push_back(TICKETS_PER_EVENT);
+        }
+
+        return catalog;
+    }
+
+    /** Database with a handler of its only worker, requests are passed through memory */
+    struct Server {
+        Database database;
+        RequestHandler::metrics_t metrics{1, RequestHandler::REQUEST_NAMES};
+        RequestHandler handler;
+        std::vector<char> buffer = std::vector<char>(RequestHandler::MAX_DATAGRAM);
+
+        explicit Server(size_t events, size_t replay_budget = RequestHandler::REPLAY_CACHE_BUDGET)
+                : database(make_catalog(events), TIMEOUT, 1), handler(database, 0, metrics.worker(0), replay_budget) {}
+
+        /** Handles a request and gives the length of its response, only the handler counts allocations */
+        size_t handle(const std::string& request) {
+            memcpy(buffer.data(), request.data(), request.size());
+            allocations::count(&metrics.worker(0).allocations);
+            auto response = handler.handle(buffer.data(), request.size());
+            allocations::count(nullptr);
+            return response.length + (response.payload ? response.payload->size() - response.payload_offset : 0);
+        }
+
+        /** Reports heap allocations of the handler per iteration */
+        void report_allocations(benchmark::State& state) {
+            state.counters["allocations"] = benchmark::Counter(
+                    static_cast<double>(metrics.worker(0).allocations.get()), benchmark::Counter::kAvgIterations);
+        }
+    };
+
+    std::string get_events() {
+        return {static_cast<char>(RequestHandler::GET_EVENTS)};
+    }
+
+    std::string get_events_page(uint32_t cursor) {
+        std::string request(5, 0);
+        buffer_write(request.data(), RequestHandler::GET_EVENTS_PAGE, cursor);
+        return request;
+    }
+
+    std::string get_reservation(uint32_t event, uint16_t tickets) {
+        std::string request(7, 0);
+        buffer_write(request.data(), RequestHandler::GET_RESERVATION, event, tickets);
+        return request;
+    }
+
+    /** GET_RESERVATIONS of a ticket for each of @p count consecutive events */
+    std::string get_reservations(uint32_t first_event, uint8_t count) {
+        std::string request(2 + count * 6, 0);
+        size_t offset = buffer_write(request.data(), RequestHandler::GET_RESERVATIONS, count);
+
+        for (uint32_t event = first_event; event < first_event + count; event++) {
+            offset += buffer_write(request.data() + offset, event, uint16_t{1});
+        }
+
+        return request;
+    }
+
+    std::string get_tickets(uint32_t reservation, const Database::cookie_t& cookie) {
+        std::string request(53, 0);
+        buffer_write(request.data(), RequestHandler::GET_TICKETS, reservation, cookie);
+        return request;
+    }
+
+    /** Reservation id and cookie from a RESERVATION response */
+    std::pair<uint32_t, Database::cookie_t> parse_reservation(const std::vector<char>& response) {
+        return {buffer_read<uint32_t>(response.data(), 1), buffer_read<Database::cookie_t>(response.data(), 11)};
+    }
+}
+
+static void BM_BufferWrite(benchmark::State& state) {
+    std::vector<char> buffer(RequestHandler::MAX_DATAGRAM);
+    Database::cookie_t cookie{};
+    uint32_t id = 0;
+
+    for (auto _ : state) {
+        size_t bytes = buffer_write(buffer.data(), RequestHandler::RESERVATION, id, id,
+                                    static_cast<uint16_t>(id), cookie, uint64_t{id});
+        benchmark::DoNotOptimize(bytes);
+        benchmark::ClobberMemory();
+        id++;
+    }
+}
+BENCHMARK(BM_BufferWrite);
+
+static void BM_TicketsWrite(benchmark::State& state) {
+    auto count = static_cast<size_t>(state.range(0));
+    std::vector<char> buffer(count * TICKET_LEN);
+    uint64_t first = 0;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(tickets_write(buffer.data(), first, count));
+        benchmark::ClobberMemory();
+        first += count;
+    }
+
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * count));
+}
+BENCHMARK(BM_TicketsWrite)->Arg(1)->Arg(64)->Arg(Database::MAX_TICKETS);
+
+static void BM_GenerateCookie(benchmark::State& state) {
+    Database::reservation_id reservation = Database::MIN_RESERVATION_ID;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(Database::generate_cookie(reservation++));
+    }
+}
+BENCHMARK(BM_GenerateCookie);
+
+/** Reservation ids are slab slots: acquiring one after most of a large slab was released at random */
+static void BM_ReservationIdFragmented(benchmark::State& state) {
+    constexpr Slab<int>::index_t SLOTS = 1 << 20;
+    Slab<int> slab;
+    std::vector<Slab<int>::index_t> live;
+
+    for (Slab<int>::index_t i = 0; i < SLOTS; i++) {
+        live.push_back(slab.acquire().value());
+    }
+
+    std::mt19937 rng(0);
+    std::shuffle(live.begin(), live.end(), rng);
+    for (size_t i = 0; i < SLOTS / 2; i++) {
+        slab.release(live[i]);
+    }
+
+    for (auto _ : state) {
+        auto slot = slab.acquire().value();
+        benchmark::DoNotOptimize(slot);
+        slab.release(slot);
+    }
+}
+BENCHMARK(BM_ReservationIdFragmented);
+
+static void BM_GetEvents(benchmark::State& state) {
+    Server server(static_cast<size_t>(state.range(0)));
+    std::string request = get_events();
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(server.handle(request));
+    }
+
+    server.report_allocations(state);
+}
+BENCHMARK(BM_GetEvents)->Arg(10)->Arg(1000)->Arg(1000000);
+
+/** Every GET_EVENTS follows a reservation, so the listing has to be published again */
+static void BM_GetEventsAfterReservation(benchmark::State& state) {
+    Server server(static_cast<size_t>(state.range(0)));
+    std::string events = get_events();
+    uint32_t event = 0;
+    auto event_count = static_cast<uint32_t>(std::min<int64_t>(state.range(0), 100));
+
+    for (auto _ : state) {
+        server.handle(get_reservation(event, 1));
+        benchmark::DoNotOptimize(server.handle(events));
+        event = (event + 1) % event_count;
+    }
+}
+BENCHMARK(BM_GetEventsAfterReservation)->Arg(10)->Arg(1000)->Arg(1000000)->Iterations(100000);
+
+/** Reads all events with GET_EVENTS_PAGE */
+static void BM_GetEventsAllPages(benchmark::State& state) {
+    Server server(static_cast<size_t>(state.range(0)));
+    size_t pages = 0;
+
+    for (auto _ : state) {
+        for (uint32_t cursor = 0; cursor != Database::END_OF_EVENTS; pages++) {
+            server.handle(get_events_page(cursor));
+            cursor = buffer_read<uint32_t>(server.buffer.data(), 1);
+        }
+    }
+
+    state.counters["pages"] = benchmark::Counter(static_cast<double>(pages), benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_GetEventsAllPages)->Arg(10)->Arg(1000)->Arg(1000000);
+
+/** A reservation and buying its tickets, reservations stay, so the number of iterations is fixed */
+static void BM_ReserveAndBuy(benchmark::State& state) {
+    Server server(1000);
+    uint32_t event = 0;
+
+    for (auto _ : state) {
+        server.handle(get_reservation(event, 4));
+        auto [reservation, cookie] = parse_reservation(server.buffer);
+        benchmark::DoNotOptimize(server.handle(get_tickets(reservation, cookie)));
+        event = (event + 1) % 1000;
+    }
+
+    server.report_allocations(state);
+}
+BENCHMARK(BM_ReserveAndBuy)->Iterations(200000);
+
+/** A client retrying GET_TICKETS of many tickets, answered from the replay cache unless the argument is 0 */
+static void BM_GetTicketsRetry(benchmark::State& state) {
+    Server server(1, static_cast<size_t>(state.range(0)));
+    server.handle(get_reservation(0, Database::MAX_TICKETS));
+    auto [reservation, cookie] = parse_reservation(server.buffer);
+    std::string request = get_tickets(reservation, cookie);
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(server.handle(request));
+    }
+
+    server.report_allocations(state);
+}
+BENCHMARK(BM_GetTicketsRetry)->Arg(0)->Arg(RequestHandler::REPLAY_CACHE_BUDGET);
+
+/** Full dispatch of a mix of requests which leave the database unchanged */
+static void BM_HandleRequestMix(benchmark::State& state) {
+    Server server(1000);
+    server.handle(get_reservation(0, 8));
+    auto [reservation, cookie] = parse_reservation(server.buffer);
+
+    std::vector<std::string> requests = {
+        get_events(),
+        get_events_page(500),
+        get_reservation(1, Database::MAX_TICKETS + 1), /* BAD_REQUEST */
+        get_reservation(5000, 1), /* BAD_REQUEST */
+        get_tickets(reservation, cookie), /* tickets bought by the first call */
+        get_tickets(reservation + 1, cookie), /* BAD_REQUEST */
+        std::string(3, 42) /* malformed */
+    };
+
+    size_t next = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(server.handle(requests[next]));
+        next = next + 1 == requests.size() ? 0 : next + 1;
+    }
+
+    server.report_allocations(state);
+}
+BENCHMARK(BM_HandleRequestMix);
+
+/** Flood of garbage datagrams, each refused without a response */
+static void BM_MalformedRequests(benchmark::State& state) {
+    Server server(1000);
+
+    std::vector<std::string> requests = {
+        std::string(3, 42), /* unknown type */
+        get_reservation(0, 1) + '\0', /* GET_RESERVATION too long */
+        get_events() + get_events(), /* GET_EVENTS too long */
+        get_reservations(0, 4).substr(0, 10), /* GET_RESERVATIONS with events cut off */
+        std::string(1, RequestHandler::GET_TICKETS) /* GET_TICKETS without fields */
+    };
+
+    size_t next = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(server.handle(requests[next]));
+        next = next + 1 == requests.size() ? 0 : next + 1;
+    }
+
+    server.report_allocations(state);
+}
+BENCHMARK(BM_MalformedRequests);
+
+int main(int argc, char** argv) {
+    log_level.store(LOG_ERROR); /* Measure handlers, not logging */
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return EXIT_FAILURE;
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    return EXIT_SUCCESS;
+}
+
+/** Reserves a ticket for each of N events in one request, compare with BM_ReserveEach */
+static void BM_ReserveBulk(benchmark::State& state) {
+    Server server(1000);
+    auto count = static_cast<uint8_t>(state.range(0));
+    uint32_t event = 0;
+
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(server.handle(get_reservations(event, count)));
+        event = (event + count) % (1000 - count);
+    }
+
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * count));
+}
+BENCHMARK(BM_ReserveBulk)->Arg(1)->Arg(16)->Arg(RequestHandler::MAX_BULK_RESERVATIONS)->Iterations(20000);
+
+/** Reserves a ticket for each of N events with a request per event */
+static void BM_ReserveEach(benchmark::State& state) {
+    Server server(1000);
+    auto count = static_cast<uint32_t>(state.range(0));
+    uint32_t event = 0;
+
+    for (auto _ : state) {
+        for (uint32_t i = 0; i < count; i++) {
+            benchmark::DoNotOptimize(server.handle(get_reservation(event + i, 1)));
+        }
+        event = (event + count) % (1000 - count);
+    }
+
+    state.SetItemsProcessed(static_cast<int64_t>(state.iterations() * count));
+}
+BENCHMARK(BM_ReserveEach)->Arg(1)->Arg(16)->Arg(RequestHandler::MAX_BULK_RESERVATIONS)->Iterations(20000);
+
+/** Database shared by the threads of BM_ReserveSharedEvent, one shard per thread */
+static std::unique_ptr<Database> shared_database;
+
+static void setup_shared_database(const benchmark::State& state) {
+    std::vector<Database::event_id> hot_events;
+    if (state.range(0) != 0) {
+        hot_events.push_back(0);
+    }
+
+    shared_database = std::make_unique<Database>(make_catalog(1), TIMEOUT, static_cast<size_t>(state.threads()),
+                                                 std::nullopt, hot_events);
+}
+
+static void teardown_shared_database(const benchmark::State&) {
+    shared_database.reset();
+}
+
+/** Workers reserving a single event at once, through the shard of the event or their own if the argument is 1 */
+static void BM_ReserveSharedEvent(benchmark::State& state) {
+    RequestHandler::metrics_t metrics{1, RequestHandler::REQUEST_NAMES};
+    RequestHandler handler(*shared_database, static_cast<size_t>(state.thread_index()), metrics.worker(0), 0);
+    std::vector<char> buffer(RequestHandler::MAX_DATAGRAM);
+    std::string request = get_reservation(0, 1);
+
+    for (auto _ : state) {
+        memcpy(buffer.data(), request.data(), request.size());
+        benchmark::DoNotOptimize(handler.handle(buffer.data(), request.size()));
+    }
+}
+/* Every thread reserves a ticket per iteration, all threads together fewer than TICKETS_PER_EVENT */
+BENCHMARK(BM_ReserveSharedEvent)->Setup(setup_shared_database)->Teardown(teardown_shared_database)
+        ->Arg(0)->Arg(1)->ThreadRange(1, 8)->Iterations(8000)->UseRealTime();
@@ -0,0 +1,113 @@
+#ifndef CINEMA_SERVER_ADDRESS_H
+#define CINEMA_SERVER_ADDRESS_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <charconv>
+
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "ensure.h"
+
+/** Any-address IPv4 listener, the default */
+constexpr const char* ANY_IPV4 = "0.0.0.0";
+
+/** Octets of the address held in @p address, as passed to bind or sendmsg */
+inline socklen_t address_length(const sockaddr_storage& address) {
+    return static_cast<socklen_t>(address.ss_family == AF_INET6 ? sizeof(sockaddr_in6) : sizeof(sockaddr_in));
+}
+
+/** Printable address and port, IPv6 addresses are bracketed */
+inline std::string address_string(const sockaddr_storage& address) {
+    char host[INET6_ADDRSTRLEN] = {};
+
+    if (address.ss_family == AF_INET6) {
+        const auto& ipv6 = reinterpret_cast<const sockaddr_in6&>(address);
+        inet_ntop(AF_INET6, &ipv6.sin6_addr, host, sizeof(host));
+        return "[" + std::string(host) + "]:" + std::to_string(ntohs(ipv6.sin6_port));
+    }
+
+    const auto& ipv4 = reinterpret_cast<const sockaddr_in&>(address);
+    inet_ntop(AF_INET, &ipv4.sin_addr, host, sizeof(host));
+    return std::string(host) + ":" + std::to_string(ntohs(ipv4.sin_port));
+}
+
+/**
+ * Integer key of an address and port. An IPv4 client keeps the same key when reaching
+ * a dual-stack socket as an IPv4-mapped address; other IPv6 addresses are hashed, so
+ * two of them may rarely share a key.
+ */
+inline uint64_t address_key(const sockaddr_storage& address) {
+    if (address.ss_family != AF_INET6) {
+        const auto& ipv4 = reinterpret_cast<const sockaddr_in&>(address);
+        return static_cast<uint64_t>(ipv4.sin_addr.s_addr) << 16 | ipv4.sin_port;
+    }
+
+    const auto& ipv6 = reinterpret_cast<const sockaddr_in6&>(address);
+
+    if (IN6_IS_ADDR_V4MAPPED(&ipv6.sin6_addr)) {
+        uint32_t ipv4;
+        memcpy(&ipv4, ipv6.sin6_addr.s6_addr + 12, sizeof(ipv4));
+        return static_cast<uint64_t>(ipv4) << 16 | ipv6.sin6_port;
+    }
+
+    uint64_t halves[2];
+    memcpy(halves, &ipv6.sin6_addr, sizeof(halves));
+
+    /* Mixing as in splitmix64, the port keeps clients behind one address apart */
+    uint64_t key = (halves[0] ^ (halves[1] * 0x9E3779B97F4A7C15ull)) + ipv6.sin6_port;
+    key = (key ^ (key >> 30)) * 0xBF58476D1CE4E5B9ull;
+    key = (key ^ (key >> 27)) * 0x94D049BB133111EBull;
+    return key ^ (key >> 31);
+}
+
+/**
+ * Resolves a numeric listening address.
+ * @param host IPv4 or IPv6 address, an IPv6 one may name its interface as in fe80::1%eth0
+ * @param port port in host byte order
+ * @return address, the program ends if @p host is not an address
+ */
+inline sockaddr_storage listen_address(const std::string& host, uint16_t port) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV | AI_PASSIVE;
+
+    addrinfo* resolved = nullptr;
+    int error = getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &resolved);
+    ensure(error == 0, "Invalid listening address", host, gai_strerror(error));
+
+    sockaddr_storage address{};
+    memcpy(&address, resolved->ai_addr, resolved->ai_addrlen);
+    freeaddrinfo(resolved);
+
+    return address;
+}
+
+/**
+ * Resolves a numeric address followed by a port, as in 192.0.2.1:7000 or [2001:db8::1]:7000.
+ * @return address, the program ends if @p endpoint is not one
+ */
+inline sockaddr_storage endpoint_address(const std::string& endpoint) {
+    size_t separator = endpoint.rfind(':');
+    ensure(separator != std::string::npos, "Address", endpoint, "has no port");
+
+    uint16_t port = 0;
+    const char* end = endpoint.data() + endpoint.size();
+    auto [parsed, error] = std::from_chars(endpoint.data() + separator + 1, end, port);
+    ensure(error == std::errc() && parsed == end, "Invalid port of address", endpoint);
+
+    std::string host = endpoint.substr(0, separator);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']') {
+        host = host.substr(1, host.size() - 2);
+    }
+
+    return listen_address(host, port);
+}
+
+#endif //CINEMA_SERVER_ADDRESS_H
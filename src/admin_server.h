@@ -0,0 +1,91 @@
+#ifndef CINEMA_SERVER_ADMIN_SERVER_H
+#define CINEMA_SERVER_ADMIN_SERVER_H
+
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <algorithm>
+#include <functional>
+#include <string_view>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ensure.h"
+
+/**
+ * Administrative UDP endpoint, bound to the loopback interface and served
+ * by its own thread, so it never slows down the workers. Every datagram
+ * is a command, answered with the text the handler gives for it.
+ */
+class AdminServer {
+public:
+    using handler_t = std::function<std::string(std::string_view command)>;
+
+    /**
+     * @param port listening port on the loopback interface
+     * @param handler gives the response to a command
+     */
+    AdminServer(uint16_t port, handler_t handler) : handler(std::move(handler)), buffer(MAX_DATAGRAM) {
+        socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+        ensure(socket_fd > 0, "Failed to create an admin socket");
+
+        sockaddr_in address{};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        ensure(bind(socket_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != -1,
+               "Failed to bind admin port", port);
+        debug("Starting admin listening on port", port);
+    }
+
+    AdminServer(const AdminServer&) = delete;
+    AdminServer& operator=(const AdminServer&) = delete;
+
+    ~AdminServer() {
+        close(socket_fd);
+    }
+
+    [[noreturn]] void start() {
+        while (true) {
+            sockaddr_in client{};
+            auto client_len = static_cast<socklen_t>(sizeof(client));
+            ssize_t length = recvfrom(socket_fd, buffer.data(), buffer.size(), 0,
+                                      reinterpret_cast<sockaddr*>(&client), &client_len);
+
+            if (length < 0) {
+                ensure(errno == EINTR, "Failed to receive a message on admin socket", socket_fd);
+                continue;
+            }
+
+            std::string response = handler(trim(std::string_view(buffer.data(), static_cast<size_t>(length))));
+            response.resize(std::min(response.size(), MAX_DATAGRAM));
+
+            if (sendto(socket_fd, response.data(), response.size(), 0,
+                       reinterpret_cast<sockaddr*>(&client), client_len) < 0) {
+                alert("Failed to send an admin response");
+            }
+        }
+    }
+
+private:
+    static constexpr size_t MAX_DATAGRAM = 65507;
+
+    int socket_fd = -1;
+    handler_t handler;
+    std::vector<char> buffer;
+
+    /** Commands may end with a newline, as sent by netcat */
+    static std::string_view trim(std::string_view command) {
+        while (!command.empty() && (command.back() == '\n' || command.back() == '\r' || command.back() == ' ')) {
+            command.remove_suffix(1);
+        }
+
+        return command;
+    }
+};
+
+#endif //CINEMA_SERVER_ADMIN_SERVER_H
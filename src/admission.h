@@ -0,0 +1,201 @@
+#ifndef CINEMA_SERVER_ADMISSION_H
+#define CINEMA_SERVER_ADMISSION_H
+
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+
+#include <netinet/in.h>
+
+#include "database.h"
+
+/**
+ * Token buckets of many keys in a fixed open-addressing table. A bucket is kept as
+ * the time its next token is due (the generic cell rate algorithm), so it is a single
+ * integer refilled without a timer. A bucket due in the past is full, which is the
+ * same as having no bucket at all, so it is forgotten without losing anything. A key
+ * is looked up in a short window of slots; if all of them hold other keys, the bucket
+ * that ran dry longest ago is evicted, so tables age the least recently limited keys
+ * out and never grow.
+ * @tparam Key integer key
+ */
+template<typename Key>
+class TokenBuckets {
+public:
+    /** Slots examined for a key, a window never wraps more than once */
+    static constexpr size_t PROBES = 8;
+
+    /**
+     * @param rate tokens refilled per second
+     * @param burst tokens a full bucket holds
+     * @param capacity number of slots, rounded up to a power of two
+     */
+    TokenBuckets(uint64_t rate, uint64_t burst, size_t capacity) {
+        size_t slots = PROBES;
+        while (slots < capacity) {
+            slots *= 2;
+        }
+
+        buckets.resize(slots);
+        slot_mask = slots - 1;
+        interval = std::max<uint64_t>(NANOS_PER_SECOND / std::max<uint64_t>(rate, 1), 1);
+        tolerance = (std::max<uint64_t>(burst, 1) - 1) * interval;
+    }
+
+    /**
+     * Takes a token of a key.
+     * @param key key
+     * @param now current time in nanoseconds of a monotonic clock
+     * @return false if the bucket is empty
+     */
+    bool take(Key key, uint64_t now) {
+        Bucket& bucket = this->find(key, now);
+
+        if (bucket.due > now + tolerance)
+            return false;
+
+        bucket.due = std::max(bucket.due, now) + interval;
+        return true;
+    }
+
+    /** Whether take() would succeed at @p now, without taking a token */
+    bool has_token(Key key, uint64_t now) const {
+        for (size_t probe = 0; probe < PROBES; probe++) {
+            const Bucket& bucket = buckets[(this->home(key) + probe) & slot_mask];
+
+            if (bucket.key == key && bucket.due > now)
+                return bucket.due <= now + tolerance;
+        }
+
+        return true;
+    }
+
+private:
+    static constexpr uint64_t NANOS_PER_SECOND = 1000000000;
+
+    struct Bucket {
+        Key key{};
+        uint64_t due = 0; /** Time the next token is due, a bucket due before now is full */
+    };
+
+    std::vector<Bucket> buckets;
+    size_t slot_mask;
+    uint64_t interval; /** Nanoseconds per token */
+    uint64_t tolerance; /** How far a bucket may be due ahead of now, a burst less a token */
+
+    /** Fibonacci hashing, spreads consecutive keys */
+    size_t home(Key key) const {
+        return static_cast<size_t>((static_cast<uint64_t>(key) * 0x9E3779B97F4A7C15ull) >> 32) & slot_mask;
+    }
+
+    /** Gives the bucket of a key, replacing a full or the longest-idle one of the window if it has none */
+    Bucket& find(Key key, uint64_t now) {
+        Bucket* victim = nullptr;
+
+        for (size_t probe = 0; probe < PROBES; probe++) {
+            Bucket& bucket = buckets[(this->home(key) + probe) & slot_mask];
+
+            if (bucket.key == key)
+                return bucket;
+
+            if (victim == nullptr || (victim->due > now && bucket.due < victim->due)) {
+                victim = &bucket;
+            }
+        }
+
+        *victim = {key, now};
+        return *victim;
+    }
+};
+
+/**
+ * Reservations waiting for tickets of a hot event to be admitted. Every event
+ * admits reservations at a fixed rate, requests above it wait in a bounded FIFO
+ * and are served as soon as their event has a token again, so clients are served
+ * in the order they asked instead of whoever retries fastest. A request waiting
+ * longer than MAX_WAIT is dropped, its client has likely given up.
+ * Used by a single worker.
+ */
+class AdmissionQueue {
+public:
+    /** Reservation request kept until it is admitted */
+    struct Deferred {
+        sockaddr_storage client;
+        uint32_t listener; /** Socket which received the request */
+        Database::ReservationRequest request;
+        uint64_t deadline; /** Time after which the request is dropped */
+    };
+
+    static constexpr uint64_t MAX_WAIT = 1000000000; /** Nanoseconds */
+
+    /** Number of distinct events tracked by a queue */
+    static constexpr size_t EVENT_SLOTS = 1 << 14;
+
+    /**
+     * @param rate reservations admitted per second for every event
+     * @param capacity maximal number of waiting requests
+     */
+    AdmissionQueue(uint64_t rate, size_t capacity) : events(rate, rate, EVENT_SLOTS), capacity(capacity) {
+        waiting.reserve(capacity);
+    }
+
+    /** Takes a token of an event, drain() must come first so that waiting requests get tokens first */
+    bool admit(Database::event_id event, uint64_t now) {
+        return events.take(event, now);
+    }
+
+    /** Whether admit() would succeed, without taking a token */
+    bool has_token(Database::event_id event, uint64_t now) const {
+        return events.has_token(event, now);
+    }
+
+    /**
+     * Queues a request which was not admitted.
+     * @return false if the queue is full and the request is dropped
+     */
+    bool defer(const sockaddr_storage& client, uint32_t listener, const Database::ReservationRequest& request,
+               uint64_t now) {
+        if (waiting.size() == capacity)
+            return false;
+
+        waiting.push_back({client, listener, request, now + MAX_WAIT});
+        return true;
+    }
+
+    /**
+     * Serves waiting requests whose events have tokens, in their arrival order.
+     * @param now current time in nanoseconds of a monotonic clock
+     * @param limit maximal number of served requests
+     * @param visit callable invoked with every admitted Deferred
+     * @return number of requests dropped after MAX_WAIT
+     */
+    template<typename Visitor>
+    size_t drain(uint64_t now, size_t limit, Visitor&& visit) {
+        size_t kept = 0, dropped = 0;
+
+        for (Deferred& deferred : waiting) {
+            if (deferred.deadline < now) {
+                dropped++;
+            } else if (limit > 0 && events.take(deferred.request.event, now)) {
+                visit(deferred);
+                limit--;
+            } else {
+                waiting[kept++] = deferred;
+            }
+        }
+
+        waiting.resize(kept);
+        return dropped;
+    }
+
+    bool empty() const {
+        return waiting.empty();
+    }
+
+private:
+    TokenBuckets<Database::event_id> events;
+    std::vector<Deferred> waiting; /** Oldest first */
+    size_t capacity;
+};
+
+#endif //CINEMA_SERVER_ADMISSION_H
@@ -0,0 +1,62 @@
+#include <new>
+#include <cstddef>
+#include <cstdlib>
+#include <algorithm>
+
+#include "allocations.h"
+
+namespace {
+    /**
+     * Counts an allocation and makes it as the default operator new does,
+     * retried while a new handler may free memory.
+     * @param alignment alignment of the memory, at least that of malloc
+     */
+    void* counted_allocation(std::size_t size, std::size_t alignment) {
+        if (allocations::counter != nullptr) {
+            allocations::counter->add();
+        }
+
+        size = std::max<std::size_t>(size, 1);
+
+        while (true) {
+            /* aligned_alloc takes only multiples of the alignment */
+            if (void* memory = alignment <= alignof(std::max_align_t)
+                               ? std::malloc(size)
+                               : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment))
+                return memory;
+
+            std::new_handler handler = std::get_new_handler();
+
+            if (handler == nullptr)
+                throw std::bad_alloc();
+
+            handler();
+        }
+    }
+}
+
+/* Replaces the global operator new of the program linking this file, see allocations.h */
+void* operator new(std::size_t size) {
+    return counted_allocation(size, alignof(std::max_align_t));
+}
+
+/* Used by memory resources, such as the upstream of a pool */
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    return counted_allocation(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept {
+    std::free(memory);
+}
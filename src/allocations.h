@@ -0,0 +1,23 @@
+#ifndef CINEMA_SERVER_ALLOCATIONS_H
+#define CINEMA_SERVER_ALLOCATIONS_H
+
+#include "metrics.h"
+
+/**
+ * Counting of heap allocations per thread, to check that the request path of
+ * a worker does not allocate once its tables have grown. The global operator
+ * new is replaced by allocations.cpp, which a program counting allocations
+ * links. Aligned allocations, which memory resources make, count too;
+ * allocations of threads which never started counting do not.
+ */
+namespace allocations {
+    /** Counter of the calling thread, written only by it */
+    inline thread_local Counter* counter = nullptr;
+
+    /** Counts further allocations of the calling thread into @p counter, nullptr stops counting */
+    inline void count(Counter* counter) {
+        allocations::counter = counter;
+    }
+}
+
+#endif //CINEMA_SERVER_ALLOCATIONS_H
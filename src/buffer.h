@@ -1,79 +1,117 @@
 #ifndef CINEMA_SERVER_BUFFER_H
 #define CINEMA_SERVER_BUFFER_H
 
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
 #include <type_traits>
 
+/*
+ * Wire codec: integers and enums are written in network byte order, byte arrays
+ * and strings as they are. Every field is copied straight into the output buffer
+ * and read with memcpy, so fields need no alignment.
+ *
+ * Bounds are not checked per field. Every reader checks the length of a whole message
+ * once before reading its fields: RequestHandler matches a request against the length
+ * its type requires, other readers compare what they received with the length they
+ * expect. Responses are written into buffers of MAX_DATAGRAM octets, which fixed messages
+ * fit by their message_size() and variable ones are sized to before writing.
+ */
+
 namespace {
-    /** Gives the number of octets required to store a variable. */
     template<typename T>
-    inline constexpr size_t bytes(const T& data) {
-        if constexpr (std::is_convertible_v<T, std::string>) {
-            return data.size();
+    struct is_byte_array : std::false_type {};
+
+    template<size_t N>
+    struct is_byte_array<std::array<char, N>> : std::true_type {};
+
+    /** Converts an integer between host and network byte order, the conversion is its own inverse */
+    template<typename T>
+    inline constexpr T network_order(T value) {
+        static_assert(std::is_integral_v<T>, "Only integers have a byte order");
+
+        if constexpr (sizeof(T) == 1 || __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__) {
+            return value;
+        } else if constexpr (sizeof(T) == 2) {
+            return static_cast<T>(__builtin_bswap16(static_cast<uint16_t>(value)));
+        } else if constexpr (sizeof(T) == 4) {
+            return static_cast<T>(__builtin_bswap32(static_cast<uint32_t>(value)));
         } else {
-            return sizeof(data);
+            static_assert(sizeof(T) == 8, "Unsupported integer size");
+            return static_cast<T>(__builtin_bswap64(static_cast<uint64_t>(value)));
         }
     }
-}
 
-/**
- * Writes a generic data of a given size to a buffer
- * @tparam Arg type of a data
- * @param dest buffer
- * @param src data to write
- * @param size octets per source
- * @return @p size
- */
-template<typename Arg>
-inline size_t buffer_write(char* dest, Arg&& src, size_t size) {
-    if constexpr (std::is_convertible_v<Arg, std::string>) {
-        memcpy(dest, const_cast<char*>(src.c_str()), size);
-    } else {
-        memcpy(dest, reinterpret_cast<char*>(&src), size);
+    /** Writes a single field, see buffer_write() */
+    template<typename T>
+    inline size_t write_field(char* dest, const T& field) {
+        if constexpr (std::is_enum_v<T>) {
+            return write_field(dest, static_cast<std::underlying_type_t<T>>(field));
+        } else if constexpr (std::is_integral_v<T>) {
+            T value = network_order(field);
+            memcpy(dest, &value, sizeof(value));
+            return sizeof(value);
+        } else if constexpr (is_byte_array<T>::value) {
+            memcpy(dest, field.data(), field.size());
+            return field.size();
+        } else {
+            static_assert(std::is_convertible_v<const T&, std::string_view>, "Unsupported field type");
+            std::string_view text(field);
+            memcpy(dest, text.data(), text.size());
+            return text.size();
+        }
     }
-
-    return size;
 }
 
-/**
- * Writes generic data to a buffer and returns it's size in octets.
- * See buffer_write(char*, Arg&&, size_t)
- */
-template<typename Arg>
-inline size_t buffer_write(char* dest, Arg&& src) {
-    return buffer_write(dest, src, bytes(src));
-}
+/** Whether a field has the same size in every message: integers, enums and byte arrays */
+template<typename T>
+constexpr bool is_fixed_field_v = std::is_integral_v<T> || std::is_enum_v<T> || is_byte_array<T>::value;
 
 /**
- * Writes an arbitrary number of generic data to a buffer
- * and returns number of written octets. See buffer_write(char*, Arg&&)
+ * Gives the size of a message made of fixed fields at compile time.
+ * @tparam Fields types of consecutive fields
+ * @return number of octets
  */
-template<typename Arg, typename... Args>
-inline size_t buffer_write(char* dest, Arg&& src_head, Args&&... src_tail) {
-    size_t written = buffer_write(dest, std::forward<Arg>(src_head));
-    return written + buffer_write(dest + written, std::forward<Args>(src_tail)...);
+template<typename... Fields>
+inline constexpr size_t message_size() {
+    static_assert((is_fixed_field_v<Fields> && ...), "Message size depends on its strings");
+    return (sizeof(Fields) + ... + 0);
 }
 
 /**
- * Reads a pointer from buffer
- * @tparam Arg underlying type of a pointer
- * @param buffer buffer
- * @param offset number of bytes to skip
- * @return pointer to @p buffer + @p offset
+ * Writes fields one after another, integers and enums in network byte order,
+ * byte arrays and anything convertible to std::string_view verbatim.
+ * @param dest buffer large enough for all fields
+ * @param fields fields to write
+ * @return number of written octets
  */
-template<typename Arg>
-inline Arg* buffer_read(char* buffer, size_t offset) {
-    return reinterpret_cast<Arg*>(buffer + offset);
+template<typename... Fields>
+inline size_t buffer_write(char* dest, const Fields&... fields) {
+    size_t written = 0;
+    ((written += write_field(dest + written, fields)), ...);
+    return written;
 }
 
 /**
- * Converts buffer to a string.
+ * Reads a fixed field from a buffer, converting integers to host byte order.
+ * @tparam T type of the field
  * @param buffer buffer
- * @param offset number of bytes to skip
- * @param len lengths a string to extract
- * @return string
+ * @param offset number of octets to skip, there is no alignment requirement
+ * @return field value
  */
-inline std::string buffer_to_string(char* buffer, size_t offset, size_t len = 1) {
-    return {buffer + offset, len};
+template<typename T>
+inline T buffer_read(const char* buffer, size_t offset) {
+    static_assert(is_fixed_field_v<T> && !std::is_enum_v<T>, "Only integers and byte arrays are read");
+
+    T value;
+    memcpy(&value, buffer + offset, sizeof(value));
+
+    if constexpr (std::is_integral_v<T>) {
+        return network_order(value);
+    } else {
+        return value;
+    }
 }
 
 #endif //CINEMA_SERVER_BUFFER_H
@@ -0,0 +1,350 @@
+#ifndef CINEMA_SERVER_CATALOG_H
+#define CINEMA_SERVER_CATALOG_H
+
+#include <thread>
+#include <string>
+#include <vector>
+#include <numeric>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <string_view>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "ensure.h"
+
+/**
+ * Events as structure of arrays: event i has tickets[i] tickets and its
+ * description occupies descriptions[offsets[i]] to descriptions[offsets[i + 1]].
+ */
+struct Catalog {
+    std::vector<uint16_t> tickets;
+    std::vector<uint32_t> offsets{0};
+    std::vector<char> descriptions;
+
+    size_t size() const {
+        return tickets.size();
+    }
+
+    std::string_view description(size_t event) const {
+        return {descriptions.data() + offsets[event], offsets[event + 1] - offsets[event]};
+    }
+};
+
+namespace {
+    /** Leading octets of a binary catalog snapshot */
+    constexpr char CATALOG_MAGIC[8] = {'C', 'S', 'E', 'V', 'E', 'N', 'T', 'S'};
+    constexpr uint32_t CATALOG_VERSION = 1;
+
+    /** Written in host byte order, a snapshot reading differently comes from another byte order */
+    constexpr uint32_t CATALOG_BYTE_ORDER = 0x01020304;
+
+    /** Header of a binary snapshot, followed by tickets, offsets and descriptions in the byte order of the writer */
+    struct CatalogHeader {
+        char magic[sizeof(CATALOG_MAGIC)];
+        uint32_t version;
+        uint32_t events;
+        uint32_t byte_order;
+    };
+
+    /** Smallest part of a text file worth a separate thread */
+    constexpr size_t MIN_CATALOG_CHUNK = 1 << 20;
+
+    /** Read-only mapping of a whole file, unmapped on destruction */
+    class MappedFile {
+    public:
+        explicit MappedFile(const std::string& name) {
+            int fd = open(name.c_str(), O_RDONLY);
+            ensure(fd != -1, "File", name, "does not exist");
+
+            struct stat status{};
+            ensure(fstat(fd, &status) != -1 && S_ISREG(status.st_mode), "File", name, "is not a regular file");
+            length = static_cast<size_t>(status.st_size);
+
+            if (length > 0) {
+                void* mapping = mmap(nullptr, length, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+                ensure(mapping != MAP_FAILED, "Failed to map file", name);
+                contents = static_cast<const char*>(mapping);
+            }
+
+            close(fd);
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        ~MappedFile() {
+            if (length > 0) {
+                munmap(const_cast<char*>(contents), length);
+            }
+        }
+
+        const char* begin() const {
+            return contents;
+        }
+
+        const char* end() const {
+            return contents + length;
+        }
+
+        size_t size() const {
+            return length;
+        }
+
+    private:
+        const char* contents = nullptr;
+        size_t length = 0;
+    };
+
+    /** Counts newline characters, 16 octets at once when SSE2 is available */
+    inline size_t count_newlines(const char* begin, const char* end) {
+        size_t newlines = 0;
+
+#ifdef __SSE2__
+        const __m128i newline = _mm_set1_epi8('\n');
+
+        for (; begin + sizeof(__m128i) <= end; begin += sizeof(__m128i)) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+            auto mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+            newlines += static_cast<size_t>(__builtin_popcount(mask));
+        }
+#endif
+
+        return newlines + static_cast<size_t>(std::count(begin, end, '\n'));
+    }
+
+    /** Finds the next newline character or gives @p end */
+    inline const char* find_newline(const char* begin, const char* end) {
+#ifdef __SSE2__
+        const __m128i newline = _mm_set1_epi8('\n');
+
+        for (; begin + sizeof(__m128i) <= end; begin += sizeof(__m128i)) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+            auto mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+
+            if (mask != 0)
+                return begin + __builtin_ctz(mask);
+        }
+#endif
+
+        return std::find(begin, end, '\n');
+    }
+
+    /**
+     * Parses a ticket count: skips leading blanks, reads decimal digits
+     * and saturates at the maximal count. A line without digits gives 0.
+     */
+    inline uint16_t parse_tickets(const char* begin, const char* end) {
+        while (begin != end && (*begin == ' ' || *begin == '\t'))
+            begin++;
+
+        uint32_t value = 0;
+        for (; begin != end && *begin >= '0' && *begin <= '9'; begin++) {
+            value = std::min<uint32_t>(value * 10 + static_cast<uint32_t>(*begin - '0'), UINT16_MAX);
+        }
+
+        return static_cast<uint16_t>(value);
+    }
+
+    /** Runs @p work(part) for every part on its own thread, the first one on the caller */
+    template<typename Work>
+    inline void parallel_for(size_t parts, Work&& work) {
+        std::vector<std::thread> threads;
+
+        for (size_t part = 1; part < parts; part++) {
+            threads.emplace_back(work, part);
+        }
+
+        work(0);
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    inline bool has_catalog_magic(const MappedFile& file) {
+        return file.size() >= sizeof(CATALOG_MAGIC) && memcmp(file.begin(), CATALOG_MAGIC, sizeof(CATALOG_MAGIC)) == 0;
+    }
+
+    /**
+     * Validates the layout of a binary snapshot: a known version, the byte order of the host
+     * and sections adding up to the size of the file, so a text file is never taken for one.
+     */
+    inline bool is_catalog_snapshot(const MappedFile& file) {
+        if (!has_catalog_magic(file) || file.size() < sizeof(CatalogHeader))
+            return false;
+
+        CatalogHeader header{};
+        memcpy(&header, file.begin(), sizeof(header));
+
+        if (header.version != CATALOG_VERSION || header.byte_order != CATALOG_BYTE_ORDER)
+            return false;
+
+        /* Sizes in size_t, so the largest event count overflows none of them */
+        size_t events = header.events;
+        size_t descriptions_at = sizeof(header) + events * sizeof(uint16_t) + (events + 1) * sizeof(uint32_t);
+
+        if (descriptions_at > file.size())
+            return false;
+
+        uint32_t descriptions_bytes = 0;
+        memcpy(&descriptions_bytes, file.begin() + descriptions_at - sizeof(uint32_t), sizeof(uint32_t));
+
+        return descriptions_at + descriptions_bytes == file.size();
+    }
+
+    /** Loads a snapshot validated by is_catalog_snapshot() */
+    inline Catalog load_catalog_snapshot(const MappedFile& file, const std::string& name) {
+        CatalogHeader header{};
+        memcpy(&header, file.begin(), sizeof(header));
+
+        Catalog catalog;
+        size_t events = header.events;
+        size_t tickets_bytes = events * sizeof(uint16_t);
+        size_t offsets_bytes = (events + 1) * sizeof(uint32_t);
+        const char* position = file.begin() + sizeof(header);
+
+        catalog.tickets.resize(events);
+        memcpy(catalog.tickets.data(), position, tickets_bytes);
+        position += tickets_bytes;
+
+        catalog.offsets.resize(events + 1);
+        memcpy(catalog.offsets.data(), position, offsets_bytes);
+        position += offsets_bytes;
+
+        /* Descriptions are sliced by the offsets without further checks */
+        ensure(catalog.offsets.front() == 0 && std::is_sorted(catalog.offsets.begin(), catalog.offsets.end()),
+               "Snapshot", name, "has corrupt description offsets");
+
+        /* All descriptions in a single allocation */
+        catalog.descriptions.assign(position, position + catalog.offsets.back());
+
+        return catalog;
+    }
+
+    /**
+     * Parses pairs of lines: description and ticket count. The file is split
+     * into chunks handled by separate threads: first every chunk counts its
+     * newlines, which gives the number of the first line starting in each
+     * chunk, then every chunk parses the lines starting in it.
+     */
+    inline Catalog load_catalog_text(const MappedFile& file) {
+        const char* text = file.begin();
+        size_t length = file.size();
+        size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+        size_t chunks = std::clamp<size_t>(length / MIN_CATALOG_CHUNK, 1, hardware);
+
+        auto chunk_begin = [&](size_t chunk) {return text + length * chunk / chunks;};
+        std::vector<size_t> first_line(chunks + 1, 0);
+
+        parallel_for(chunks, [&](size_t chunk) {
+            first_line[chunk + 1] = count_newlines(chunk_begin(chunk), chunk_begin(chunk + 1));
+        });
+
+        std::partial_sum(first_line.begin(), first_line.end(), first_line.begin());
+
+        /* The last line does not need to end with a newline */
+        size_t lines = first_line[chunks] + (length > 0 && text[length - 1] != '\n' ? 1 : 0);
+        size_t events = lines / 2;
+
+        Catalog catalog;
+        catalog.tickets.resize(events);
+        catalog.offsets.assign(events + 1, 0);
+        std::vector<const char*> starts(events);
+
+        parallel_for(chunks, [&](size_t chunk) {
+            const char* end = chunk_begin(chunk + 1);
+            const char* line = chunk_begin(chunk);
+            size_t line_number = first_line[chunk];
+
+            /* Skip the line started in the previous chunk */
+            if (line != text && line[-1] != '\n') {
+                line = find_newline(line, file.end()) + 1;
+                line_number++;
+            }
+
+            for (; line < end && line_number / 2 < events; line_number++) {
+                const char* line_end = find_newline(line, file.end());
+                size_t event = line_number / 2;
+
+                if (line_number % 2 == 0) {
+                    starts[event] = line;
+                    catalog.offsets[event + 1] = static_cast<uint32_t>(line_end - line);
+                } else {
+                    catalog.tickets[event] = parse_tickets(line, line_end);
+                }
+
+                line = line_end + 1;
+            }
+        });
+
+        std::partial_sum(catalog.offsets.begin(), catalog.offsets.end(), catalog.offsets.begin());
+        catalog.descriptions.resize(catalog.offsets.back());
+
+        parallel_for(chunks, [&](size_t chunk) {
+            for (size_t event = events * chunk / chunks; event < events * (chunk + 1) / chunks; event++) {
+                size_t description_length = catalog.offsets[event + 1] - catalog.offsets[event];
+                memcpy(catalog.descriptions.data() + catalog.offsets[event], starts[event], description_length);
+            }
+        });
+
+        return catalog;
+    }
+}
+
+/**
+ * Loads events from a text file of description and ticket count lines
+ * or from a binary snapshot written by save_catalog(), recognized by its magic
+ * and validated by its header. A file failing validation is parsed as text.
+ * @param name path to the file
+ * @return loaded events
+ */
+inline Catalog load_catalog(const std::string& name) {
+    MappedFile file(name);
+
+    if (is_catalog_snapshot(file))
+        return load_catalog_snapshot(file, name);
+
+    if (has_catalog_magic(file)) {
+        alert("File", name, "is not a snapshot of this version and byte order, parsing it as text");
+    }
+
+    return load_catalog_text(file);
+}
+
+/**
+ * Writes a binary snapshot of events, which loads without parsing.
+ * @param catalog events
+ * @param name path to the snapshot
+ */
+inline void save_catalog(const Catalog& catalog, const std::string& name) {
+    CatalogHeader header{};
+    memcpy(header.magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+    header.version = CATALOG_VERSION;
+    header.events = static_cast<uint32_t>(catalog.size());
+    header.byte_order = CATALOG_BYTE_ORDER;
+
+    int fd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    ensure(fd != -1, "Failed to create snapshot", name);
+
+    auto write_all = [&](const void* data, size_t bytes) {
+        ensure(write(fd, data, bytes) == static_cast<ssize_t>(bytes), "Failed to write snapshot", name);
+    };
+
+    write_all(&header, sizeof(header));
+    write_all(catalog.tickets.data(), catalog.tickets.size() * sizeof(uint16_t));
+    write_all(catalog.offsets.data(), catalog.offsets.size() * sizeof(uint32_t));
+    write_all(catalog.descriptions.data(), catalog.descriptions.size());
+
+    ensure(close(fd) != -1, "Failed to close snapshot", name);
+}
+
+#endif //CINEMA_SERVER_CATALOG_H
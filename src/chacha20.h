@@ -0,0 +1,104 @@
+#ifndef CINEMA_SERVER_CHACHA20_H
+#define CINEMA_SERVER_CHACHA20_H
+
+#include <array>
+#include <cstdint>
+#include <algorithm>
+
+#include <sys/random.h>
+
+#include "ensure.h"
+
+/**
+ * ChaCha20 keystream (RFC 8439) used as a cryptographically secure random
+ * generator. The key and nonce come from getrandom once, afterwards random
+ * words cost a fraction of a block function call and no system calls.
+ * An instance is not thread-safe, every thread should own one.
+ */
+class ChaCha20 {
+public:
+    ChaCha20() {
+        this->reseed();
+    }
+
+    /** Gives the next 32 random bits */
+    uint32_t next() {
+        if (position == block.size()) {
+            this->refill();
+        }
+
+        return block[position++];
+    }
+
+    /** Fills @p count words with random bits */
+    void fill(uint32_t* dest, size_t count) {
+        for (size_t i = 0; i < count; i++) {
+            dest[i] = this->next();
+        }
+    }
+
+private:
+    static constexpr size_t WORDS = 16;
+    static constexpr size_t KEY_WORDS = 8;
+    static constexpr size_t NONCE_WORDS = 3;
+    static constexpr size_t COUNTER = 12;
+    static constexpr size_t DOUBLE_ROUNDS = 10;
+
+    /** "expand 32-byte k" */
+    static constexpr std::array<uint32_t, 4> CONSTANTS = {0x61707865, 0x3320646e, 0x79622d32, 0x6b206574};
+
+    std::array<uint32_t, WORDS> state{};
+    std::array<uint32_t, WORDS> block{};
+    size_t position = WORDS; /** Next unused word of block */
+
+    static uint32_t rotate(uint32_t value, int bits) {
+        return (value << bits) | (value >> (32 - bits));
+    }
+
+    static void quarter_round(uint32_t& a, uint32_t& b, uint32_t& c, uint32_t& d) {
+        a += b; d ^= a; d = rotate(d, 16);
+        c += d; b ^= c; b = rotate(b, 12);
+        a += b; d ^= a; d = rotate(d, 8);
+        c += d; b ^= c; b = rotate(b, 7);
+    }
+
+    /** Draws a fresh key and nonce from the kernel */
+    void reseed() {
+        std::array<uint32_t, KEY_WORDS + NONCE_WORDS> seed{};
+        auto seed_bytes = static_cast<ssize_t>(sizeof(seed));
+        ensure(getrandom(seed.data(), sizeof(seed), 0) == seed_bytes, "Failed to seed random generator");
+
+        std::copy(CONSTANTS.begin(), CONSTANTS.end(), state.begin());
+        std::copy(seed.begin(), seed.begin() + KEY_WORDS, state.begin() + CONSTANTS.size());
+        state[COUNTER] = 0;
+        std::copy(seed.begin() + KEY_WORDS, seed.end(), state.begin() + COUNTER + 1);
+    }
+
+    void refill() {
+        block = state;
+
+        for (size_t round = 0; round < DOUBLE_ROUNDS; round++) {
+            quarter_round(block[0], block[4], block[8], block[12]);
+            quarter_round(block[1], block[5], block[9], block[13]);
+            quarter_round(block[2], block[6], block[10], block[14]);
+            quarter_round(block[3], block[7], block[11], block[15]);
+            quarter_round(block[0], block[5], block[10], block[15]);
+            quarter_round(block[1], block[6], block[11], block[12]);
+            quarter_round(block[2], block[7], block[8], block[13]);
+            quarter_round(block[3], block[4], block[9], block[14]);
+        }
+
+        for (size_t i = 0; i < WORDS; i++) {
+            block[i] += state[i];
+        }
+
+        /* Never reuse a (key, nonce, counter) triple */
+        if (++state[COUNTER] == 0) {
+            this->reseed();
+        }
+
+        position = 0;
+    }
+};
+
+#endif //CINEMA_SERVER_CHACHA20_H
@@ -0,0 +1,70 @@
+#ifndef CINEMA_SERVER_CLOCK_H
+#define CINEMA_SERVER_CLOCK_H
+
+#include <ctime>
+#include <atomic>
+#include <cstdint>
+
+namespace {
+    constexpr uint64_t MILLIS_PER_SECOND = 1000;
+    constexpr uint64_t NANOS_PER_MILLI = 1000000;
+
+    inline uint64_t read_millis(clockid_t clock) {
+        timespec time{};
+        clock_gettime(clock, &time);
+        return static_cast<uint64_t>(time.tv_sec) * MILLIS_PER_SECOND
+               + static_cast<uint64_t>(time.tv_nsec) / NANOS_PER_MILLI;
+    }
+}
+
+/**
+ * Coarse time cached for the request path. Workers refresh it once per event
+ * loop tick, requests read a relaxed atomic instead of calling into the vDSO.
+ * Expiration follows the monotonic clock, so it is immune to wall clock jumps,
+ * wall time is only given to clients and written to the journal.
+ */
+class Clock {
+public:
+    /** Refreshes the cached time, monotonic readings of racing workers never move it back */
+    static void tick() {
+        Clock::advance(monotonic_millis, read_millis(CLOCK_MONOTONIC_COARSE));
+        wall_seconds.store(read_millis(CLOCK_REALTIME_COARSE) / MILLIS_PER_SECOND, std::memory_order_relaxed);
+    }
+
+    /** Monotonic seconds as of the last tick */
+    static uint64_t now() {
+        return Clock::millis() / MILLIS_PER_SECOND;
+    }
+
+    /** Monotonic milliseconds as of the last tick */
+    static uint64_t millis() {
+        return monotonic_millis.load(std::memory_order_relaxed);
+    }
+
+    /** Seconds since the Unix epoch as of the last tick */
+    static uint64_t wall_now() {
+        return wall_seconds.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Converts a wall time to the monotonic clock, as far as the two clocks agree now.
+     * @param wall seconds since the Unix epoch
+     * @return monotonic seconds, at least now()
+     */
+    static uint64_t to_monotonic(uint64_t wall) {
+        uint64_t wall_now = Clock::wall_now();
+        return Clock::now() + (wall > wall_now ? wall - wall_now : 0);
+    }
+
+private:
+    static inline std::atomic<uint64_t> monotonic_millis{read_millis(CLOCK_MONOTONIC_COARSE)};
+    static inline std::atomic<uint64_t> wall_seconds{read_millis(CLOCK_REALTIME_COARSE) / MILLIS_PER_SECOND};
+
+    static void advance(std::atomic<uint64_t>& cached, uint64_t value) {
+        uint64_t previous = cached.load(std::memory_order_relaxed);
+
+        while (previous < value && !cached.compare_exchange_weak(previous, value, std::memory_order_relaxed)) {}
+    }
+};
+
+#endif //CINEMA_SERVER_CLOCK_H
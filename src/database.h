@@ -0,0 +1,1448 @@
+#ifndef CINEMA_SERVER_DATABASE_H
+#define CINEMA_SERVER_DATABASE_H
+
+#include <array>
+#include <mutex>
+#include <limits>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <optional>
+#include <algorithm>
+#include <memory_resource>
+
+#include <arpa/inet.h>
+
+#include "ensure.h"
+#include "buffer.h"
+#include "catalog.h"
+#include "clock.h"
+#include "chacha20.h"
+#include "events_cache.h"
+#include "journal.h"
+#include "id_table.h"
+#include "slab.h"
+#include "seqlock.h"
+#include "timer_wheel.h"
+
+namespace {
+    template<typename Number, std::enable_if_t<std::is_arithmetic_v<Number>, bool> = true>
+    constexpr bool is_between(Number value, Number min, Number max) noexcept {
+        return value >= min && value <= max;
+    }
+}
+
+/**
+ * Events and reservations split into shards by event id. Each shard owns
+ * its events together with all reservations made for them and is guarded
+ * by its own mutex, so requests concerning different shards never contend.
+ * Reservation ids carry the shard index, therefore they stay globally unique.
+ * Events themselves are dense arrays indexed by event id, an event's ticket
+ * count is guarded by the lock of its shard. Events are replaced as a whole
+ * by reload(), which moves one shard at a time to the new ones. Counts for
+ * introspection are mirrored into atomics, see event_counts(), so reading
+ * them never takes a lock.
+ */
+class Database {
+public:
+    using desclen_t      = uint8_t;
+    using tickets_t      = uint16_t;
+    using event_id       = uint32_t;
+    using reservation_id = uint32_t;
+    using seconds_t      = uint64_t;
+
+    static constexpr uint32_t MIN_TIMEOUT     = 1;
+    static constexpr uint32_t DEFAULT_TIMEOUT = 5;
+    static constexpr uint32_t MAX_TIMEOUT     = 86400;
+
+    /** Minimal possible ID of a reservation */
+    static constexpr reservation_id MIN_RESERVATION_ID = 1000000;
+
+    /** Length of a cookie to confirm a reservation */
+    static constexpr size_t COOKIE_LEN = 48;
+
+    using cookie_t = std::array<char, COOKIE_LEN>;
+
+    /** Maximal number of tickets to reserve in a single request */
+    static constexpr tickets_t MAX_TICKETS = 9357;
+
+    /** Maximal number of events reserved together by reserve_all() */
+    static constexpr size_t MAX_BULK_RESERVATIONS = 255;
+
+    /**
+     * Maximal number of reservations held at once in a single shard by default.
+     * Further ids of the shard tell generations of a reservation slot apart.
+     */
+    static constexpr size_t MAX_SHARD_RESERVATIONS = 1 << 22;
+
+    /** Bought reservations a shard has room for before its table of them grows */
+    static constexpr size_t BOUGHT_CAPACITY = 1 << 10;
+
+    /** Seconds a bought reservation is kept after its expiration time by default, see purchase() */
+    static constexpr seconds_t BOUGHT_RETENTION = 3600;
+
+    /** Maximal number of reservations removed by a single expire_reservations call */
+    static constexpr size_t EXPIRATION_BATCH = 4096;
+
+    /** Space for serialized events in an EVENTS datagram, without its type octet */
+    static constexpr size_t MAX_EVENTS_PAYLOAD = 65506;
+
+    /** Space for serialized events in an EVENTS_PAGE datagram, without its type octet and cursor */
+    static constexpr size_t MAX_EVENTS_PAGE_PAYLOAD = MAX_EVENTS_PAYLOAD - sizeof(event_id);
+
+    /** Cursor following the page with the last event */
+    static constexpr event_id END_OF_EVENTS = std::numeric_limits<event_id>::max();
+
+    /** Reservation confirmed to a client */
+    struct Reservation {
+        reservation_id id;
+        cookie_t cookie;
+        seconds_t expiration_time;
+    };
+
+    /** Tickets requested for a single event, see reserve_all() */
+    struct ReservationRequest {
+        event_id event;
+        tickets_t tickets;
+    };
+
+    /** Counts of an event, see event_counts() */
+    struct EventCounts {
+        event_id event;
+        tickets_t available; /** Tickets on sale */
+        uint32_t held; /** Reservations whose tickets were not bought yet */
+    };
+
+    /** Held reservations expiring soon, see expiring_within() */
+    struct Expiring {
+        uint64_t reservations;
+        uint64_t tickets;
+    };
+
+    /** Serialized events starting with a cursor, see events_page() */
+    struct EventsPage {
+        EventsCache::snapshot_ptr events; /** Snapshot of the page, nullptr if empty */
+        size_t offset; /** Offset of the first requested event in the snapshot */
+        event_id next; /** Cursor of the following page or END_OF_EVENTS */
+    };
+
+    /**
+     * @param catalog initial events
+     * @param timeout seconds for buying reserved tickets
+     * @param shard_count number of shards
+     * @param journal path of a journal, state saved in it is restored and all changes are
+     * recorded in it; without it all state lives only in memory
+     * @param hot_events events reserved in the shard of the calling worker, see reserve()
+     * @param held_reservations reservations held at once in a shard, bought ones do not count;
+     * it must stay the same for a journal
+     * @param bought_retention seconds a bought reservation is kept after its expiration time
+     */
+    Database(Catalog catalog, uint32_t timeout, size_t shard_count,
+             const std::optional<std::string>& journal = std::nullopt, const std::vector<event_id>& hot_events = {},
+             size_t held_reservations = MAX_SHARD_RESERVATIONS, seconds_t bought_retention = BOUGHT_RETENTION)
+        : bought_retention(bought_retention), shards(shard_count),
+          store(std::make_shared<EventStore>(std::move(catalog), &snapshot_pool)) {
+        this->set_timeout(timeout);
+        this->set_hot_events(hot_events);
+        this->initialize_shards(held_reservations);
+
+        if (journal.has_value()) {
+            this->open_journal(journal.value());
+        }
+    }
+
+    /**
+     * Reserves tickets for an event. A reservation of an ordinary event is held by the shard
+     * of the event, so its requests are serialized by one lock. A hot event is reserved in
+     * the shard of the calling worker instead and its tickets are taken from a counter shared
+     * by all shards, so workers sell it in parallel and each one expires its own reservations.
+     * @param event event id
+     * @param tickets number of tickets
+     * @param worker shard of the calling worker
+     * @return reservation or std::nullopt if event does not exist, has not enough tickets
+     * or all reservation ids of the shard are in use
+     */
+    std::optional<Reservation> reserve(event_id event, tickets_t tickets, size_t worker) {
+        Shard& shard = this->is_hot(event) ? shards[worker] : this->event_shard(event);
+        std::lock_guard guard(shard.lock);
+
+        /* Check if server can provide the given number of tickets */
+        if (event >= shard.store->events.size() || !this->take_tickets(shard, event, tickets))
+            return std::nullopt;
+
+        auto reservation = this->create_reservation(shard, event, tickets);
+
+        if (!reservation.has_value()) {
+            this->give_tickets(shard, event, tickets);
+        }
+
+        return reservation;
+    }
+
+    /**
+     * Reserves tickets for several events, all or none of them. Every event gets
+     * a reservation of its own in its shard, all involved shards are locked together,
+     * so no other request sees a part of the reservations. An event may repeat,
+     * its requests then draw from its tickets one after another.
+     * @param requests requested events and ticket counts
+     * @param count number of requests, at most MAX_BULK_RESERVATIONS
+     * @param reservations filled with a reservation for every request, in the same order
+     * @return std::nullopt if all tickets were reserved, otherwise the first event which
+     * does not exist, has not enough tickets or whose shard has no reservation ids left
+     */
+    std::optional<event_id> reserve_all(const ReservationRequest* requests, size_t count, Reservation* reservations) {
+        bulk_shards request_shards{};
+        auto guards = this->lock_event_shards(requests, count, request_shards);
+
+        for (size_t i = 0; i < count; i++) {
+            if (requests[i].event >= this->event_store(requests[i].event).events.size())
+                return requests[i].event;
+        }
+
+        if (auto unavailable = this->unavailable_event(requests, count, request_shards); unavailable.has_value())
+            return unavailable;
+
+        /* Tickets of hot events were taken while checking */
+        for (size_t i = 0; i < count; i++) {
+            auto [event, tickets] = requests[i];
+            Shard& shard = this->event_shard(event);
+
+            if (!this->is_hot(event)) {
+                this->take_tickets(shard, event, tickets);
+            }
+
+            /* Free slots were counted, but a slot may still turn out to have no id left */
+            auto reservation = this->create_reservation(shard, event, tickets);
+
+            if (!reservation.has_value()) {
+                this->undo_reservations(requests, count, reservations, i);
+                return event;
+            }
+
+            reservations[i] = reservation.value();
+        }
+
+        return std::nullopt;
+    }
+
+    /**
+     * Buys reserved tickets on the first call, passes them to @p visit on every call until
+     * the bought reservation is pruned, bought_retention seconds after its expiration time.
+     * Tickets of a reservation are always consecutive, see tickets_write().
+     * @param reservation reservation id
+     * @param cookie cookie confirming the reservation
+     * @param visit callable invoked with the number of the first ticket, the ticket count
+     * and the last wall second the bought reservation is surely kept
+     * @return true if reservation exists and cookie matches
+     */
+    template<typename Visitor>
+    bool purchase(reservation_id reservation, const cookie_t& cookie, Visitor&& visit) {
+        if (reservation < MIN_RESERVATION_ID)
+            return false;
+
+        Shard& shard = this->reservation_shard(reservation);
+        std::lock_guard guard(shard.lock);
+
+        /* Retried after a successful GET_TICKETS request */
+        if (const reservation_data* bought = shard.bought.find(this->shard_id(reservation))) {
+            if (cookie != bought->cookie)
+                return false;
+
+            visit(bought->first_ticket, bought->tickets, bought->expiration_time + bought_retention);
+            return true;
+        }
+
+        auto slot = this->reservation_slot(reservation);
+
+        /* Check if reservation exists and cookie match */
+        if (!this->is_held(shard, reservation) || cookie != shard.reserved[slot].cookie)
+            return false;
+
+        /* Expired, but its timer has not fired yet */
+        if (shard.reserved[slot].deadline < Clock::now())
+            return false;
+
+        auto first_ticket = next_ticket.fetch_add(shard.reserved[slot].tickets, std::memory_order_relaxed);
+        const reservation_data& data = this->buy_reservation(shard, reservation, first_ticket);
+        this->record(shard, Journal::PURCHASE_RECORD, reservation, data.first_ticket);
+        this->extend_lease(shard, data.first_ticket + data.tickets);
+
+        visit(data.first_ticket, data.tickets, data.expiration_time + bought_retention);
+        return true;
+    }
+
+    /**
+     * Gives serialized events as sent in EVENTS response, without the type octet.
+     * The snapshot is immutable, it is refreshed only after ticket counts change,
+     * so most calls just share the previous one. Refreshing it reads the counts
+     * without locking any shard, each count is one its event had at some moment.
+     * @return event id, ticket count, description length and description of each event
+     */
+    EventsCache::snapshot_ptr events_snapshot() {
+        store_ptr current = std::atomic_load(&store);
+        return this->published_page(*current, current->listing, 0);
+    }
+
+    /**
+     * Gives serialized events starting with the one at @p cursor, as many as fit into
+     * an EVENTS_PAGE datagram. Events are split into fixed pages, a cursor inside
+     * a page gives the rest of it, so paging through all events sends each one once.
+     * @param cursor id of the first event, following pages start at EventsPage::next
+     * @return page, empty for the cursor equal to the number of events,
+     * or std::nullopt if the cursor is past it
+     */
+    std::optional<EventsPage> events_page(event_id cursor) {
+        store_ptr current = std::atomic_load(&store);
+        EventsCache& pages = current->pages;
+        size_t events = current->events.size();
+
+        if (cursor > events)
+            return std::nullopt;
+
+        if (cursor == events)
+            return EventsPage{nullptr, 0, END_OF_EVENTS};
+
+        size_t page = pages.page_of(cursor);
+        event_id next = pages.page_end(page);
+
+        return EventsPage{this->published_page(*current, pages, page), pages.event_offset(cursor),
+                          next == events ? END_OF_EVENTS : next};
+    }
+
+    /**
+     * Replaces all events while requests are served, keeping every reservation and
+     * bought ticket. The new events are serialized before any lock is taken, then
+     * shards move to them one at a time, each locked only while its held tickets
+     * are counted, so requests of other shards go on meanwhile. A held reservation
+     * keeps its tickets: the ticket count of an event in @p catalog is the number on
+     * sale, held ones included, and tickets of a reservation which expires later go
+     * back to the new count. Reservations of removed events can still be bought.
+     * @param catalog new events, an event keeps its id
+     */
+    void reload(Catalog catalog) {
+        std::lock_guard reload_guard(reload_lock);
+        auto next = std::make_shared<EventStore>(std::move(catalog), &snapshot_pool);
+
+        for (auto& shard : shards) {
+            std::lock_guard guard(shard.lock);
+            std::fill(shard.hot_taken.begin(), shard.hot_taken.end(), 0);
+            this->take_held_tickets(shard, *next);
+            shard.store = next;
+        }
+
+        /* Until now pages of the old events were served, their counts of moved shards lagging behind */
+        std::atomic_store(&store, next);
+
+        /* The journal snapshot is the only place telling the new events apart from the old ones */
+        if (journal != nullptr) {
+            journal->request_compaction();
+        }
+    }
+
+    /**
+     * Removes reservations of a shard which expired before now and bought ones past their
+     * retention, at most EXPIRATION_BATCH of them, so that the shard is never locked for long.
+     * @param index shard index
+     * @return number of removed reservations, EXPIRATION_BATCH if some may be left
+     */
+    size_t expire_reservations(size_t index) {
+        Shard& shard = shards[index];
+        std::lock_guard guard(shard.lock);
+        size_t expired = 0;
+
+        shard.expiration.advance(Clock::now(), EXPIRATION_BATCH, [&](reservation_id reservation) {
+            this->remove_reservation(shard, reservation);
+            this->record(shard, Journal::EXPIRE_RECORD, reservation);
+            expired++;
+        });
+
+        return expired + this->prune_bought(shard, EXPIRATION_BATCH - expired);
+    }
+
+    /**
+     * Gives the state a follower starts replicating from, see ReplicationLeader.
+     * Records committed afterwards with higher sequence numbers follow it.
+     */
+    std::string replication_state() {
+        ensure(journal != nullptr, "Replication needs a journal");
+        return this->journal_snapshot();
+    }
+
+    /** Passes records of every later journal commit to @p committed, see Journal::on_commit() */
+    void on_journal_commit(Journal::committed_t committed) {
+        ensure(journal != nullptr, "Replication needs a journal");
+        journal->on_commit(std::move(committed));
+    }
+
+    /**
+     * Applies the state of a leader given by replication_state(), before any request is handled.
+     * State and records applied before are replaced, so a follower can start over from a fresh state.
+     * @param sequences filled with the last sequence number of every shard of the leader
+     * @param leader address of the leader, for errors
+     */
+    void replicate_state(const std::string& state, std::vector<uint64_t>& sequences, const std::string& leader) {
+        this->clear_state();
+        this->restore_snapshot(state, sequences, leader);
+    }
+
+    /** Applies a record of the leader unless its state already covered it, see replicate_state() */
+    void replicate_record(Journal::RecordType type, uint16_t shard, uint64_t sequence, const char* fields,
+                          std::vector<uint64_t>& sequences, const std::string& leader) {
+        this->apply_record(type, shard, sequence, fields, sequences, leader);
+    }
+
+    /**
+     * Prepares a follower to serve requests once its leader is lost. Ticket numbers continue
+     * after the last lease of the leader, so none it sold is repeated, and the follower
+     * journals its own changes from now on.
+     * @param sequences last sequence number of every shard, as left by the replicated records
+     * @param journal path of the journal of the follower, its contents are replaced by the current state
+     */
+    void promote(const std::vector<uint64_t>& sequences, const std::optional<std::string>& journal) {
+        /* Reservations which expired since the last frame of the leader are removed at once */
+        Clock::tick();
+        this->finish_restore();
+        info("Took over", this->reservation_count(), "reservations from the leader");
+
+        if (journal.has_value()) {
+            this->start_journal(journal.value(), sequences);
+        }
+    }
+
+    /**
+     * Number of held reservations in all shards, neither expired nor bought. Counts published
+     * by the shards are read without locking them, so a scrape never delays a worker.
+     */
+    size_t held_count() const {
+        size_t count = 0;
+
+        for (const auto& shard : shards) {
+            count += shard.held_reservations.load(std::memory_order_relaxed);
+        }
+
+        return count;
+    }
+
+    /** Number of bought reservations kept in all shards, read as held_count() */
+    size_t bought_count() const {
+        size_t count = 0;
+
+        for (const auto& shard : shards) {
+            count += shard.bought_reservations.load(std::memory_order_relaxed);
+        }
+
+        return count;
+    }
+
+    /** Number of reservations in all shards, bought or not */
+    size_t reservation_count() const {
+        return this->held_count() + this->bought_count();
+    }
+
+    /** Number of events, as of the last reload */
+    size_t event_count() {
+        return std::atomic_load(&store)->events.size();
+    }
+
+    /**
+     * Reads counts of events without locking their shards, so a worker changing them is
+     * never delayed by the reader. Counts of a single event are consistent with each other.
+     * @param first first event
+     * @param count maximal number of events
+     * @return counts of at most @p count events from @p first on
+     */
+    std::vector<EventCounts> event_counts(event_id first, size_t count) {
+        store_ptr current = std::atomic_load(&store);
+        std::vector<EventCounts> counts;
+
+        for (size_t event = first; event < current->events.size() && counts.size() < count; event++) {
+            uint64_t packed = current->counters[event].load(std::memory_order_relaxed);
+            counts.push_back({static_cast<event_id>(event), static_cast<tickets_t>(packed),
+                              static_cast<uint32_t>(packed >> HELD_SHIFT)});
+        }
+
+        return counts;
+    }
+
+    /**
+     * Counts held reservations which expire within some seconds, without locking the shards.
+     * Every shard is read under its seqlock, so its counts are as of a single moment.
+     * @param seconds time from now, all held reservations expire within timeout + 1 seconds
+     */
+    Expiring expiring_within(seconds_t seconds) {
+        seconds_t now = Clock::now();
+        seconds_t end = now + std::min(seconds, timeout + 1);
+        Expiring total{};
+
+        for (const auto& shard : shards) {
+            /* A reservation with a deadline expires after its second has passed */
+            auto counted = shard.expiring_lock.read([&] {
+                Expiring counted{};
+
+                for (seconds_t deadline = now; deadline < end; deadline++) {
+                    const ExpiringSecond& second = shard.expiring[deadline % shard.expiring.size()];
+                    counted.reservations += second.reservations.load(std::memory_order_relaxed);
+                    counted.tickets += second.tickets.load(std::memory_order_relaxed);
+                }
+
+                return counted;
+            });
+
+            total.reservations += counted.reservations;
+            total.tickets += counted.tickets;
+        }
+
+        return total;
+    }
+
+    /**
+     * Creates a cookie starting with the reservation id, so cookies of live
+     * reservations are unique without remembering them, followed by random
+     * characters drawn from a per-thread ChaCha20 keystream.
+     */
+    static cookie_t generate_cookie(reservation_id reservation) {
+        thread_local ChaCha20 rng;
+        std::array<uint32_t, COOKIE_LEN - COOKIE_ID_LEN> random{};
+        cookie_t cookie{};
+
+        for (size_t i = 0; i < COOKIE_ID_LEN; i++, reservation /= COOKIE_BASE) {
+            cookie[i] = static_cast<char>(MIN_COOKIE_CHAR + reservation % COOKIE_BASE);
+        }
+
+        /* Scale 32 random bits into the character range, without branches or division */
+        rng.fill(random.data(), random.size());
+        for (size_t i = 0; i < random.size(); i++) {
+            auto offset = static_cast<uint64_t>(random[i]) * COOKIE_BASE >> 32;
+            cookie[COOKIE_ID_LEN + i] = static_cast<char>(MIN_COOKIE_CHAR + offset);
+        }
+
+        return cookie;
+    }
+
+private:
+    using timer_handle = TimerWheel<reservation_id>::handle;
+
+    /** Locks taken by reserve_all(), one for each distinct shard of its events, so taking them never allocates */
+    using bulk_guards = std::array<std::unique_lock<std::mutex>, MAX_BULK_RESERVATIONS>;
+
+    /** Shard indices of the requests of reserve_all() in ascending order, a shard repeats once per request */
+    using bulk_shards = std::array<size_t, MAX_BULK_RESERVATIONS>;
+
+    struct reservation_data {
+        cookie_t cookie;
+        seconds_t expiration_time; /** Wall time, as sent to the client */
+        seconds_t deadline; /** Expiration time on the monotonic clock, see Clock */
+        event_id event;
+        tickets_t tickets;
+        timer_handle timer; /** Expiration timer, valid until tickets are bought */
+        uint64_t first_ticket; /** Number of the first bought ticket or NO_TICKETS */
+    };
+
+    /** Character range for cookie */
+    static constexpr char MIN_COOKIE_CHAR = 33;
+    static constexpr char MAX_COOKIE_CHAR = 126;
+    static constexpr uint32_t COOKIE_BASE = MAX_COOKIE_CHAR - MIN_COOKIE_CHAR + 1;
+
+    /** Leading cookie characters holding the reservation id in base COOKIE_BASE */
+    static constexpr size_t COOKIE_ID_LEN = 5;
+
+    /** Marks a reservation whose tickets were not bought yet */
+    static constexpr uint64_t NO_TICKETS = std::numeric_limits<uint64_t>::max();
+
+    /** Held reservations of an event in the high half of its counter, available tickets in the low half */
+    static constexpr unsigned HELD_SHIFT = 32;
+
+    /** Events with their serializations, replaced as a whole by reload() */
+    struct EventStore {
+        /** Descriptions and available tickets of events numbered from 0 */
+        Catalog events;
+
+        EventsCache listing; /** Events sent in EVENTS response, a single page */
+        EventsCache pages; /** All events split into EVENTS_PAGE responses */
+
+        /** Available tickets and held reservations of every event, written by its shard and read without a lock */
+        std::vector<std::atomic<uint64_t>> counters;
+
+        /** @param snapshots resource of published pages, see EventsCache */
+        EventStore(Catalog catalog, std::pmr::memory_resource* snapshots)
+            : events(std::move(catalog)), listing(events, MAX_EVENTS_PAYLOAD, snapshots, 1),
+              pages(events, MAX_EVENTS_PAGE_PAYLOAD, snapshots), counters(events.size()) {
+            for (event_id event = 0; event < events.size(); event++) {
+                counters[event].store(events.tickets[event], std::memory_order_relaxed);
+            }
+        }
+
+        /** Sets available tickets of an event, shard of the event must be locked */
+        void set_tickets(event_id event, tickets_t tickets) {
+            events.tickets[event] = tickets;
+
+            uint64_t held = counters[event].load(std::memory_order_relaxed) >> HELD_SHIFT;
+            counters[event].store(held << HELD_SHIFT | tickets, std::memory_order_relaxed);
+
+            listing.mark_dirty(event);
+            pages.mark_dirty(event);
+        }
+
+        /** Adds to held reservations of an event, a shard holding them must be locked */
+        void add_held(event_id event, int64_t reservations) {
+            counters[event].fetch_add(static_cast<uint64_t>(reservations) << HELD_SHIFT, std::memory_order_relaxed);
+        }
+
+        /** Available tickets of an event, also of a hot one whose count in events lags behind */
+        tickets_t available(event_id event) const {
+            return static_cast<tickets_t>(counters[event].load(std::memory_order_relaxed));
+        }
+
+        /**
+         * Changes available tickets of a hot event, which shards holding its reservations change
+         * at once, each under its own lock. Only the counter changes, its count in events stays
+         * the one before any shard took tickets, see Shard::hot_taken; pages are filled in from
+         * the counters, see available().
+         * @param update callable given the available tickets, giving the new count or std::nullopt
+         * @return false if @p update refused the change
+         */
+        template<typename Update>
+        bool update_hot_tickets(event_id event, Update&& update) {
+            uint64_t counter = counters[event].load(std::memory_order_relaxed);
+            std::optional<tickets_t> tickets;
+
+            do {
+                tickets = update(static_cast<tickets_t>(counter));
+
+                if (!tickets.has_value())
+                    return false;
+            } while (!counters[event].compare_exchange_weak(counter, (counter >> HELD_SHIFT << HELD_SHIFT)
+                                                                     | tickets.value(), std::memory_order_relaxed));
+
+            listing.mark_dirty(event);
+            pages.mark_dirty(event);
+            return true;
+        }
+    };
+
+    using store_ptr = std::shared_ptr<EventStore>;
+
+    /** Held reservations whose deadline falls on one second */
+    struct ExpiringSecond {
+        std::atomic<uint64_t> reservations = 0;
+        std::atomic<uint64_t> tickets = 0;
+    };
+
+    /** Part of the tables owned by a single lock */
+    struct Shard {
+        std::mutex lock;
+
+        /** Events reserved from, the published store except while reload() moves shards */
+        store_ptr store;
+
+        /** Held reservations by slot, see reservation_slot() */
+        Slab<reservation_data> reserved;
+
+        /** Bought reservations by their index among ids of the shard, see shard_id() */
+        IdTable<reservation_data> bought;
+
+        /** Held and bought reservations, written under the lock and read without it */
+        std::atomic<size_t> held_reservations = 0;
+        std::atomic<size_t> bought_reservations = 0;
+
+        /** Reservations by their expiration time */
+        TimerWheel<reservation_id> expiration{0, 0};
+
+        /**
+         * Tickets of hot events taken by the shard from their counters and not given back, by event id.
+         * The counter of a hot event is its count in the events of the store less the sum over all
+         * shards, so a journal snapshot copies the shards one at a time, see journal_snapshot().
+         */
+        std::vector<int64_t> hot_taken;
+
+        /** Held reservations by their deadline modulo timeout + 1 seconds, read without the lock */
+        std::vector<ExpiringSecond> expiring;
+        SeqLock expiring_lock; /** Written under the lock, so readers see all seconds of a shard at once */
+    };
+
+    seconds_t timeout; /** Time measured in seconds for a reservation to be valid */
+    seconds_t bought_retention; /** Seconds a bought reservation is kept after its expiration time */
+
+    /**
+     * Published pages of all stores, which workers copy and drop, so a page published after
+     * a change reuses memory of a dropped one. Declared before the stores, so it outlives them.
+     */
+    std::pmr::synchronized_pool_resource snapshot_pool{std::pmr::pool_options{0, EventsCache::MAX_POOLED_BLOCK}};
+
+    std::vector<Shard> shards;
+    reservation_id shard_slots = 0; /** Slots of held reservations in a shard */
+    reservation_id generations = 0; /** Generations of a slot with distinct ids */
+
+    /** Events served in EVENTS and EVENTS_PAGE responses, replaced with std::atomic_store */
+    store_ptr store;
+    std::vector<bool> hot; /** Whether an event is hot, by its id, see reserve() */
+    std::mutex snapshot_lock; /** Serializes snapshot refreshes, which take no shard lock */
+    std::mutex reload_lock; /** Serializes reloads with each other and with journal snapshots */
+
+    std::atomic<uint64_t> next_ticket = 0; /** Number of the next bought ticket, shared by all shards */
+    std::atomic<uint64_t> ticket_lease = 0; /** Tickets below it may have been bought, see extend_lease() */
+
+    std::unique_ptr<Journal> journal; /** Records changes of all shards, nullptr if disabled */
+
+    /** Leading octets of a journal snapshot */
+    static constexpr std::string_view JOURNAL_MAGIC = "CSJOURNL";
+    static constexpr uint32_t JOURNAL_VERSION = 3;
+
+    /** Ticket numbers leased by a single LEASE_RECORD, a new lease follows once half of one is bought */
+    static constexpr uint64_t TICKET_LEASE = 1 << 26;
+
+    void set_timeout(uint32_t _timeout) {
+        ensure(is_between(_timeout, MIN_TIMEOUT, MAX_TIMEOUT), "Invalid timeout value");
+        this->timeout = _timeout;
+    };
+
+    void set_hot_events(const std::vector<event_id>& events) {
+        for (event_id event : events) {
+            ensure(event < store->events.size(), "Hot event", event, "does not exist");
+            hot.resize(std::max(hot.size(), static_cast<size_t>(event) + 1));
+            hot[event] = true;
+        }
+    }
+
+    bool is_hot(event_id event) const {
+        return event < hot.size() && hot[event];
+    }
+
+    /**
+     * Splits ids of every shard into generations of its slots. The last shard has
+     * the fewest ids, every shard uses as many, so all shards share one layout.
+     * A bought reservation leaves its slot, so ids run out only once every
+     * generation of every slot is kept by a bought reservation.
+     */
+    void initialize_shards(size_t held_reservations) {
+        const auto stride = static_cast<reservation_id>(shards.size());
+        auto ids = (std::numeric_limits<reservation_id>::max() - MIN_RESERVATION_ID - (stride - 1)) / stride + 1;
+
+        ensure(held_reservations > 0, "Every worker must hold at least one reservation");
+        shard_slots = static_cast<reservation_id>(std::min(static_cast<size_t>(ids), held_reservations));
+        generations = ids / shard_slots;
+
+        for (auto& shard : shards) {
+            shard.reserved = Slab<reservation_data>(shard_slots);
+            shard.bought = IdTable<reservation_data>(BOUGHT_CAPACITY);
+            shard.expiration = TimerWheel<reservation_id>(timeout, Clock::now());
+            shard.expiring = std::vector<ExpiringSecond>(timeout + 1);
+            shard.hot_taken = std::vector<int64_t>(hot.size(), 0);
+            shard.store = store;
+        }
+    }
+
+    /** Events of the shard of an event, which must be locked */
+    EventStore& event_store(event_id event) {
+        return *this->event_shard(event).store;
+    }
+
+    /** Sets available tickets of an event, shard of the event must be locked */
+    void set_tickets(event_id event, tickets_t tickets) {
+        this->event_store(event).set_tickets(event, tickets);
+    }
+
+    /**
+     * Subtracts tickets held by reservations of a locked shard from the new counts of their
+     * events. An event with fewer tickets than its reservations hold has none left.
+     * Shards which moved already may change counts of hot events in @p next meanwhile.
+     */
+    void take_held_tickets(Shard& shard, EventStore& next) {
+        shard.reserved.for_each([&](Slab<reservation_data>::index_t slot) {
+            const reservation_data& data = shard.reserved[slot];
+
+            if (data.event >= next.events.size())
+                return;
+
+            if (this->is_hot(data.event)) {
+                this->update_hot_tickets(shard, next, data.event, [&](tickets_t available) {
+                    return std::optional<tickets_t>(available - std::min(available, data.tickets));
+                });
+            } else {
+                tickets_t available = next.events.tickets[data.event];
+                next.set_tickets(data.event, available - std::min(available, data.tickets));
+            }
+
+            next.add_held(data.event, 1);
+        });
+    }
+
+    /**
+     * Gives the snapshot of a page of @p events, publishing it first if it changed.
+     * Counts are read from the counters, so shards changing them go on meanwhile.
+     */
+    EventsCache::snapshot_ptr published_page(EventStore& events, EventsCache& cache, size_t page) {
+        if (cache.is_dirty(page)) {
+            std::lock_guard refresh_guard(snapshot_lock);
+
+            if (cache.is_dirty(page)) {
+                cache.publish(page, [&events](event_id event) {return events.available(event);});
+            }
+        }
+
+        return cache.snapshot(page);
+    }
+
+    /**
+     * Locks shards of the requested events in ascending order, to avoid deadlocks.
+     * @param indices filled with the shard index of every request, sorted
+     */
+    bulk_guards lock_event_shards(const ReservationRequest* requests, size_t count, bulk_shards& indices) {
+        for (size_t i = 0; i < count; i++) {
+            indices[i] = this->shard_index(this->event_shard(requests[i].event));
+        }
+
+        std::sort(indices.begin(), indices.begin() + count);
+        bulk_guards guards;
+
+        for (size_t i = 0, locked = 0; i < count; i++) {
+            if (i == 0 || indices[i] != indices[i - 1]) {
+                guards[locked++] = std::unique_lock(shards[indices[i]].lock);
+            }
+        }
+
+        return guards;
+    }
+
+    /**
+     * Checks whether all requests of reserve_all() can be satisfied, shards of their events must be locked.
+     * Tickets are taken from the raw counts while checking and given back afterwards, so the
+     * counters read by published pages are not touched. Other shards reserve hot events meanwhile, so their tickets are
+     * taken for good and given back only if some request fails. A shard is refused if it has
+     * fewer free ids than the requests it gets.
+     * @param indices shard indices of the requests, see lock_event_shards()
+     * @return first event which cannot be reserved or std::nullopt
+     */
+    std::optional<event_id> unavailable_event(const ReservationRequest* requests, size_t count,
+                                              const bulk_shards& indices) {
+        size_t checked = 0;
+        std::optional<event_id> unavailable;
+
+        for (; checked < count; checked++) {
+            auto [event, tickets] = requests[checked];
+            Shard& shard = this->event_shard(event);
+            auto [first, last] = std::equal_range(indices.begin(), indices.begin() + count, this->shard_index(shard));
+
+            if (shard.reserved.available() < static_cast<size_t>(last - first)
+                || (this->is_hot(event) ? !this->take_tickets(shard, event, tickets)
+                                        : !valid_ticket_count(tickets, shard.store->events.tickets[event]))) {
+                unavailable = event;
+                break;
+            }
+
+            if (!this->is_hot(event)) {
+                shard.store->events.tickets[event] -= tickets;
+            }
+        }
+
+        while (checked-- > 0) {
+            auto [event, tickets] = requests[checked];
+
+            if (!this->is_hot(event)) {
+                this->event_store(event).events.tickets[event] += tickets;
+            } else if (unavailable.has_value()) {
+                this->give_tickets(this->event_shard(event), event, tickets);
+            }
+        }
+
+        return unavailable;
+    }
+
+    /**
+     * Takes back what reserve_all() did before it failed, shards of the requests must be locked.
+     * Created reservations are removed and journaled as expired, tickets of the failed request
+     * and those of later hot requests, taken while checking, are given back.
+     * @param failed index of the request which got no reservation
+     */
+    void undo_reservations(const ReservationRequest* requests, size_t count, const Reservation* reservations,
+                           size_t failed) {
+        for (size_t i = 0; i < failed; i++) {
+            Shard& shard = this->event_shard(requests[i].event);
+            reservation_id reservation = reservations[i].id;
+
+            shard.expiration.cancel(shard.reserved[this->reservation_slot(reservation)].timer);
+            this->remove_reservation(shard, reservation);
+            this->record(shard, Journal::EXPIRE_RECORD, reservation);
+        }
+
+        for (size_t i = failed; i < count; i++) {
+            auto [event, tickets] = requests[i];
+
+            if (i == failed || this->is_hot(event)) {
+                this->give_tickets(this->event_shard(event), event, tickets);
+            }
+        }
+    }
+
+    Shard& event_shard(event_id event) {
+        return shards[event % shards.size()];
+    }
+
+    Shard& reservation_shard(reservation_id reservation) {
+        return shards[(reservation - MIN_RESERVATION_ID) % shards.size()];
+    }
+
+    size_t shard_index(const Shard& shard) const {
+        return static_cast<size_t>(&shard - shards.data());
+    }
+
+    /** Index of a reservation among ids of its shard: its slot and the generation of the slot */
+    reservation_id shard_id(reservation_id reservation) const {
+        return (reservation - MIN_RESERVATION_ID) / static_cast<reservation_id>(shards.size());
+    }
+
+    Slab<reservation_data>::index_t reservation_slot(reservation_id reservation) const {
+        return this->shard_id(reservation) % shard_slots;
+    }
+
+    Slab<reservation_data>::generation_t reservation_generation(reservation_id reservation) const {
+        return this->shard_id(reservation) / shard_slots;
+    }
+
+    /** Whether a reservation is held, not bought or just its slot reused by a later one */
+    bool is_held(const Shard& shard, reservation_id reservation) const {
+        auto slot = this->reservation_slot(reservation);
+
+        return shard.reserved.contains(slot)
+               && shard.reserved.generation(slot) % generations == this->reservation_generation(reservation);
+    }
+
+    /**
+     * Gives an id congruent to the shard index modulo number of shards. A released
+     * id comes back only after its slot was reused generations times, an O(1)
+     * allocation therefore does not hand the id of a reservation which just expired
+     * to the next client. Ids of kept bought reservations never come back, see acquire_slot().
+     */
+    reservation_id slot_reservation(const Shard& shard, Slab<reservation_data>::index_t slot) const {
+        auto generation = static_cast<reservation_id>(shard.reserved.generation(slot) % generations);
+        return this->shard_reservation(shard, generation * shard_slots + slot);
+    }
+
+    /** Gives the reservation of an index among ids of a shard, see shard_id() */
+    reservation_id shard_reservation(const Shard& shard, reservation_id id) const {
+        return MIN_RESERVATION_ID + id * static_cast<reservation_id>(shards.size())
+               + static_cast<reservation_id>(this->shard_index(shard));
+    }
+
+    static bool valid_ticket_count(tickets_t requested, tickets_t available) {
+        return is_between(requested, static_cast<uint16_t>(1), std::min(MAX_TICKETS, available));
+    }
+
+    /**
+     * Takes tickets for a reservation of a locked shard from the events of the shard.
+     * @return false if the number of tickets is invalid or more than are available
+     */
+    bool take_tickets(Shard& shard, event_id event, tickets_t tickets) {
+        EventStore& events = *shard.store;
+
+        if (this->is_hot(event)) {
+            return this->update_hot_tickets(shard, events, event, [tickets](tickets_t available) {
+                return valid_ticket_count(tickets, available) ? std::optional<tickets_t>(available - tickets)
+                                                              : std::nullopt;
+            });
+        }
+
+        if (!valid_ticket_count(tickets, events.events.tickets[event]))
+            return false;
+
+        events.set_tickets(event, events.events.tickets[event] - tickets);
+        return true;
+    }
+
+    /**
+     * Changes available tickets of a hot event from a locked shard, see EventStore::update_hot_tickets(),
+     * and counts the change among the tickets taken by the shard.
+     */
+    template<typename Update>
+    bool update_hot_tickets(Shard& shard, EventStore& events, event_id event, Update&& update) {
+        tickets_t before = 0, after = 0;
+        bool updated = events.update_hot_tickets(event, [&](tickets_t available) {
+            std::optional<tickets_t> tickets = update(available);
+            before = available;
+            after = tickets.value_or(available);
+            return tickets;
+        });
+
+        if (updated) {
+            shard.hot_taken[event] += static_cast<int64_t>(before) - after;
+        }
+
+        return updated;
+    }
+
+    /** Gives tickets of a reservation of a locked shard back to the events of the shard */
+    void give_tickets(Shard& shard, event_id event, tickets_t tickets) {
+        EventStore& events = *shard.store;
+
+        /* The event may have been removed by a reload meanwhile */
+        if (event >= events.events.size())
+            return;
+
+        if (this->is_hot(event)) {
+            this->update_hot_tickets(shard, events, event, [tickets](tickets_t available) {
+                return std::optional<tickets_t>(available + tickets);
+            });
+        } else {
+            events.set_tickets(event, events.events.tickets[event] + tickets);
+        }
+    }
+
+    void remove_reservation(Shard& shard, reservation_id reservation) {
+        auto slot = this->reservation_slot(reservation);
+        auto [event, tickets] = std::pair(shard.reserved[slot].event, shard.reserved[slot].tickets);
+
+        this->count_held(shard, shard.reserved[slot], -1);
+        shard.reserved.release(slot);
+        Database::count_reservations(shard);
+        this->give_tickets(shard, event, tickets);
+
+        debug("Reservation", reservation, "has expired");
+    }
+
+    /**
+     * Takes a slot of a locked shard whose id no bought reservation keeps, in amortized O(1).
+     * Generations of a slot only grow until they start over, so its ids are new within a round.
+     * Bought reservations pin their slot, a pinned slot about to start over is parked until
+     * the last of them is pruned, so each slot is parked at most once per round.
+     */
+    std::optional<Slab<reservation_data>::index_t> acquire_slot(Shard& shard) {
+        while (auto slot = shard.reserved.acquire()) {
+            if (shard.reserved.generation(slot.value()) % generations != 0 || !shard.reserved.pinned(slot.value()))
+                return slot;
+
+            shard.reserved.park(slot.value());
+        }
+
+        return std::nullopt;
+    }
+
+    /**
+     * Forgets bought reservations of a locked shard whose expiration time passed bought_retention
+     * seconds ago, oldest purchases first, so a client can no longer present their ids.
+     * @param limit maximal number of pruned reservations
+     * @return number of pruned reservations
+     */
+    size_t prune_bought(Shard& shard, size_t limit) {
+        seconds_t now = Clock::wall_now();
+        size_t pruned = 0;
+
+        /* Purchases are ordered by their expiration times up to a timeout, a later one waits at most that long */
+        for (; pruned < limit && !shard.bought.empty(); pruned++) {
+            if (shard.bought.oldest().expiration_time + bought_retention >= now)
+                break;
+
+            this->remove_oldest_bought(shard);
+        }
+
+        if (pruned > 0) {
+            Database::count_reservations(shard);
+        }
+
+        return pruned;
+    }
+
+    /** Forgets the oldest bought reservation of a locked shard, its slot is reused once no other one pins it */
+    void remove_oldest_bought(Shard& shard) {
+        auto slot = shard.bought.oldest_id() % shard_slots;
+        shard.reserved.unpin(slot);
+
+        if (!shard.reserved.pinned(slot)) {
+            shard.reserved.unpark(slot);
+        }
+
+        shard.bought.remove_oldest();
+    }
+
+    std::optional<Reservation> create_reservation(Shard& shard, event_id event, tickets_t tickets) {
+        auto slot = this->acquire_slot(shard);
+
+        if (!slot.has_value())
+            return std::nullopt;
+
+        seconds_t deadline = timeout + Clock::now();
+        seconds_t expiration_time = timeout + Clock::wall_now();
+        reservation_id reservation = this->slot_reservation(shard, slot.value());
+        cookie_t cookie = Database::generate_cookie(reservation);
+
+        timer_handle timer = shard.expiration.schedule(deadline, reservation);
+        shard.reserved[slot.value()] = {cookie, expiration_time, deadline, event, tickets, timer, NO_TICKETS};
+        this->count_held(shard, shard.reserved[slot.value()], 1);
+        Database::count_reservations(shard);
+        this->record(shard, Journal::RESERVE_RECORD, reservation, event, tickets, cookie, expiration_time);
+
+        debug("Created reservation", reservation, "for", tickets, "tickets to event", event);
+
+        return Reservation{reservation, cookie, expiration_time};
+    }
+
+    /** Moves a held reservation of a locked shard to the bought ones, freeing its slot for later reservations */
+    const reservation_data& buy_reservation(Shard& shard, reservation_id reservation, uint64_t first_ticket) {
+        auto slot = this->reservation_slot(reservation);
+        reservation_data data = shard.reserved[slot];
+
+        shard.expiration.cancel(data.timer);
+        this->count_held(shard, data, -1);
+        shard.reserved.release(slot);
+        shard.reserved.pin(slot);
+        data.first_ticket = first_ticket;
+        debug("Disabled expiration for reservation", reservation);
+
+        const reservation_data& bought = shard.bought.insert(this->shard_id(reservation), data);
+        Database::count_reservations(shard);
+        return bought;
+    }
+
+    /** Publishes the numbers of reservations of a locked shard, see held_count() and bought_count() */
+    static void count_reservations(Shard& shard) {
+        shard.held_reservations.store(shard.reserved.size(), std::memory_order_relaxed);
+        shard.bought_reservations.store(shard.bought.size(), std::memory_order_relaxed);
+    }
+
+    /** Adds a held reservation to the counts read by introspection, or removes it; the shard must be locked */
+    void count_held(Shard& shard, const reservation_data& data, int64_t reservations) {
+        ExpiringSecond& second = shard.expiring[data.deadline % shard.expiring.size()];
+
+        shard.expiring_lock.write([&] {
+            second.reservations.store(second.reservations.load(std::memory_order_relaxed)
+                                      + static_cast<uint64_t>(reservations), std::memory_order_relaxed);
+            second.tickets.store(second.tickets.load(std::memory_order_relaxed)
+                                 + static_cast<uint64_t>(reservations) * data.tickets, std::memory_order_relaxed);
+        });
+
+        /* The event may have been removed by a reload meanwhile */
+        if (data.event < shard.store->events.size()) {
+            shard.store->add_held(data.event, reservations);
+        }
+    }
+
+    /**
+     * Journals a lease of ticket numbers far ahead once half of the previous one is bought.
+     * A restart or a promoted follower continues after the lease, so tickets bought after
+     * the last record it knows are never sold again, as long as fewer than half a lease
+     * of tickets are bought meanwhile. The shard must be locked.
+     * @param bought number following the last bought ticket
+     */
+    void extend_lease(Shard& shard, uint64_t bought) {
+        uint64_t lease = ticket_lease.load(std::memory_order_relaxed);
+
+        while (journal != nullptr && bought + TICKET_LEASE / 2 > lease) {
+            if (ticket_lease.compare_exchange_weak(lease, bought + TICKET_LEASE, std::memory_order_relaxed)) {
+                this->record(shard, Journal::LEASE_RECORD, bought + TICKET_LEASE);
+                return;
+            }
+        }
+    }
+
+    /** Journals a change of a shard, which must be locked */
+    template<typename... Fields>
+    void record(Shard& shard, Journal::RecordType type, const Fields&... fields) {
+        if (journal != nullptr) {
+            journal->append(this->shard_index(shard), type, fields...);
+        }
+    }
+
+    /** Drops all reservations and held counts, before a restore sets every count again */
+    void clear_state() {
+        for (auto& counter : store->counters) {
+            counter.store(0, std::memory_order_relaxed);
+        }
+
+        for (auto& shard : shards) {
+            shard.held_reservations.store(0, std::memory_order_relaxed);
+            shard.bought_reservations.store(0, std::memory_order_relaxed);
+        }
+
+        this->initialize_shards(shard_slots);
+        next_ticket.store(0);
+        ticket_lease.store(0);
+    }
+
+    /** Restores state saved in a journal and starts recording changes in it */
+    void open_journal(const std::string& path) {
+        std::vector<uint64_t> sequences(shards.size(), 0);
+        auto start = std::chrono::steady_clock::now();
+
+        if (auto snapshot = Journal::read_snapshot(path); snapshot.has_value()) {
+            this->restore_snapshot(snapshot.value(), sequences, path);
+        }
+
+        size_t records = Journal::replay(path, [&](Journal::RecordType type, uint16_t shard, uint64_t sequence,
+                                                   const char* fields) {
+            this->apply_record(type, shard, sequence, fields, sequences, path);
+        });
+
+        this->finish_restore();
+
+        auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start);
+        info("Restored", this->reservation_count(), "reservations from journal", path, "replaying", records,
+             "records in", elapsed.count(), "ms");
+
+        this->start_journal(path, sequences);
+    }
+
+    /** Starts recording changes in a journal, its contents are replaced by the current state */
+    void start_journal(const std::string& path, const std::vector<uint64_t>& sequences) {
+        journal = std::make_unique<Journal>(path, sequences);
+        journal->start([this] {return this->journal_snapshot();});
+    }
+
+    /** Applies a record unless the restored snapshot covers it */
+    void apply_record(Journal::RecordType type, uint16_t shard, uint64_t sequence, const char* fields,
+                      std::vector<uint64_t>& sequences, const std::string& source) {
+        ensure(shard < shards.size(), "Journal", source, "was written with more than", shards.size(), "workers");
+
+        if (sequence <= sequences[shard]) /* Covered by the snapshot */
+            return;
+
+        sequences[shard] = sequence;
+        this->restore_record(type, fields);
+    }
+
+    /**
+     * Makes restored state ready for requests, ticket numbers continue after the last lease.
+     * Restored counts of hot events become the ones no shard took tickets from yet.
+     */
+    void finish_restore() {
+        for (auto& shard : shards) {
+            shard.reserved.rebuild_free_list();
+            this->remove_overdue_reservations(shard);
+            this->prune_bought(shard, std::numeric_limits<size_t>::max());
+        }
+
+        for (event_id event = 0; event < std::min(hot.size(), store->events.size()); event++) {
+            if (hot[event]) {
+                store->events.tickets[event] = store->available(event);
+            }
+        }
+
+        for (auto& shard : shards) {
+            std::fill(shard.hot_taken.begin(), shard.hot_taken.end(), 0);
+        }
+
+        next_ticket.store(std::max(next_ticket.load(), ticket_lease.load()));
+    }
+
+    /** Applies a journal record, before any request is handled */
+    void restore_record(Journal::RecordType type, const char* fields) {
+        auto reservation = buffer_read<reservation_id>(fields, 0);
+        size_t offset = sizeof(reservation);
+
+        switch (type) {
+            case Journal::LEASE_RECORD: {
+                ticket_lease.store(std::max(ticket_lease.load(), buffer_read<uint64_t>(fields, 0)));
+                break;
+            }
+            case Journal::RESERVE_RECORD: {
+                auto event = buffer_read<event_id>(fields, offset);
+                auto tickets = buffer_read<tickets_t>(fields, offset + sizeof(event));
+                auto cookie = buffer_read<cookie_t>(fields, offset + sizeof(event) + sizeof(tickets));
+                auto expiration_time = buffer_read<seconds_t>(fields, offset + sizeof(event) + sizeof(tickets)
+                                                                      + sizeof(cookie));
+
+                ensure(event < store->events.size(), "Journal reserves tickets for unknown event", event);
+                this->set_tickets(event, store->available(event) - tickets);
+                this->restore_reservation(reservation, {cookie, expiration_time, 0, event, tickets, {}, NO_TICKETS});
+                break;
+            }
+            case Journal::PURCHASE_RECORD: {
+                Shard& shard = this->reservation_shard(reservation);
+                ensure(this->is_held(shard, reservation), "Journal buys unknown reservation", reservation);
+                const reservation_data& data = this->buy_reservation(shard, reservation,
+                                                                     buffer_read<uint64_t>(fields, offset));
+
+                next_ticket.store(std::max(next_ticket.load(), data.first_ticket + data.tickets));
+                break;
+            }
+            case Journal::EXPIRE_RECORD: {
+                Shard& shard = this->reservation_shard(reservation);
+                ensure(this->is_held(shard, reservation), "Journal expires unknown reservation", reservation);
+                shard.expiration.cancel(shard.reserved[this->reservation_slot(reservation)].timer);
+                this->remove_reservation(shard, reservation);
+                break;
+            }
+            default:
+                quit("Unknown journal record type", static_cast<int>(type));
+        }
+    }
+
+    /**
+     * Removes restored reservations which expired while the server was down,
+     * before any request can buy their tickets.
+     */
+    void remove_overdue_reservations(Shard& shard) {
+        seconds_t now = Clock::wall_now();
+        std::vector<reservation_id> overdue;
+
+        shard.reserved.for_each([&](Slab<reservation_data>::index_t slot) {
+            const reservation_data& data = shard.reserved[slot];
+
+            if (data.expiration_time < now) {
+                overdue.push_back(this->slot_reservation(shard, slot));
+            }
+        });
+
+        for (reservation_id reservation : overdue) {
+            shard.expiration.cancel(shard.reserved[this->reservation_slot(reservation)].timer);
+            this->remove_reservation(shard, reservation);
+        }
+    }
+
+    /** Puts a held reservation back into its slot and schedules its expiration, a bought one among the bought */
+    void restore_reservation(reservation_id reservation, reservation_data data) {
+        Shard& shard = this->reservation_shard(reservation);
+        auto slot = this->reservation_slot(reservation);
+
+        if (data.first_ticket != NO_TICKETS) {
+            ensure(shard.bought.find(this->shard_id(reservation)) == nullptr, "Journal buys reservation",
+                   reservation, "twice");
+            next_ticket.store(std::max(next_ticket.load(), data.first_ticket + data.tickets));
+            shard.bought.insert(this->shard_id(reservation), data);
+
+            /* The slot goes on after the bought generation, as it did when the reservation was bought */
+            shard.reserved.restore_generation(slot, this->reservation_generation(reservation) + 1);
+            shard.reserved.pin(slot);
+            Database::count_reservations(shard);
+            return;
+        }
+
+        /* Pruning is not journaled, an id given again shows that it and all older purchases were pruned */
+        if (shard.bought.find(this->shard_id(reservation)) != nullptr) {
+            while (shard.bought.oldest_id() != this->shard_id(reservation)) {
+                this->remove_oldest_bought(shard);
+            }
+
+            this->remove_oldest_bought(shard);
+        }
+
+        bool held_elsewhere = data.event < store->events.size()
+                              && &shard != &this->event_shard(data.event);
+        ensure(!held_elsewhere || this->is_hot(data.event), "Journal was written with event", data.event,
+               "hot, it must stay hot");
+
+        /* The journal keeps wall time only, its reservations expire in as many seconds as are left */
+        data.deadline = Clock::to_monotonic(data.expiration_time);
+        data.timer = shard.expiration.schedule(data.deadline, reservation);
+
+        shard.reserved.restore(slot, this->reservation_generation(reservation));
+        shard.reserved[slot] = data;
+        this->count_held(shard, data, 1);
+        Database::count_reservations(shard);
+    }
+
+    /**
+     * Serializes ticket counts, reservations and the last journal sequence number of every shard.
+     * Shards are copied one at a time, each under its own lock and with its own sequence number,
+     * so the others go on serving requests meanwhile. Hot events are counted by the tickets each
+     * shard took from them, see Shard::hot_taken; numbers of bought tickets only grow, so they
+     * are read after all shards, covering every record of the copies.
+     */
+    std::string journal_snapshot() {
+        std::lock_guard reload_guard(reload_lock);
+        const Catalog& events = store->events;
+
+        std::string state;
+        auto append = [&state](const auto&... fields) {
+            size_t offset = state.size();
+            state.resize(offset + message_size<std::decay_t<decltype(fields)>...>());
+            buffer_write(state.data() + offset, fields...);
+        };
+
+        state.append(JOURNAL_MAGIC);
+        append(JOURNAL_VERSION, static_cast<uint32_t>(shards.size()), static_cast<uint32_t>(events.size()));
+
+        for (size_t index = 0; index < shards.size(); index++) {
+            Shard& shard = shards[index];
+            std::lock_guard guard(shard.lock);
+
+            /* Counts of hot events are the ones before any shard took tickets, which no shard changes */
+            append(journal->sequence(index));
+            for (size_t event = index; event < events.size(); event += shards.size()) {
+                append(events.tickets[event]);
+            }
+
+            auto taken = static_cast<uint32_t>(std::count_if(shard.hot_taken.begin(), shard.hot_taken.end(),
+                                                             [](int64_t tickets) {return tickets != 0;}));
+            append(taken);
+            for (event_id event = 0; event < shard.hot_taken.size(); event++) {
+                if (shard.hot_taken[event] != 0) {
+                    append(event, static_cast<uint64_t>(shard.hot_taken[event]));
+                }
+            }
+
+            append(static_cast<uint32_t>(shard.reserved.size() + shard.bought.size()));
+            shard.reserved.for_each([&](Slab<reservation_data>::index_t slot) {
+                const reservation_data& data = shard.reserved[slot];
+                append(this->slot_reservation(shard, slot), data.event, data.tickets, data.cookie,
+                       data.expiration_time, data.first_ticket);
+            });
+            shard.bought.for_each([&](reservation_id id, const reservation_data& data) {
+                append(this->shard_reservation(shard, id), data.event, data.tickets, data.cookie,
+                       data.expiration_time, data.first_ticket);
+            });
+        }
+
+        append(next_ticket.load(), ticket_lease.load());
+        return state;
+    }
+
+    /** Restores state written by journal_snapshot() */
+    void restore_snapshot(const std::string& state, std::vector<uint64_t>& sequences, const std::string& path) {
+        const char* position = state.data();
+        auto read = [&](auto field) {
+            ensure(position + sizeof(field) <= state.data() + state.size(), "Journal snapshot of", path,
+                   "is truncated");
+            field = buffer_read<decltype(field)>(position, 0);
+            position += sizeof(field);
+            return field;
+        };
+
+        ensure(state.compare(0, JOURNAL_MAGIC.size(), JOURNAL_MAGIC) == 0, "File", path, "is not a journal");
+        position += JOURNAL_MAGIC.size();
+        /* Snapshots of the first version have no lease, up to the second one no tickets of hot events were taken */
+        auto version = read(uint32_t{});
+        ensure(version >= 1 && version <= JOURNAL_VERSION, "Unsupported version of journal", path);
+        ensure(read(uint32_t{}) == shards.size(), "Journal", path, "was written with a different number of workers");
+        const Catalog& events = store->events;
+        ensure(read(uint32_t{}) == events.size(), "Journal", path, "was written for a different number of events");
+        std::vector<int64_t> counts(events.size());
+
+        for (size_t shard = 0; shard < shards.size(); shard++) {
+            sequences[shard] = read(uint64_t{});
+
+            for (size_t event = shard; event < events.size(); event += shards.size()) {
+                counts[event] += read(tickets_t{});
+            }
+
+            for (auto taken = version < 3 ? 0 : read(uint32_t{}); taken > 0; taken--) {
+                auto event = read(event_id{});
+                ensure(event < events.size(), "Journal snapshot of", path, "takes tickets of unknown event", event);
+                counts[event] -= static_cast<int64_t>(read(uint64_t{}));
+            }
+
+            for (auto reservations = read(uint32_t{}); reservations > 0; reservations--) {
+                auto reservation = read(reservation_id{});
+                reservation_data data{};
+                data.event = read(event_id{});
+                data.tickets = read(tickets_t{});
+                data.cookie = read(cookie_t{});
+                data.expiration_time = read(seconds_t{});
+                data.first_ticket = read(uint64_t{});
+
+                this->restore_reservation(reservation, data);
+            }
+        }
+
+        for (event_id event = 0; event < events.size(); event++) {
+            ensure(is_between<int64_t>(counts[event], 0, std::numeric_limits<tickets_t>::max()), "Journal snapshot of",
+                   path, "has an invalid ticket count of event", event);
+            this->set_tickets(event, static_cast<tickets_t>(counts[event]));
+        }
+
+        next_ticket.store(read(uint64_t{}));
+        ticket_lease.store(version == 1 ? 0 : read(uint64_t{}));
+    }
+};
+
+#endif //CINEMA_SERVER_DATABASE_H
@@ -1,11 +1,204 @@
 #ifndef CINEMA_SERVER_ENSURE_H
 #define CINEMA_SERVER_ENSURE_H
 
-#include <iostream>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <cstring>
+#include <sstream>
+#include <algorithm>
+#include <string_view>
+#include <type_traits>
+
+#include <unistd.h>
+
+/** Severity of a log line, lines below the current level are not formatted */
+enum LogLevel : int {
+    LOG_DEBUG = 0,
+    LOG_INFO  = 1,
+    LOG_ERROR = 2
+};
+
+/* Least severe level compiled in, calls below it compile to nothing */
+#ifndef CINEMA_SERVER_LOG_LEVEL
+#ifdef NDEBUG
+#define CINEMA_SERVER_LOG_LEVEL LOG_INFO
+#else
+#define CINEMA_SERVER_LOG_LEVEL LOG_DEBUG
+#endif
+#endif
+
+constexpr int MIN_LOG_LEVEL = CINEMA_SERVER_LOG_LEVEL;
+
+/** Least severe level printed, may be raised at runtime */
+inline std::atomic<int> log_level = MIN_LOG_LEVEL;
+
+inline bool log_enabled(LogLevel level) {
+    return level >= MIN_LOG_LEVEL && level >= log_level.load(std::memory_order_relaxed);
+}
+
+/**
+ * Destination of log lines. Until start() lines are written directly to stderr,
+ * afterwards they are pushed into a bounded lock-free ring and written in batches
+ * by a background thread, so logging threads never block or flush. Lines which
+ * find the ring full are dropped and counted. The ring is drained at exit.
+ */
+class LogSink {
+public:
+    static LogSink& instance() {
+        static LogSink sink;
+        return sink;
+    }
+
+    LogSink(const LogSink&) = delete;
+    LogSink& operator=(const LogSink&) = delete;
+
+    ~LogSink() {
+        if (drainer.joinable()) {
+            running.store(false, std::memory_order_release);
+            drainer.join();
+        }
+    }
+
+    /** Starts writing lines asynchronously */
+    void start() {
+        if (!drainer.joinable()) {
+            running.store(true, std::memory_order_release);
+            drainer = std::thread(&LogSink::drain, this);
+        }
+    }
+
+    /** Queues a non-empty line, truncated to LINE_LEN octets */
+    void write(std::string_view line) {
+        if (!running.load(std::memory_order_acquire)) {
+            write_all(line.data(), line.size());
+            return;
+        }
+
+        size_t position = head.load(std::memory_order_relaxed);
+        Record* record;
+
+        while (true) { /* Claim a free record, see Vyukov's bounded MPMC queue */
+            record = &ring[position % RING_SIZE];
+            size_t sequence = record->sequence.load(std::memory_order_acquire);
+            auto difference = static_cast<std::ptrdiff_t>(sequence - position);
+
+            if (difference == 0 && head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                break;
+
+            if (difference < 0) {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+
+            if (difference > 0) {
+                position = head.load(std::memory_order_relaxed);
+            }
+        }
+
+        record->length = std::min(line.size(), LINE_LEN);
+        memcpy(record->text.data(), line.data(), record->length);
+        record->text[record->length - 1] = line.back(); /* Keep the line end of truncated lines */
+        record->sequence.store(position + 1, std::memory_order_release);
+    }
+
+    /** Number of lines dropped because the ring was full */
+    size_t dropped_lines() const {
+        return dropped.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr size_t LINE_LEN = 256;
+    static constexpr size_t RING_SIZE = 4096;
+    static constexpr size_t DRAIN_BATCH = 1 << 16;
+    static constexpr std::chrono::milliseconds IDLE_INTERVAL{1};
+
+    struct Record {
+        std::atomic<size_t> sequence; /** Position of the record when full, plus one */
+        size_t length;
+        std::array<char, LINE_LEN> text;
+    };
+
+    std::array<Record, RING_SIZE> ring;
+    alignas(64) std::atomic<size_t> head = 0; /** Next position claimed by a producer */
+    alignas(64) size_t tail = 0; /** Next position read by the drainer */
+    std::atomic<size_t> dropped = 0;
+    std::atomic<bool> running = false;
+    std::thread drainer;
+
+    LogSink() {
+        for (size_t i = 0; i < RING_SIZE; i++) {
+            ring[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    static void write_all(const char* data, size_t length) {
+        while (length > 0) {
+            ssize_t written = ::write(STDERR_FILENO, data, length);
+
+            if (written <= 0)
+                return;
+
+            data += written;
+            length -= static_cast<size_t>(written);
+        }
+    }
+
+    void drain() {
+        std::string batch;
+        batch.reserve(DRAIN_BATCH);
+
+        while (true) {
+            bool stopping = !running.load(std::memory_order_acquire);
+
+            while (batch.size() + LINE_LEN <= DRAIN_BATCH) {
+                Record& record = ring[tail % RING_SIZE];
+
+                if (record.sequence.load(std::memory_order_acquire) != tail + 1)
+                    break;
+
+                batch.append(record.text.data(), record.length);
+                record.sequence.store(tail + RING_SIZE, std::memory_order_release);
+                tail++;
+            }
+
+            if (!batch.empty()) {
+                write_all(batch.data(), batch.size());
+                batch.clear();
+            } else if (stopping) {
+                return;
+            } else {
+                std::this_thread::sleep_for(IDLE_INTERVAL);
+            }
+        }
+    }
+};
+
+namespace {
+    /** Writes an argument, callables are invoked only now, so they can defer costly formatting */
+    template<typename T>
+    inline void format_argument(std::ostream& out, const T& argument) {
+        if constexpr (std::is_invocable_v<const T&>) {
+            out << argument();
+        } else {
+            out << argument;
+        }
+    }
+}
 
 template<typename Arg, typename... Args>
-inline void display(const std::string& type, const Arg& head, const Args&... args) {
-    ((std::cerr << type + ": " << head) << ... << (std::cerr << " ", args)) << std::endl;
+inline void display(const char* type, const Arg& head, const Args&... args) {
+    thread_local std::ostringstream line;
+    line.str("");
+
+    line << type << ": ";
+    format_argument(line, head);
+    ((line << ' ', format_argument(line, args)), ...);
+    line << '\n';
+
+    LogSink::instance().write(line.str());
 }
 
 template<typename Arg, typename... Args>
@@ -13,11 +206,23 @@ inline void alert(const Arg& head, const Args&... args) {
     display("Error", head, args...);
 }
 
+template<typename Arg, typename... Args>
+inline void info(const Arg& head, const Args&... args) {
+    if constexpr (LOG_INFO >= MIN_LOG_LEVEL) {
+        if (log_enabled(LOG_INFO)) {
+            display("INFO", head, args...);
+        }
+    }
+}
+
+/** Arguments are evaluated even if the line is not printed, pass a lambda to defer costly ones */
 template<typename Arg, typename... Args>
 inline void debug(const Arg& head, const Args&... args) {
-#ifndef NDEBUG
-    display("DEBUG", head, args...);
-#endif
+    if constexpr (LOG_DEBUG >= MIN_LOG_LEVEL) {
+        if (log_enabled(LOG_DEBUG)) {
+            display("DEBUG", head, args...);
+        }
+    }
 }
 
 template<typename Arg, typename... Args>
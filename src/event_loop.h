@@ -0,0 +1,381 @@
+#ifndef CINEMA_SERVER_EVENT_LOOP_H
+#define CINEMA_SERVER_EVENT_LOOP_H
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cerrno>
+#include <cstring>
+#include <optional>
+#include <algorithm>
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "ensure.h"
+#include "uring.h"
+
+/** Received datagram, valid until EventLoop::release() */
+struct Datagram {
+    char* data; /** Request, overwritten with its response, in a buffer of EventLoop::MAX_DATAGRAM octets */
+    size_t length;
+    sockaddr_storage* client;
+    uint32_t listener; /** Index of the socket which received the datagram, its response is sent from it */
+};
+
+/**
+ * Receiving side of a worker: waits for datagrams on its sockets and gives them
+ * in batches. Backends differ only in how they wait, see make_event_loop().
+ */
+class EventLoop {
+public:
+    static constexpr size_t MAX_DATAGRAM = 65507;
+
+    /** Longest request a loop receiving into small buffers takes, longer ones are dropped */
+    static constexpr size_t MAX_REQUEST = 2048;
+
+    virtual ~EventLoop() = default;
+
+    /**
+     * Waits for datagrams on any socket and receives a batch of them.
+     * @param timeout_ms longest wait, 0 only takes the queued datagrams
+     * @param writable index of a socket to stop waiting for once it can take more responses
+     * @return received datagrams, empty after the timeout or when only the socket became writable
+     */
+    virtual const std::vector<Datagram>& receive(int timeout_ms, std::optional<uint32_t> writable) = 0;
+
+    /** Gives back buffers of the last batch, after their responses are sent */
+    virtual void release() {}
+
+protected:
+    std::vector<Datagram> datagrams;
+};
+
+/**
+ * Waits in poll() until a datagram arrives on any socket, then takes the queued ones
+ * with a single recvmmsg per ready socket. A batch is shared by all sockets, so the
+ * socket read first rotates and a busy one cannot starve the others.
+ */
+class BlockingLoop : public EventLoop {
+public:
+    BlockingLoop(const std::vector<int>& sockets, size_t batch)
+            : sockets(sockets), descriptors(sockets.size()), slots(batch * MAX_DATAGRAM), clients(batch),
+              vectors(batch), requests(batch) {
+        for (size_t i = 0; i < batch; i++) {
+            vectors[i] = {slots.data() + i * MAX_DATAGRAM, MAX_DATAGRAM};
+            requests[i].msg_hdr.msg_name = &clients[i];
+            requests[i].msg_hdr.msg_iov = &vectors[i];
+            requests[i].msg_hdr.msg_iovlen = 1;
+        }
+    }
+
+    const std::vector<Datagram>& receive(int timeout_ms, std::optional<uint32_t> writable) override {
+        datagrams.clear();
+
+        for (uint32_t i = 0; i < sockets.size(); i++) {
+            descriptors[i] = {sockets[i], static_cast<short>(POLLIN | (writable == i ? POLLOUT : 0)), 0};
+        }
+
+        int ready = poll(descriptors.data(), descriptors.size(), timeout_ms);
+        ensure(ready >= 0 || errno == EINTR, "Failed to wait for messages on", sockets.size(), "sockets");
+
+        if (ready > 0) {
+            this->receive_queued(true);
+        }
+
+        return datagrams;
+    }
+
+protected:
+    std::vector<int> sockets;
+
+    /**
+     * Takes whatever is queued, without blocking.
+     * @param polled whether to read only sockets which poll() found readable
+     */
+    void receive_queued(bool polled) {
+        size_t received = 0;
+
+        for (size_t turn = 0; turn < sockets.size() && received < requests.size(); turn++) {
+            auto listener = static_cast<uint32_t>((first + turn) % sockets.size());
+
+            if (!polled || (descriptors[listener].revents & POLLIN)) {
+                received += this->receive_from(listener, received);
+            }
+        }
+
+        first = (first + 1) % sockets.size();
+    }
+
+private:
+    std::vector<pollfd> descriptors; /** Sockets in the order of their indices */
+    size_t first = 0; /** Socket read first by the next receive */
+    std::vector<char> slots; /** Per-datagram buffers, MAX_DATAGRAM octets each */
+    std::vector<sockaddr_storage> clients; /** Sender address of each received datagram */
+    std::vector<iovec> vectors;
+    std::vector<mmsghdr> requests;
+
+    /** Receives into free slots from @p offset on, gives the number of datagrams */
+    size_t receive_from(uint32_t listener, size_t offset) {
+        for (size_t i = offset; i < requests.size(); i++) {
+            requests[i].msg_hdr.msg_namelen = static_cast<socklen_t>(sizeof(sockaddr_storage));
+        }
+
+        int socket_fd = sockets[listener];
+        int received = recvmmsg(socket_fd, requests.data() + offset, requests.size() - offset, MSG_DONTWAIT,
+                                nullptr);
+
+        /* A failed receive loses at most the datagram it was taking */
+        if (received < 0) {
+            if (errno != EAGAIN && errno != EINTR) {
+                alert("Failed to receive messages on socket", socket_fd, strerror(errno));
+            }
+            return 0;
+        }
+
+        for (size_t i = offset; i < offset + received; i++) {
+            datagrams.push_back({static_cast<char*>(vectors[i].iov_base), requests[i].msg_len, &clients[i],
+                                 listener});
+        }
+
+        return static_cast<size_t>(received);
+    }
+};
+
+/**
+ * Spins on non-blocking receives before falling back to poll(), so a burst is
+ * served without a wakeup. The spin doubles after it catches a datagram and halves
+ * after it catches none, so an idle worker soon blocks. The kernel busy-polls the
+ * device queue too, if SO_BUSY_POLL is permitted.
+ */
+class BusyPollLoop : public BlockingLoop {
+public:
+    static constexpr std::chrono::microseconds MIN_SPIN{5};
+    static constexpr std::chrono::microseconds MAX_SPIN{200};
+
+    BusyPollLoop(const std::vector<int>& sockets, size_t batch) : BlockingLoop(sockets, batch) {
+        auto busy_poll = static_cast<int>(MAX_SPIN.count());
+
+        for (int socket_fd : sockets) {
+            if (setsockopt(socket_fd, SOL_SOCKET, SO_BUSY_POLL, &busy_poll, sizeof(busy_poll)) == -1) {
+                info("SO_BUSY_POLL requires CAP_NET_ADMIN, spinning in user space only");
+                break;
+            }
+        }
+    }
+
+    const std::vector<Datagram>& receive(int timeout_ms, std::optional<uint32_t> writable) override {
+        datagrams.clear();
+        auto deadline = std::chrono::steady_clock::now() + (timeout_ms == 0 ? std::chrono::microseconds{0} : spin);
+
+        do {
+            this->receive_queued(false);
+
+            if (!datagrams.empty()) {
+                spin = std::min(spin * 2, MAX_SPIN);
+                return datagrams;
+            }
+        } while (std::chrono::steady_clock::now() < deadline);
+
+        spin = std::max(spin / 2, MIN_SPIN);
+        return BlockingLoop::receive(timeout_ms, writable);
+    }
+
+private:
+    std::chrono::microseconds spin = MIN_SPIN;
+};
+
+/**
+ * Receives with a multishot recvmsg per socket on io_uring: the kernel keeps
+ * placing datagrams into provided buffers shared by all sockets and a batch is
+ * collected from the completion ring, usually without any system call under load.
+ * Provided buffers only fit MAX_REQUEST octets, a request is copied into a slot
+ * of the batch its response is written over, and its buffer is given back at once.
+ */
+class UringLoop : public EventLoop {
+public:
+    UringLoop(const std::vector<int>& sockets, size_t batch)
+            : sockets(sockets), batch(batch), ring(RING_ENTRIES), armed(sockets.size(), false),
+              slots(batch * MAX_DATAGRAM), clients(batch) {
+        ensure(UringLoop::supports_multishot_receive(), "io_uring of this kernel has no multishot recvmsg");
+
+        /* Twice the batch, so the kernel can receive while a batch is handled */
+        size_t count = 1;
+        while (count < 2 * batch) {
+            count *= 2;
+        }
+
+        ring.provide_buffers(BUFFER_GROUP, static_cast<uint16_t>(count), BUFFER_LEN);
+        header.msg_namelen = sizeof(sockaddr_storage);
+    }
+
+    const std::vector<Datagram>& receive(int timeout_ms, std::optional<uint32_t> writable) override {
+        datagrams.clear();
+
+        for (uint32_t i = 0; i < sockets.size(); i++) {
+            if (!armed[i]) {
+                this->arm(i);
+            }
+        }
+
+        if (writable.has_value() && !polling) {
+            this->poll_writable(writable.value());
+        }
+
+        if (this->collect() == 0) {
+            ring.enter(timeout_ms != 0, timeout_ms);
+            this->collect();
+        }
+
+        ring.publish_buffers();
+        return datagrams;
+    }
+
+private:
+    static constexpr unsigned RING_ENTRIES = 64;
+    static constexpr uint16_t BUFFER_GROUP = 0;
+
+    /** Completions carry their kind in the upper half of user_data and their socket in the lower */
+    static constexpr uint64_t RECEIVE_TAG = 1;
+    static constexpr uint64_t WRITABLE_TAG = 2;
+    static constexpr unsigned TAG_SHIFT = 32;
+
+    /** A buffer holds the recvmsg header, the sender address and the request */
+    static constexpr size_t PAYLOAD_OFFSET = sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_storage);
+    static constexpr size_t BUFFER_LEN = PAYLOAD_OFFSET + MAX_REQUEST;
+
+    std::vector<int> sockets;
+    size_t batch;
+    Uring ring;
+    msghdr header{}; /** Layout of received messages, read by the kernel for every datagram */
+    std::vector<bool> armed; /** Whether the multishot receive of each socket is pending */
+    bool polling = false; /** Whether a poll for writability is pending */
+    std::vector<char> slots; /** Per-datagram buffers of the batch, MAX_DATAGRAM octets each */
+    std::vector<sockaddr_storage> clients;
+
+    void arm(uint32_t listener) {
+        armed[listener] = ring.submit([this, listener](io_uring_sqe* sqe) {
+            UringLoop::prepare_receive(sqe, sockets[listener], &header);
+            sqe->user_data = RECEIVE_TAG << TAG_SHIFT | listener;
+        });
+    }
+
+    static void prepare_receive(io_uring_sqe* sqe, int socket_fd, msghdr* header) {
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = socket_fd;
+        sqe->addr = reinterpret_cast<uint64_t>(header);
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = BUFFER_GROUP;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+    }
+
+    /** Errors a receive armed again fails with as well, so serving cannot go on */
+    static bool is_permanent(int error) {
+        return error == EINVAL || error == EOPNOTSUPP || error == EBADF || error == ENOTSOCK || error == EFAULT;
+    }
+
+    /**
+     * Arms a multishot recvmsg on a socket which never receives, in a ring of its own. Kernels
+     * before 6.0 have the buffer ring but refuse the multishot flag when the submission is read,
+     * no feature flag or opcode probe tells them apart.
+     */
+    static bool supports_multishot_receive() {
+        msghdr header{};
+        header.msg_namelen = sizeof(sockaddr_storage);
+
+        Uring probe(1);
+        probe.provide_buffers(BUFFER_GROUP, 1, BUFFER_LEN);
+        int socket_fd = socket(AF_INET, SOCK_DGRAM, 0);
+        ensure(socket_fd != -1, "Failed to create a socket probing io_uring");
+        probe.submit([&](io_uring_sqe* sqe) {UringLoop::prepare_receive(sqe, socket_fd, &header);});
+        probe.enter(false, 0);
+
+        bool refused = false;
+        probe.complete(1, [&](const io_uring_cqe& cqe) {refused = cqe.res < 0;});
+        close(socket_fd);
+
+        /* Closing the probing ring cancels the pending receive */
+        return !refused;
+    }
+
+    /** Completes once the socket can take more responses */
+    void poll_writable(uint32_t listener) {
+        polling = ring.submit([this, listener](io_uring_sqe* sqe) {
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = sockets[listener];
+            sqe->poll32_events = POLLOUT;
+            sqe->user_data = WRITABLE_TAG << TAG_SHIFT | listener;
+        });
+    }
+
+    size_t collect() {
+        return ring.complete(batch, [this](const io_uring_cqe& cqe) {
+            auto listener = static_cast<uint32_t>(cqe.user_data);
+
+            if (cqe.user_data >> TAG_SHIFT == WRITABLE_TAG) {
+                polling = false;
+                return;
+            }
+
+            /* The receive stops when buffers run out, it is armed again after they are released */
+            if (!(cqe.flags & IORING_CQE_F_MORE)) {
+                armed[listener] = false;
+            }
+
+            /* A failed receive loses at most the datagram it was taking, the receive is armed again */
+            if (cqe.res < 0) {
+                ensure(!UringLoop::is_permanent(-cqe.res), "Failed to receive messages on socket",
+                       sockets[listener], strerror(-cqe.res));
+
+                if (cqe.res != -ENOBUFS && cqe.res != -EINTR) {
+                    alert("Failed to receive messages on socket", sockets[listener], strerror(-cqe.res));
+                }
+                return;
+            }
+
+            auto id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+            char* buffer = ring.buffer(id);
+            auto* message = reinterpret_cast<io_uring_recvmsg_out*>(buffer);
+
+            if (message->namelen <= sizeof(sockaddr_storage) && !(message->flags & MSG_TRUNC)) {
+                size_t slot = datagrams.size();
+                memcpy(slots.data() + slot * MAX_DATAGRAM, buffer + PAYLOAD_OFFSET, message->payloadlen);
+                memcpy(&clients[slot], buffer + sizeof(io_uring_recvmsg_out), sizeof(sockaddr_storage));
+                datagrams.push_back({slots.data() + slot * MAX_DATAGRAM, message->payloadlen, &clients[slot],
+                                     listener});
+            }
+
+            ring.recycle(id);
+        });
+    }
+};
+
+/** Names of event loop backends, selected with a flag */
+constexpr const char* BLOCKING_LOOP = "blocking";
+constexpr const char* BUSY_POLL_LOOP = "busy_poll";
+constexpr const char* URING_LOOP = "io_uring";
+
+/**
+ * Creates the receiving side of a worker.
+ * @param backend BLOCKING_LOOP, BUSY_POLL_LOOP or URING_LOOP
+ * @param sockets bound sockets, datagrams tell them apart by their index
+ * @param batch maximal number of datagrams received at once from all sockets
+ */
+inline std::unique_ptr<EventLoop> make_event_loop(const std::string& backend, const std::vector<int>& sockets,
+                                                  size_t batch) {
+    if (backend == BLOCKING_LOOP)
+        return std::make_unique<BlockingLoop>(sockets, batch);
+
+    if (backend == BUSY_POLL_LOOP)
+        return std::make_unique<BusyPollLoop>(sockets, batch);
+
+    if (backend == URING_LOOP)
+        return std::make_unique<UringLoop>(sockets, batch);
+
+    quit("Event loop must be", BLOCKING_LOOP, "or", BUSY_POLL_LOOP, "or", URING_LOOP);
+    return nullptr;
+}
+
+#endif //CINEMA_SERVER_EVENT_LOOP_H
@@ -0,0 +1,147 @@
+#ifndef CINEMA_SERVER_EVENTS_CACHE_H
+#define CINEMA_SERVER_EVENTS_CACHE_H
+
+#include <deque>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <memory_resource>
+
+#include "buffer.h"
+#include "catalog.h"
+
+/**
+ * Events serialized as in EVENTS response, split into pages of consecutive
+ * events which fit into a given space. A page is marked when ticket counts of
+ * its events change and published as an immutable copy on demand, with the
+ * current counts filled in, so serving it never serializes events. The cache
+ * does no locking: marking is safe from any thread at any time, publishing the
+ * same page must be serialized by the caller. Copies are allocated from a memory
+ * resource given by the owner, so publishing reuses memory of dropped copies.
+ */
+class EventsCache {
+public:
+    using event_id  = uint32_t;
+    using tickets_t = uint16_t;
+    using desclen_t = uint8_t;
+    /** A polymorphic string, so snapshots are sent like responses allocated from pools */
+    using snapshot_ptr = std::shared_ptr<const std::pmr::string>;
+
+    /** Largest block a resource for copies has to recycle, a page with its terminator fits into it */
+    static constexpr size_t MAX_POOLED_BLOCK = 1 << 16;
+
+    /**
+     * Serializes events in order of their ids.
+     * @param catalog events
+     * @param capacity maximal number of octets of a page, less than MAX_POOLED_BLOCK
+     * @param copies resource for published copies, safe to use from any thread; it must outlive them
+     * @param max_pages maximal number of pages, events which do not fit are left out
+     */
+    EventsCache(const Catalog& catalog, size_t capacity, std::pmr::memory_resource* copies,
+                size_t max_pages = std::numeric_limits<size_t>::max()) : copies(copies) {
+        pages.emplace_back();
+
+        for (event_id event = 0; event < catalog.size(); event++) {
+            std::string_view description = catalog.description(event);
+            tickets_t tickets = catalog.tickets[event];
+            size_t event_bytes = sizeof(event) + sizeof(tickets) + sizeof(desclen_t) + description.size();
+
+            if (pages.back().serialized.size() + event_bytes > capacity) {
+                if (pages.size() == max_pages)
+                    break;
+
+                pages.emplace_back().first = event;
+            }
+
+            Page& page = pages.back();
+            size_t offset = page.serialized.size();
+            page.serialized.resize(offset + event_bytes);
+            buffer_write(page.serialized.data() + offset, event, tickets,
+                         static_cast<desclen_t>(description.size()), description);
+
+            page.last = event + 1;
+            event_pages.push_back(static_cast<uint32_t>(pages.size() - 1));
+            event_offsets.push_back(static_cast<uint16_t>(offset));
+        }
+    }
+
+    /** Whether the event is serialized in some page */
+    bool contains(event_id event) const {
+        return event < event_pages.size();
+    }
+
+    /** Index of the page holding a contained event */
+    size_t page_of(event_id event) const {
+        return event_pages[event];
+    }
+
+    /** Id following the last event of a page */
+    event_id page_end(size_t page) const {
+        return pages[page].last;
+    }
+
+    /** Offset of a contained event's serialization in its page */
+    size_t event_offset(event_id event) const {
+        return event_offsets[event];
+    }
+
+    /**
+     * Marks the page of an event as changed, if it is contained. The new count
+     * must be readable by the publisher before, it is filled in by publish().
+     */
+    void mark_dirty(event_id event) {
+        if (this->contains(event)) {
+            pages[event_pages[event]].dirty.store(true, std::memory_order_release);
+        }
+    }
+
+    /** Whether a page changed since it was last published */
+    bool is_dirty(size_t page) const {
+        return pages[page].dirty.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Publishes a copy of a page with the ticket counts given by @p tickets_of. A count
+     * changing meanwhile marks the page again, so the next call publishes it.
+     * @param tickets_of callable giving the available tickets of an event
+     */
+    template<typename Counts>
+    void publish(size_t page, Counts&& tickets_of) {
+        Page& published = pages[page];
+
+        /* Cleared before the counts are read, so none changed afterwards goes unnoticed */
+        published.dirty.exchange(false, std::memory_order_acq_rel);
+        auto copy = std::allocate_shared<std::pmr::string>(std::pmr::polymorphic_allocator<std::pmr::string>(copies),
+                                                           std::string_view(published.serialized));
+
+        for (event_id event = published.first; event < published.last; event++) {
+            buffer_write(copy->data() + event_offsets[event] + sizeof(event), tickets_of(event));
+        }
+
+        std::atomic_store(&published.published, snapshot_ptr(std::move(copy)));
+    }
+
+    /** Gives the last published copy of a page, safe to call concurrently with anything */
+    snapshot_ptr snapshot(size_t page) const {
+        return std::atomic_load(&pages[page].published);
+    }
+
+private:
+    struct Page {
+        event_id first = 0; /** Id of the first event in the page */
+        event_id last = 0; /** Id following the last event in the page */
+        std::string serialized; /** Serialized events with their initial counts, never changed */
+        std::atomic<bool> dirty = true; /** Whether counts changed since it was published, pages start unpublished */
+        snapshot_ptr published; /** Last copy with counts filled in */
+    };
+
+    std::pmr::memory_resource* copies; /** Resource of published copies and their control blocks */
+    std::deque<Page> pages; /** Never resized after construction, pages are not movable */
+    std::vector<uint32_t> event_pages; /** Page of each contained event */
+    std::vector<uint16_t> event_offsets; /** Offset of each contained event in its page */
+};
+
+#endif //CINEMA_SERVER_EVENTS_CACHE_H
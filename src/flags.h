@@ -3,6 +3,7 @@
 
 #include <regex>
 #include <limits>
+#include <vector>
 #include <sstream>
 #include <optional>
 #include <unordered_map>
@@ -127,4 +128,32 @@ inline T get_flag_required(const flag_map& flags, const std::string& name) {
     }
 }
 
+/**
+ * Gets a comma-separated flag and converts each of its items to a given type.
+ * If the flag does not exist inside a map, returns an empty list.
+ * @tparam T type to convert an item
+ * @param flags flag map
+ * @param name name of the flag
+ * @return items in the given order
+ */
+template<typename T>
+inline std::vector<T> get_flag_list(const flag_map& flags, const std::string& name) {
+    std::vector<T> items;
+    auto flag_it = flags.find(name);
+
+    if (flag_it == flags.end())
+        return items;
+
+    std::istringstream list(flag_it->second);
+    for (std::string item; std::getline(list, item, ',');) {
+        try {
+            items.push_back(convert_flag<T>(item));
+        } catch (const std::invalid_argument& e) {
+            quit(e.what(), "for", name);
+        }
+    }
+
+    return items;
+}
+
 #endif //CINEMA_SERVER_FLAGS_H
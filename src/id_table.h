@@ -0,0 +1,168 @@
+#ifndef CINEMA_SERVER_ID_TABLE_H
+#define CINEMA_SERVER_ID_TABLE_H
+
+#include <limits>
+#include <vector>
+#include <cstdint>
+
+/**
+ * Table of objects by 32-bit ids which are removed in the order they were inserted.
+ * Objects are stored densely in a ring in insertion order, an open-addressing index
+ * with linear probing finds them, so a lookup touches one bucket in most cases.
+ * The ring and the index double once the ring is full, the table therefore
+ * allocates only when it grows past a power of two, never on removal.
+ * @tparam T stored object, default constructible
+ */
+template<typename T>
+class IdTable {
+public:
+    using id_t = uint32_t;
+
+    /** @param capacity number of objects stored before the table grows */
+    explicit IdTable(size_t capacity = 0) {
+        size_t slots = IdTable::ring_size(capacity);
+
+        ids.resize(slots);
+        values.resize(slots);
+        buckets.assign(2 * slots, EMPTY);
+    }
+
+    /** @return object of the id or nullptr if it is not in the table */
+    T* find(id_t id) {
+        size_t bucket = this->bucket_with(id);
+        return buckets[bucket] == EMPTY ? nullptr : &values[buckets[bucket]];
+    }
+
+    const T* find(id_t id) const {
+        return const_cast<IdTable*>(this)->find(id);
+    }
+
+    /** Stores an object under an id which must not be in the table yet */
+    T& insert(id_t id, T value) {
+        if (count == ids.size()) {
+            this->grow();
+        }
+
+        auto position = static_cast<uint32_t>((first + count++) & (ids.size() - 1));
+        ids[position] = id;
+        values[position] = std::move(value);
+        this->index(position);
+
+        return values[position];
+    }
+
+    /** Id of the object inserted first among those left, the table must not be empty */
+    id_t oldest_id() const {
+        return ids[first];
+    }
+
+    /** Object inserted first among those left, the table must not be empty */
+    const T& oldest() const {
+        return values[first];
+    }
+
+    /** Removes the object inserted first among those left, the table must not be empty */
+    void remove_oldest() {
+        this->unindex(this->bucket_with(ids[first]));
+        values[first] = T{};
+        first = (first + 1) & (ids.size() - 1);
+        count--;
+    }
+
+    /** Invokes @p visit with every id and its object, in insertion order */
+    template<typename Visitor>
+    void for_each(Visitor&& visit) const {
+        for (size_t i = 0; i < count; i++) {
+            size_t position = (first + i) & (ids.size() - 1);
+            visit(ids[position], values[position]);
+        }
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+private:
+    static constexpr uint32_t EMPTY = std::numeric_limits<uint32_t>::max();
+
+    std::vector<id_t> ids; /** Ids of the objects, a power of two of them */
+    std::vector<T> values; /** Objects in insertion order from first on, wrapping around */
+    std::vector<uint32_t> buckets; /** Positions of objects or EMPTY, twice as many as positions */
+    size_t first = 0; /** Position of the oldest object */
+    size_t count = 0; /** Number of objects */
+
+    /** Smallest power of two of positions holding @p capacity objects */
+    static size_t ring_size(size_t capacity) {
+        size_t size = 1;
+
+        while (size < capacity) {
+            size *= 2;
+        }
+
+        return size;
+    }
+
+    /** Fibonacci hashing, so consecutive ids spread over the buckets */
+    size_t bucket_of(id_t id) const {
+        return static_cast<size_t>((static_cast<uint64_t>(id) * 0x9E3779B97F4A7C15ull) >> 32) & (buckets.size() - 1);
+    }
+
+    /** Bucket holding the id, or the empty bucket ending its probe sequence */
+    size_t bucket_with(id_t id) const {
+        size_t bucket = this->bucket_of(id);
+
+        while (buckets[bucket] != EMPTY && ids[buckets[bucket]] != id) {
+            bucket = (bucket + 1) & (buckets.size() - 1);
+        }
+
+        return bucket;
+    }
+
+    void index(uint32_t position) {
+        buckets[this->bucket_with(ids[position])] = position;
+    }
+
+    /** Empties a bucket, moving later buckets of the probe sequence back so that no lookup stops early */
+    void unindex(size_t bucket) {
+        size_t mask = buckets.size() - 1;
+
+        for (size_t next = (bucket + 1) & mask; buckets[next] != EMPTY; next = (next + 1) & mask) {
+            size_t home = this->bucket_of(ids[buckets[next]]);
+
+            /* An entry may fill the hole unless its home lies cyclically after the hole, up to its bucket */
+            if (((next - home) & mask) >= ((next - bucket) & mask)) {
+                buckets[bucket] = buckets[next];
+                bucket = next;
+            }
+        }
+
+        buckets[bucket] = EMPTY;
+    }
+
+    /** Doubles the ring, moving objects to its start, and rebuilds the index */
+    void grow() {
+        std::vector<id_t> grown_ids(2 * ids.size());
+        std::vector<T> grown_values(2 * values.size());
+
+        for (size_t i = 0; i < count; i++) {
+            size_t position = (first + i) & (ids.size() - 1);
+            grown_ids[i] = ids[position];
+            grown_values[i] = std::move(values[position]);
+        }
+
+        ids.swap(grown_ids);
+        values.swap(grown_values);
+        first = 0;
+        buckets.assign(2 * ids.size(), EMPTY);
+
+        for (uint32_t position = 0; position < count; position++) {
+            this->index(position);
+        }
+    }
+};
+
+#endif //CINEMA_SERVER_ID_TABLE_H
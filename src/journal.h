@@ -0,0 +1,366 @@
+#ifndef CINEMA_SERVER_JOURNAL_H
+#define CINEMA_SERVER_JOURNAL_H
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <optional>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "ensure.h"
+#include "buffer.h"
+#include "catalog.h"
+
+/**
+ * Write-ahead journal of state changes. Request threads append records to
+ * a buffer of their shard, a background thread group-commits all buffers with
+ * a single write and fdatasync every GROUP_COMMIT_RECORDS records or every
+ * GROUP_COMMIT_INTERVAL, whichever comes first, so a response precedes the
+ * durability of its record by at most one interval.
+ *
+ * Every record carries a sequence number of its shard. The journal is compacted
+ * into a snapshot of the whole state, tagged with the last sequence number of
+ * every shard, and truncated afterwards. Replay skips records covered by the
+ * snapshot, so a crash at any point of a compaction loses nothing.
+ */
+class Journal {
+public:
+    enum RecordType : uint8_t {
+        RESERVE_RECORD  = 1, /** Reservation created: reservation, event, tickets, cookie, expiration time */
+        PURCHASE_RECORD = 2, /** Tickets bought: reservation, first ticket */
+        EXPIRE_RECORD   = 3, /** Reservation expired: reservation */
+        LEASE_RECORD    = 4  /** Tickets below a number may have been bought: ticket */
+    };
+
+    /** Gives the serialized state with the last sequence number of every shard, see compact() */
+    using snapshot_t = std::function<std::string()>;
+
+    /** Receives the records of every shard in a commit, see on_commit() */
+    using committed_t = std::function<void(const std::vector<std::string>& records)>;
+
+    static constexpr size_t GROUP_COMMIT_RECORDS = 512;
+    static constexpr std::chrono::microseconds GROUP_COMMIT_INTERVAL{1000};
+
+    /** Journal size which triggers a compaction */
+    static constexpr size_t COMPACTION_BYTES = 64 << 20;
+
+    /**
+     * Opens the journal for appending, after it was replayed.
+     * @param path path of the journal, its snapshot has the suffix ".snapshot"
+     * @param sequences last sequence number of every shard
+     */
+    Journal(std::string path, const std::vector<uint64_t>& sequences)
+            : path(std::move(path)), logs(sequences.size()), taken(sequences.size()) {
+        fd = open(this->path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        ensure(fd != -1, "Failed to open journal", this->path);
+
+        for (size_t shard = 0; shard < logs.size(); shard++) {
+            logs[shard].sequence = sequences[shard];
+        }
+    }
+
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
+
+    /** Commits the remaining records */
+    ~Journal() {
+        if (flusher.joinable()) {
+            running.store(false, std::memory_order_release);
+            wake.notify_one();
+            flusher.join();
+        }
+
+        this->flush();
+        close(fd);
+    }
+
+    /**
+     * Compacts the journal, which truncates a torn tail left by a crash,
+     * and starts committing records in the background.
+     * @param snapshot gives the current state, called from the background thread
+     */
+    void start(snapshot_t snapshot) {
+        this->snapshot = std::move(snapshot);
+        this->compact();
+
+        running.store(true, std::memory_order_release);
+        flusher = std::thread(&Journal::commit_loop, this);
+    }
+
+    /**
+     * Appends a record, calls for a shard must be serialized by the caller.
+     * @param shard shard of the changed state
+     * @param type type of the record
+     * @param fields fields of the record, see RecordType
+     */
+    template<typename... Fields>
+    void append(size_t shard, RecordType type, const Fields&... fields) {
+        Log& log = logs[shard];
+
+        {
+            std::lock_guard guard(log.lock);
+            constexpr size_t fields_length = message_size<Fields...>();
+            size_t offset = log.records.size();
+
+            log.records.resize(offset + HEADER_LEN + fields_length);
+            char* record = log.records.data() + offset;
+
+            size_t length = buffer_write(record + sizeof(uint32_t), static_cast<uint16_t>(fields_length), type,
+                                         static_cast<uint16_t>(shard), ++log.sequence, fields...);
+            buffer_write(record, checksum(record + sizeof(uint32_t), length));
+        }
+
+        /* A wakeup lost in a race only delays the commit until the interval passes */
+        if (pending.fetch_add(1, std::memory_order_relaxed) + 1 == GROUP_COMMIT_RECORDS) {
+            wake.notify_one();
+        }
+    }
+
+    /** Compacts the journal soon from the background thread, after a change which records do not tell */
+    void request_compaction() {
+        compaction_requested.store(true, std::memory_order_release);
+        wake.notify_one();
+    }
+
+    /**
+     * Passes the records of every later commit to @p committed, in commit order, from
+     * the committing thread once they are durable. A commit holds whole records only.
+     */
+    void on_commit(committed_t committed) {
+        std::lock_guard guard(committed_lock);
+        this->committed = std::move(committed);
+    }
+
+    /** Last sequence number of a shard, calls for the shard must be serialized with append() */
+    uint64_t sequence(size_t shard) {
+        std::lock_guard guard(logs[shard].lock);
+        return logs[shard].sequence;
+    }
+
+    /** Contents of the snapshot of a journal, if there is one */
+    static std::optional<std::string> read_snapshot(const std::string& path) {
+        std::string name = snapshot_name(path);
+
+        if (access(name.c_str(), F_OK) != 0)
+            return std::nullopt;
+
+        MappedFile file(name);
+        return std::string(file.begin(), file.end());
+    }
+
+    /**
+     * Reads records of a journal up to its end or to the first torn record.
+     * @param path path of the journal
+     * @param visit callable invoked with the type, shard, sequence number and fields of every record
+     * @return number of records read
+     */
+    template<typename Visitor>
+    static size_t replay(const std::string& path, Visitor&& visit) {
+        if (access(path.c_str(), F_OK) != 0)
+            return 0;
+
+        MappedFile file(path);
+        size_t records = 0;
+        const char* end = Journal::read_records(file.begin(), file.end(), [&](auto... record) {
+            visit(record...);
+            records++;
+        });
+
+        if (end != file.end()) {
+            info("Journal", path, "ends with a torn record, dropping", file.end() - end, "octets");
+        }
+
+        return records;
+    }
+
+    /**
+     * Reads records laid out as in a journal, up to the first torn one.
+     * @param visit callable invoked with the type, shard, sequence number and fields of every record
+     * @return end of the last whole record
+     */
+    template<typename Visitor>
+    static const char* read_records(const char* record, const char* end, Visitor&& visit) {
+        while (static_cast<size_t>(end - record) >= HEADER_LEN) {
+            auto fields_length = buffer_read<uint16_t>(record, sizeof(uint32_t));
+            size_t length = HEADER_LEN + fields_length;
+
+            if (static_cast<size_t>(end - record) < length
+                || buffer_read<uint32_t>(record, 0) != checksum(record + sizeof(uint32_t), length - sizeof(uint32_t)))
+                break;
+
+            auto type = static_cast<RecordType>(record[TYPE_OFFSET]);
+            auto shard = buffer_read<uint16_t>(record, TYPE_OFFSET + sizeof(RecordType));
+            auto sequence = buffer_read<uint64_t>(record, SEQUENCE_OFFSET);
+
+            visit(type, shard, sequence, record + HEADER_LEN);
+            record += length;
+        }
+
+        return record;
+    }
+
+private:
+    /** Checksum, fields length, type, shard and sequence number */
+    static constexpr size_t HEADER_LEN = message_size<uint32_t, uint16_t, RecordType, uint16_t, uint64_t>();
+    static constexpr size_t TYPE_OFFSET = sizeof(uint32_t) + sizeof(uint16_t);
+    static constexpr size_t SEQUENCE_OFFSET = TYPE_OFFSET + sizeof(RecordType) + sizeof(uint16_t);
+
+    /** Records of a single shard waiting for a commit */
+    struct Log {
+        std::mutex lock;
+        std::string records;
+        uint64_t sequence = 0;
+    };
+
+    std::string path;
+    int fd = -1;
+    std::vector<Log> logs;
+    std::vector<std::string> taken; /** Buffers swapped with the logs, reused by every commit */
+    size_t journal_bytes = 0; /** Octets written since the last compaction */
+    snapshot_t snapshot;
+
+    std::atomic<size_t> pending = 0; /** Records appended since the last commit */
+    std::atomic<bool> running = false;
+    std::atomic<bool> compaction_requested = false;
+    std::mutex committed_lock; /** Guards committed, set while commits go on */
+    committed_t committed;
+    std::mutex wake_lock;
+    std::condition_variable wake;
+    std::thread flusher;
+
+    static std::string snapshot_name(const std::string& path) {
+        return path + ".snapshot";
+    }
+
+    /** Makes the rename of the snapshot durable before the journal is truncated */
+    void sync_directory() const {
+        size_t separator = path.rfind('/');
+        std::string directory = separator == std::string::npos ? "." : path.substr(0, separator + 1);
+
+        int directory_fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+        ensure(directory_fd != -1 && fsync(directory_fd) != -1, "Failed to sync directory", directory);
+        close(directory_fd);
+    }
+
+    /** FNV-1a, detects records torn by a crash */
+    static uint32_t checksum(const char* data, size_t length) {
+        uint32_t hash = 2166136261u;
+
+        for (size_t i = 0; i < length; i++) {
+            hash = (hash ^ static_cast<uint8_t>(data[i])) * 16777619u;
+        }
+
+        return hash;
+    }
+
+    void commit_loop() {
+        while (running.load(std::memory_order_acquire)) {
+            {
+                std::unique_lock guard(wake_lock);
+                wake.wait_for(guard, GROUP_COMMIT_INTERVAL, [this] {
+                    return !running.load(std::memory_order_acquire)
+                           || pending.load(std::memory_order_relaxed) >= GROUP_COMMIT_RECORDS
+                           || compaction_requested.load(std::memory_order_acquire);
+                });
+            }
+
+            this->flush();
+
+            if (journal_bytes >= COMPACTION_BYTES || compaction_requested.exchange(false, std::memory_order_acq_rel)) {
+                this->compact();
+            }
+        }
+    }
+
+    /** Writes the records of all shards with a single system call and waits until they are durable */
+    void flush() {
+        std::vector<iovec> vectors;
+        size_t length = 0;
+
+        pending.store(0, std::memory_order_relaxed);
+
+        for (size_t shard = 0; shard < logs.size(); shard++) {
+            {
+                std::lock_guard guard(logs[shard].lock);
+                logs[shard].records.swap(taken[shard]);
+            }
+
+            if (!taken[shard].empty()) {
+                vectors.push_back({taken[shard].data(), taken[shard].size()});
+                length += taken[shard].size();
+            }
+        }
+
+        if (length == 0)
+            return;
+
+        this->write_all(vectors);
+        ensure(fdatasync(fd) != -1, "Failed to commit journal", path);
+        journal_bytes += length;
+
+        if (std::lock_guard guard(committed_lock); committed) {
+            committed(taken);
+        }
+
+        for (auto& records : taken) {
+            records.clear();
+        }
+    }
+
+    /** Writes all vectors, continuing after partial writes */
+    void write_all(std::vector<iovec>& vectors) {
+        for (size_t first = 0; first < vectors.size();) {
+            auto count = static_cast<int>(std::min<size_t>(vectors.size() - first, IOV_MAX));
+            ssize_t written = writev(fd, vectors.data() + first, count);
+            ensure(written >= 0 || errno == EINTR, "Failed to write journal", path);
+
+            for (auto left = static_cast<size_t>(std::max<ssize_t>(written, 0)); left > 0;) {
+                size_t part = std::min(left, vectors[first].iov_len);
+                vectors[first].iov_base = static_cast<char*>(vectors[first].iov_base) + part;
+                vectors[first].iov_len -= part;
+                left -= part;
+
+                if (vectors[first].iov_len == 0) {
+                    first++;
+                }
+            }
+        }
+    }
+
+    /**
+     * Replaces the snapshot with the current state and truncates the journal. Only the
+     * committing thread writes the journal, so all records written so far precede the
+     * state, and records still buffered are either covered by it or follow it.
+     */
+    void compact() {
+        std::string state = snapshot();
+        std::string name = snapshot_name(path), temporary = name + ".tmp";
+
+        int snapshot_fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        ensure(snapshot_fd != -1, "Failed to create journal snapshot", temporary);
+        ensure(write(snapshot_fd, state.data(), state.size()) == static_cast<ssize_t>(state.size()),
+               "Failed to write journal snapshot", temporary);
+        ensure(fdatasync(snapshot_fd) != -1 && close(snapshot_fd) != -1, "Failed to commit journal snapshot", temporary);
+        ensure(rename(temporary.c_str(), name.c_str()) != -1, "Failed to replace journal snapshot", name);
+        this->sync_directory();
+
+        ensure(ftruncate(fd, 0) != -1 && fdatasync(fd) != -1, "Failed to truncate journal", path);
+        journal_bytes = 0;
+
+        debug("Compacted journal", path, "into a snapshot of", state.size(), "octets");
+    }
+};
+
+#endif //CINEMA_SERVER_JOURNAL_H
@@ -0,0 +1,284 @@
+#ifndef CINEMA_SERVER_METRICS_H
+#define CINEMA_SERVER_METRICS_H
+
+#include <cmath>
+#include <array>
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <sstream>
+#include <algorithm>
+
+/** Size of a cache line, metrics of different threads never share one */
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+/**
+ * Counter written by a single thread and read by any. An increment is
+ * a plain load and store, without a locked instruction.
+ */
+class Counter {
+public:
+    void add(uint64_t amount = 1) {
+        value.store(value.load(std::memory_order_relaxed) + amount, std::memory_order_relaxed);
+    }
+
+    uint64_t get() const {
+        return value.load(std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> value = 0;
+};
+
+/**
+ * Histogram of nanosecond latencies with log-linear buckets as in HDR
+ * histograms: every power of two is split into SUB_BUCKETS equal buckets,
+ * so a value is recorded with a relative error below 1 / SUB_BUCKETS.
+ * Written by a single thread, like Counter.
+ */
+class LatencyHistogram {
+public:
+    static constexpr unsigned SUB_BITS = 3;
+    static constexpr uint64_t SUB_BUCKETS = 1 << SUB_BITS;
+
+    /** Values from 2^MAX_EXPONENT nanoseconds, about 18 minutes, share the last bucket */
+    static constexpr unsigned MAX_EXPONENT = 40;
+    static constexpr size_t BUCKETS = (MAX_EXPONENT - SUB_BITS + 1) * SUB_BUCKETS;
+
+    void record(uint64_t nanoseconds) {
+        buckets[bucket(nanoseconds)].add();
+        sum.add(nanoseconds);
+    }
+
+    /** Number of values below 2^(exponent + 1) */
+    uint64_t count_below_power(unsigned exponent) const {
+        size_t end = exponent < SUB_BITS ? (size_t{2} << exponent) : (exponent - SUB_BITS + 2) * SUB_BUCKETS;
+        uint64_t total = 0;
+
+        for (size_t i = 0; i < std::min(end, BUCKETS); i++) {
+            total += buckets[i].get();
+        }
+
+        return total;
+    }
+
+    uint64_t count() const {
+        return this->count_below_power(MAX_EXPONENT);
+    }
+
+    uint64_t total() const {
+        return sum.get();
+    }
+
+    /** Highest value of the bucket holding the value at @p quantile, 0 if nothing was recorded */
+    uint64_t quantile(double quantile) const {
+        auto rank = static_cast<uint64_t>(std::ceil(quantile * static_cast<double>(this->count())));
+        uint64_t seen = 0;
+
+        for (size_t i = 0; i < BUCKETS; i++) {
+            seen += buckets[i].get();
+
+            if (seen >= std::max<uint64_t>(rank, 1))
+                return bucket_max(i);
+        }
+
+        return 0;
+    }
+
+    /** Adds values of another histogram, which must not be written meanwhile */
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < BUCKETS; i++) {
+            buckets[i].add(other.buckets[i].get());
+        }
+
+        sum.add(other.sum.get());
+    }
+
+    /** Bucket of a value: its leading bit selects the power of two, the next SUB_BITS bits the sub-bucket */
+    static size_t bucket(uint64_t value) {
+        if (value < SUB_BUCKETS)
+            return static_cast<size_t>(value);
+
+        auto exponent = static_cast<unsigned>(63 - __builtin_clzll(value));
+
+        if (exponent >= MAX_EXPONENT)
+            return BUCKETS - 1;
+
+        uint64_t sub_bucket = (value >> (exponent - SUB_BITS)) & (SUB_BUCKETS - 1);
+        return (exponent - SUB_BITS + 1) * SUB_BUCKETS + static_cast<size_t>(sub_bucket);
+    }
+
+    /** Highest value recorded in a bucket, the inverse of bucket() */
+    static uint64_t bucket_max(size_t index) {
+        if (index < SUB_BUCKETS)
+            return index;
+
+        auto exponent = static_cast<unsigned>(index / SUB_BUCKETS + SUB_BITS - 1);
+        uint64_t width = uint64_t{1} << (exponent - SUB_BITS);
+
+        if (index == BUCKETS - 1)
+            return std::numeric_limits<uint64_t>::max();
+
+        return (uint64_t{1} << exponent) + (index % SUB_BUCKETS + 1) * width - 1;
+    }
+
+private:
+    std::array<Counter, BUCKETS> buckets;
+    Counter sum;
+};
+
+/** Statistics of a single request type */
+struct RequestMetrics {
+    Counter requests; /** Received requests */
+    Counter bad_requests; /** Requests answered with BAD_REQUEST */
+    Counter malformed_requests; /** Requests dropped without a response */
+    LatencyHistogram latency; /** Time of handling sampled requests, from receiving to queueing the response */
+};
+
+/** Statistics of a single worker, written only by its thread */
+template<size_t RequestTypes>
+struct alignas(CACHE_LINE_SIZE) WorkerMetrics {
+    std::array<RequestMetrics, RequestTypes> requests;
+    Counter responses;
+    Counter bytes_sent;
+    Counter expired_reservations;
+    Counter shed_requests; /** Requests dropped by admission control */
+    Counter deferred_requests; /** Reservations queued until their event admits them */
+    Counter queued_responses; /** Responses kept until the socket could take them */
+    Counter dropped_responses; /** Responses dropped on a full backlog or a send error */
+    Counter replayed_tickets; /** GET_TICKETS answered from the replay cache */
+    Counter allocations; /** Heap allocations of the worker thread, see allocations.h */
+};
+
+/**
+ * Statistics of all workers, summed only when exported in the Prometheus
+ * text format, so recording them never contends between threads.
+ * @tparam RequestTypes number of request types told apart
+ */
+template<size_t RequestTypes>
+class Metrics {
+public:
+    using names_t = std::array<const char*, RequestTypes>;
+
+    /**
+     * @param workers number of workers
+     * @param names label of each request type
+     */
+    Metrics(size_t workers, const names_t& names) : names(names) {
+        for (size_t i = 0; i < workers; i++) {
+            this->workers.push_back(std::make_unique<WorkerMetrics<RequestTypes>>());
+        }
+    }
+
+    WorkerMetrics<RequestTypes>& worker(size_t index) {
+        return *workers[index];
+    }
+
+    /** Formats all metrics, each exported latency bucket is a power of two nanoseconds */
+    std::string prometheus() const {
+        std::ostringstream out;
+
+        this->request_counter(out, "requests", "Received requests", &RequestMetrics::requests);
+        this->request_counter(out, "bad_requests", "Requests answered with BAD_REQUEST",
+                              &RequestMetrics::bad_requests);
+        this->request_counter(out, "malformed_requests", "Requests dropped without a response",
+                              &RequestMetrics::malformed_requests);
+
+        this->worker_counter(out, "responses", "Sent responses", &WorkerMetrics<RequestTypes>::responses);
+        this->worker_counter(out, "sent_bytes", "Octets sent in responses", &WorkerMetrics<RequestTypes>::bytes_sent);
+        this->worker_counter(out, "expired_reservations", "Reservations removed after their timeout",
+                             &WorkerMetrics<RequestTypes>::expired_reservations);
+        this->worker_counter(out, "shed_requests", "Requests dropped by admission control",
+                             &WorkerMetrics<RequestTypes>::shed_requests);
+        this->worker_counter(out, "deferred_requests", "Reservations queued until their event admits them",
+                             &WorkerMetrics<RequestTypes>::deferred_requests);
+        this->worker_counter(out, "queued_responses", "Responses kept until the socket could take them",
+                             &WorkerMetrics<RequestTypes>::queued_responses);
+        this->worker_counter(out, "dropped_responses", "Responses dropped on a full backlog or a send error",
+                             &WorkerMetrics<RequestTypes>::dropped_responses);
+        this->worker_counter(out, "replayed_tickets", "GET_TICKETS answered from the replay cache",
+                             &WorkerMetrics<RequestTypes>::replayed_tickets);
+        this->worker_counter(out, "allocations", "Heap allocations of worker threads",
+                             &WorkerMetrics<RequestTypes>::allocations);
+
+        out << "# HELP ticket_server_request_duration_seconds Time of handling a sampled request\n"
+            << "# TYPE ticket_server_request_duration_seconds histogram\n";
+
+        for (size_t type = 0; type < RequestTypes; type++) {
+            for (unsigned exponent = MIN_EXPORTED_EXPONENT; exponent < LatencyHistogram::MAX_EXPONENT; exponent++) {
+                uint64_t below = this->sum([&](const auto& worker) {
+                    return worker.requests[type].latency.count_below_power(exponent);
+                });
+
+                out << "ticket_server_request_duration_seconds_bucket{type=\"" << names[type] << "\",le=\""
+                    << static_cast<double>(uint64_t{2} << exponent) / NANOS_PER_SECOND << "\"} " << below << '\n';
+            }
+
+            uint64_t count = this->sum([&](const auto& worker) {return worker.requests[type].latency.count();});
+            uint64_t total = this->sum([&](const auto& worker) {return worker.requests[type].latency.total();});
+            std::string labels = std::string("{type=\"") + names[type] + "\"";
+
+            out << "ticket_server_request_duration_seconds_bucket" << labels << ",le=\"+Inf\"} " << count << '\n'
+                << "ticket_server_request_duration_seconds_sum" << labels << "} "
+                << static_cast<double>(total) / NANOS_PER_SECOND << '\n'
+                << "ticket_server_request_duration_seconds_count" << labels << "} " << count << '\n';
+        }
+
+        return out.str();
+    }
+
+private:
+    /** Latencies below 2^(MIN_EXPORTED_EXPONENT + 1) nanoseconds, about 2 microseconds, share the first bucket */
+    static constexpr unsigned MIN_EXPORTED_EXPONENT = 10;
+    static constexpr double NANOS_PER_SECOND = 1e9;
+
+    names_t names;
+    std::vector<std::unique_ptr<WorkerMetrics<RequestTypes>>> workers;
+
+    template<typename Read>
+    uint64_t sum(Read&& read) const {
+        uint64_t total = 0;
+
+        for (const auto& worker : workers) {
+            total += read(*worker);
+        }
+
+        return total;
+    }
+
+    void request_counter(std::ostringstream& out, const char* name, const char* help,
+                         Counter RequestMetrics::* counter) const {
+        out << "# HELP ticket_server_" << name << "_total " << help << '\n'
+            << "# TYPE ticket_server_" << name << "_total counter\n";
+
+        for (size_t type = 0; type < RequestTypes; type++) {
+            uint64_t total = this->sum([&](const auto& worker) {return (worker.requests[type].*counter).get();});
+            out << "ticket_server_" << name << "_total{type=\"" << names[type] << "\"} " << total << '\n';
+        }
+    }
+
+    void worker_counter(std::ostringstream& out, const char* name, const char* help,
+                        Counter WorkerMetrics<RequestTypes>::* counter) const {
+        uint64_t total = this->sum([&](const auto& worker) {return (worker.*counter).get();});
+
+        out << "# HELP ticket_server_" << name << "_total " << help << '\n'
+            << "# TYPE ticket_server_" << name << "_total counter\n"
+            << "ticket_server_" << name << "_total " << total << '\n';
+    }
+};
+
+/**
+ * Formats a single metric in the Prometheus text format.
+ * @param name name without the ticket_server_ prefix
+ * @param type "gauge" or "counter"
+ */
+inline std::string prometheus_value(const std::string& name, const std::string& type,
+                                    const std::string& help, uint64_t value) {
+    return "# HELP ticket_server_" + name + " " + help + "\n# TYPE ticket_server_" + name + " " + type + "\n"
+           + "ticket_server_" + name + " " + std::to_string(value) + "\n";
+}
+
+#endif //CINEMA_SERVER_METRICS_H
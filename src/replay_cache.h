@@ -0,0 +1,127 @@
+#ifndef CINEMA_SERVER_REPLAY_CACHE_H
+#define CINEMA_SERVER_REPLAY_CACHE_H
+
+#include <list>
+#include <memory>
+#include <string>
+#include <iterator>
+#include <unordered_map>
+#include <memory_resource>
+
+#include "clock.h"
+#include "database.h"
+
+/**
+ * Encoded TICKETS responses of bought reservations, so a client retrying
+ * GET_TICKETS over a lossy network is answered with the ready octets instead
+ * of locking its shard and encoding up to MAX_TICKETS tickets again. Bought
+ * tickets never change, an entry is only dropped once the database may have
+ * pruned its reservation; a retry is still checked against the cookie of its
+ * entry. Entries are evicted least recently
+ * used first once their octets exceed a budget. Nodes of the recency list and
+ * the index, and the responses themselves, are recycled by a pool of the cache,
+ * so an eviction followed by an insertion reuses them. Used by a single worker.
+ */
+class ReplayCache {
+public:
+    using payload_ptr = EventsCache::snapshot_ptr;
+
+    /** Largest block recycled by the pool, no response fits into a datagram beyond it */
+    static constexpr size_t MAX_POOLED_BLOCK = 1 << 16;
+
+    /** @param budget octets of cached responses, 0 disables the cache */
+    explicit ReplayCache(size_t budget) : budget(budget), nodes(std::pmr::pool_options{0, MAX_POOLED_BLOCK}) {}
+
+    /**
+     * Allocates a zeroed response of @p length octets and its control block from the pool,
+     * reusing memory of evicted responses once they were sent. It must not outlive the cache.
+     */
+    std::shared_ptr<std::pmr::string> make_response(size_t length) {
+        return std::allocate_shared<std::pmr::string>(std::pmr::polymorphic_allocator<std::pmr::string>(&nodes),
+                                                      length, '\0');
+    }
+
+    /**
+     * Gives the cached response of a reservation and marks it as recently used.
+     * @return response without the type octet, nullptr if it is not cached, its reservation
+     * is no longer kept or the cookie differs
+     */
+    payload_ptr find(Database::reservation_id reservation, const Database::cookie_t& cookie) {
+        auto entry = index.find(reservation);
+
+        if (entry == index.end())
+            return nullptr;
+
+        /* The reservation may be pruned and its id given to another one, which the database answers for */
+        if (entry->second->kept_until < Clock::wall_now()) {
+            this->erase(entry->second);
+            return nullptr;
+        }
+
+        if (entry->second->cookie != cookie)
+            return nullptr;
+
+        entries.splice(entries.begin(), entries, entry->second);
+        return entry->second->response;
+    }
+
+    /**
+     * Caches the response of a reservation, evicting the least recently used ones to fit it.
+     * @param kept_until last wall second the bought reservation is surely kept, see Database::purchase()
+     * @param response response without the type octet, not cached if it alone exceeds the budget
+     */
+    void insert(Database::reservation_id reservation, const Database::cookie_t& cookie,
+                Database::seconds_t kept_until, payload_ptr response) {
+        size_t size = ReplayCache::entry_size(*response);
+
+        if (size > budget)
+            return;
+
+        /* An entry left by a pruned reservation whose id was given again makes room */
+        if (auto existing = index.find(reservation); existing != index.end()) {
+            if (existing->second->kept_until >= Clock::wall_now())
+                return;
+
+            this->erase(existing->second);
+        }
+
+        while (used + size > budget) {
+            this->erase(std::prev(entries.end()));
+        }
+
+        entries.push_front({reservation, cookie, kept_until, std::move(response)});
+        index.emplace(reservation, entries.begin());
+        used += size;
+    }
+
+    bool enabled() const {
+        return budget > 0;
+    }
+
+private:
+    struct Entry {
+        Database::reservation_id reservation;
+        Database::cookie_t cookie;
+        Database::seconds_t kept_until; /** Last wall second the bought reservation is surely kept */
+        payload_ptr response;
+    };
+
+    size_t budget;
+    size_t used = 0; /** Octets of all entries */
+    std::pmr::unsynchronized_pool_resource nodes; /** Declared before the containers, which return nodes to it */
+    std::pmr::list<Entry> entries{&nodes}; /** Most recently used first */
+    std::pmr::unordered_map<Database::reservation_id, std::pmr::list<Entry>::iterator> index{&nodes};
+
+    void erase(std::pmr::list<Entry>::iterator entry) {
+        used -= ReplayCache::entry_size(*entry->response);
+        index.erase(entry->reservation);
+        entries.erase(entry);
+    }
+
+    /** Octets of a response with the bookkeeping of its entry, so small responses count too */
+    static size_t entry_size(const std::pmr::string& response) {
+        return response.size() + sizeof(Entry) + sizeof(std::pmr::string);
+    }
+};
+
+#endif //CINEMA_SERVER_REPLAY_CACHE_H
@@ -0,0 +1,366 @@
+#ifndef CINEMA_SERVER_REPLICATION_H
+#define CINEMA_SERVER_REPLICATION_H
+
+#include <array>
+#include <mutex>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cerrno>
+#include <cstdint>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "ensure.h"
+#include "buffer.h"
+#include "address.h"
+#include "clock.h"
+#include "journal.h"
+#include "database.h"
+
+namespace {
+    /** Frames of the replication stream: type, payload length and payload */
+    enum FrameType : uint8_t {
+        STATE_FRAME     = 1, /** State of the leader, see Database::replication_state() */
+        RECORDS_FRAME   = 2, /** Records of a journal commit, laid out as in the journal */
+        HEARTBEAT_FRAME = 3  /** Empty, sent while no records are committed */
+    };
+
+    constexpr size_t FRAME_HEADER_LEN = message_size<FrameType, uint64_t>();
+
+    /** A leader silent for FAILOVER_TIMEOUT is lost, it sends a heartbeat after HEARTBEAT_INTERVAL */
+    constexpr std::chrono::milliseconds HEARTBEAT_INTERVAL{100};
+    constexpr std::chrono::milliseconds FAILOVER_TIMEOUT{1000};
+
+    /** Octets of records queued for a follower before it is dropped as too slow, see ReplicationLeader::ship() */
+    constexpr size_t MAX_QUEUED_RECORDS = 64 << 20;
+
+    /** Longest frame a follower takes, a leader with a larger state cannot be followed */
+    constexpr uint64_t MAX_FRAME_LEN = 1 << 30;
+}
+
+/**
+ * Leader side of hot-standby replication. A follower connecting over TCP gets the
+ * state of the leader, then every group of records committed by the journal since,
+ * so it applies exactly what the leader journals. Records are queued by the committing
+ * thread and sent by the thread of the leader without waiting for the follower, so
+ * replication never delays a response. A follower which falls MAX_QUEUED_RECORDS
+ * behind is disconnected, it reconnects and starts over from a fresh state.
+ * One follower is served at a time.
+ */
+class ReplicationLeader {
+public:
+    using state_t = std::function<std::string()>;
+
+    /**
+     * @param port TCP port followers connect to, on all addresses
+     * @param state gives the current state, see Database::replication_state()
+     */
+    ReplicationLeader(uint16_t port, state_t state) : state(std::move(state)) {
+        /* Takes IPv4 followers too, unless the host has no IPv6 */
+        sockaddr_storage address = listen_address("::", port);
+        listen_fd = socket(AF_INET6, SOCK_STREAM, 0);
+
+        if (listen_fd == -1) {
+            address = listen_address(ANY_IPV4, port);
+            listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+        } else {
+            int ipv6_only = 0;
+            setsockopt(listen_fd, IPPROTO_IPV6, IPV6_V6ONLY, &ipv6_only, sizeof(ipv6_only));
+        }
+
+        int reuse = 1;
+        ensure(listen_fd != -1 && setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != -1,
+               "Failed to create a replication socket");
+        ensure(bind(listen_fd, reinterpret_cast<const sockaddr*>(&address), address_length(address)) != -1
+               && listen(listen_fd, 1) != -1, "Failed to listen for followers on port", port);
+        debug("Listening for followers on port", port);
+    }
+
+    ReplicationLeader(const ReplicationLeader&) = delete;
+    ReplicationLeader& operator=(const ReplicationLeader&) = delete;
+
+    ~ReplicationLeader() {
+        close(listen_fd);
+    }
+
+    /**
+     * Queues committed records for the follower, if one is connected. A follower whose
+     * queue would grow past MAX_QUEUED_RECORDS is disconnected and the records are dropped.
+     * @param records records of every shard, see Journal::on_commit()
+     */
+    void ship(const std::vector<std::string>& records) {
+        std::lock_guard guard(lock);
+
+        if (!following)
+            return;
+
+        size_t length = 0;
+        for (const auto& shard_records : records) {
+            length += shard_records.size();
+        }
+
+        if (length == 0)
+            return;
+
+        if (size_t behind = queued.size() + FRAME_HEADER_LEN + length; behind > MAX_QUEUED_RECORDS) {
+            alert("Follower fell", behind, "octets behind, disconnecting it");
+            this->drop_follower();
+            return;
+        }
+
+        Frame header = ReplicationLeader::frame_header(RECORDS_FRAME, length);
+        queued.append(header.data(), header.size());
+
+        for (const auto& shard_records : records) {
+            queued.append(shard_records);
+        }
+
+        ready.notify_one();
+    }
+
+    [[noreturn]] void start() {
+        while (true) {
+            sockaddr_storage client{};
+            auto client_len = static_cast<socklen_t>(sizeof(client));
+            int follower = accept(listen_fd, reinterpret_cast<sockaddr*>(&client), &client_len);
+
+            if (follower == -1) {
+                ensure(errno == EINTR || errno == ECONNABORTED, "Failed to accept a follower");
+                continue;
+            }
+
+            info("Replicating to follower", address_string(client));
+            this->serve(follower);
+            alert("Lost follower", address_string(client));
+            close(follower);
+        }
+    }
+
+private:
+    using Frame = std::array<char, FRAME_HEADER_LEN>;
+
+    int listen_fd = -1;
+    state_t state;
+
+    std::mutex lock; /** Guards following, follower_fd and queued */
+    std::condition_variable ready;
+    bool following = false; /** Whether commits are queued for a follower */
+    int follower_fd = -1; /** Socket of the follower while commits are queued for it */
+    std::string queued; /** Frames waiting for the follower */
+
+    static Frame frame_header(FrameType type, uint64_t length) {
+        Frame header{};
+        buffer_write(header.data(), type, length);
+        return header;
+    }
+
+    /** Streams to a follower until it is lost */
+    void serve(int follower) {
+        int no_delay = 1;
+        setsockopt(follower, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+
+        /* Commits from now on are queued, those the state covers are skipped by the follower */
+        {
+            std::lock_guard guard(lock);
+            following = true;
+            follower_fd = follower;
+            queued.clear();
+        }
+
+        std::string sending = this->state();
+        Frame header = ReplicationLeader::frame_header(STATE_FRAME, sending.size());
+        sending.insert(0, header.data(), header.size());
+
+        while (ReplicationLeader::send_all(follower, sending)) {
+            sending.clear();
+
+            std::unique_lock guard(lock);
+            ready.wait_for(guard, HEARTBEAT_INTERVAL, [this] {return !queued.empty() || !following;});
+
+            if (!following)
+                return;
+
+            sending.swap(queued);
+            guard.unlock();
+
+            if (sending.empty()) {
+                header = ReplicationLeader::frame_header(HEARTBEAT_FRAME, 0);
+                sending.assign(header.data(), header.size());
+            }
+        }
+
+        std::lock_guard guard(lock);
+        this->drop_follower();
+    }
+
+    /**
+     * Stops queueing commits and ends the connection of the follower, a send blocked on it
+     * returns; lock must be held.
+     */
+    void drop_follower() {
+        if (following) {
+            shutdown(follower_fd, SHUT_RDWR);
+        }
+
+        following = false;
+        follower_fd = -1;
+        queued.clear();
+        ready.notify_one();
+    }
+
+    static bool send_all(int follower, const std::string& data) {
+        for (size_t sent = 0; sent < data.size();) {
+            ssize_t written = send(follower, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+
+            if (written < 0 && errno != EINTR)
+                return false;
+
+            sent += static_cast<size_t>(std::max<ssize_t>(written, 0));
+        }
+
+        return true;
+    }
+};
+
+/**
+ * Follower side of hot-standby replication. It applies the state and records of its
+ * leader to a database which serves no requests yet. Once the connection ends or the
+ * leader stays silent for FAILOVER_TIMEOUT, it connects again: a leader which is still
+ * up sends a fresh state replacing the applied one, as after dropping a slow follower.
+ * Otherwise the leader is lost and the follower takes over, see Database::promote().
+ */
+class ReplicationFollower {
+public:
+    /** @param leader address and replication port of the leader */
+    explicit ReplicationFollower(const sockaddr_storage& leader) : leader(leader), name(address_string(leader)) {}
+
+    /**
+     * Replicates the leader until it is lost. Connecting is retried until the leader
+     * sends its state, a database which never got the state is never promoted.
+     * @return last sequence number of every shard, see Database::promote()
+     */
+    std::vector<uint64_t> follow(Database& database, size_t shards) {
+        std::vector<uint64_t> sequences(shards, 0);
+        std::string frame;
+        bool replicated = false;
+
+        while (true) {
+            int socket_fd = this->connect_leader();
+            FrameType type{};
+            bool connected = socket_fd != -1 && this->receive_frame(socket_fd, type, frame) && type == STATE_FRAME;
+
+            /* No worker ticks the clock yet, deadlines of replicated reservations are converted by it */
+            if (connected) {
+                Clock::tick();
+                database.replicate_state(frame, sequences, name);
+                info("Following leader", name, "from its state of", frame.size(), "octets");
+                replicated = true;
+
+                while (this->receive_frame(socket_fd, type, frame)) {
+                    Clock::tick();
+
+                    if (type == RECORDS_FRAME) {
+                        this->apply_records(database, frame, sequences);
+                    }
+                }
+
+                alert("Lost connection to leader", name);
+            }
+
+            if (socket_fd != -1) {
+                close(socket_fd);
+            }
+
+            if (replicated && !connected) {
+                alert("Lost leader", name);
+                return sequences;
+            }
+
+            /* A connection just lost is tried again at once, the leader may have dropped a slow follower */
+            if (!connected) {
+                std::this_thread::sleep_for(HEARTBEAT_INTERVAL);
+            }
+        }
+    }
+
+private:
+    sockaddr_storage leader;
+    std::string name; /** Printable address of the leader */
+
+    /** @return connected socket or -1 */
+    int connect_leader() const {
+        int socket_fd = socket(leader.ss_family, SOCK_STREAM, 0);
+        ensure(socket_fd != -1, "Failed to create a replication socket");
+
+        /* Microseconds must stay below a second, or the kernel refuses the timeout; the send one bounds connect */
+        timeval timeout{static_cast<time_t>(FAILOVER_TIMEOUT.count() / 1000),
+                        static_cast<suseconds_t>(FAILOVER_TIMEOUT.count() % 1000 * 1000)};
+        ensure(setsockopt(socket_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) != -1
+               && setsockopt(socket_fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout)) != -1,
+               "Failed to set the failover timeout of the replication socket");
+
+        if (connect(socket_fd, reinterpret_cast<const sockaddr*>(&leader), address_length(leader)) == -1) {
+            debug("Failed to connect to leader", name);
+            close(socket_fd);
+            return -1;
+        }
+
+        return socket_fd;
+    }
+
+    /**
+     * @return false if the connection ended, the leader was silent for FAILOVER_TIMEOUT
+     * or the frame is longer than MAX_FRAME_LEN, so the stream is corrupt
+     */
+    bool receive_frame(int socket_fd, FrameType& type, std::string& frame) const {
+        std::array<char, FRAME_HEADER_LEN> header{};
+
+        if (!ReplicationFollower::receive_all(socket_fd, header.data(), header.size()))
+            return false;
+
+        type = static_cast<FrameType>(header[0]);
+        auto length = buffer_read<uint64_t>(header.data(), sizeof(FrameType));
+
+        if (length > MAX_FRAME_LEN) {
+            alert("Leader", name, "sent a frame of", length, "octets, dropping the connection");
+            return false;
+        }
+
+        frame.resize(length);
+
+        return ReplicationFollower::receive_all(socket_fd, frame.data(), frame.size());
+    }
+
+    static bool receive_all(int socket_fd, char* data, size_t length) {
+        for (size_t received = 0; received < length;) {
+            ssize_t read = recv(socket_fd, data + received, length - received, 0);
+
+            if (read == 0 || (read < 0 && errno != EINTR))
+                return false;
+
+            received += static_cast<size_t>(std::max<ssize_t>(read, 0));
+        }
+
+        return true;
+    }
+
+    void apply_records(Database& database, const std::string& frame, std::vector<uint64_t>& sequences) const {
+        const char* end = Journal::read_records(frame.data(), frame.data() + frame.size(),
+                                                [&](Journal::RecordType type, uint16_t shard, uint64_t sequence,
+                                                    const char* fields) {
+            database.replicate_record(type, shard, sequence, fields, sequences, name);
+        });
+
+        ensure(end == frame.data() + frame.size(), "Leader", name, "sent a corrupt record");
+    }
+};
+
+#endif //CINEMA_SERVER_REPLICATION_H
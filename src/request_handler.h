@@ -0,0 +1,419 @@
+#ifndef CINEMA_SERVER_REQUEST_HANDLER_H
+#define CINEMA_SERVER_REQUEST_HANDLER_H
+
+#include <array>
+#include <chrono>
+#include <limits>
+#include <memory>
+#include <string>
+
+#include "ensure.h"
+#include "buffer.h"
+#include "tickets.h"
+#include "metrics.h"
+#include "database.h"
+#include "replay_cache.h"
+
+/**
+ * Protocol core of a worker: parses a request, queries the database and
+ * writes the response over the request, without touching sockets, so it
+ * can be driven from memory as well as by TicketServer.
+ */
+class RequestHandler {
+public:
+    enum ClientRequest : uint8_t {
+        GET_EVENTS       = 1, /** Request to list available events */
+        GET_RESERVATION  = 3, /** Request to reserve tickets to an event */
+        GET_TICKETS      = 5, /** Request to buy reserved tickets */
+        GET_EVENTS_PAGE  = 7, /** Request to list available events starting with a cursor */
+        GET_RESERVATIONS = 9  /** Request to reserve tickets to several events at once */
+    };
+
+    enum ServerResponse : uint8_t {
+        EVENTS       = 2,  /** Response to list available requests */
+        RESERVATION  = 4,  /** Response to confirm ticket reservation */
+        TICKETS      = 6,  /** Response to send bought tickets */
+        EVENTS_PAGE  = 8,  /** Response to list a page of events with the next cursor */
+        RESERVATIONS = 10, /** Response to confirm reservations of several events */
+        BAD_REQUEST  = 255 /** Response to an invalid request */
+    };
+
+    /** Size of a request buffer, also the longest response */
+    static constexpr size_t MAX_DATAGRAM = 65507;
+
+    /** Message length of RESERVATION response: reservation, event, tickets, cookie and expiration time */
+    static constexpr size_t RESERVATION_LEN = message_size<ServerResponse, Database::reservation_id,
+            Database::event_id, Database::tickets_t, Database::cookie_t, Database::seconds_t>();
+
+    /** Maximal number of events in a GET_RESERVATIONS request */
+    static constexpr size_t MAX_BULK_RESERVATIONS = std::numeric_limits<uint8_t>::max();
+    static_assert(MAX_BULK_RESERVATIONS <= Database::MAX_BULK_RESERVATIONS, "Reserved together by the database");
+
+    /** Longest well-formed request, GET_RESERVATIONS of MAX_BULK_RESERVATIONS events */
+    static constexpr size_t MAX_REQUEST_LEN = message_size<ClientRequest, uint8_t>()
+            + MAX_BULK_RESERVATIONS * message_size<Database::event_id, Database::tickets_t>();
+
+    /** Message length of a single reservation in RESERVATIONS response, as in RESERVATION without the type */
+    static constexpr size_t BULK_RESERVATION_LEN = RESERVATION_LEN - sizeof(ServerResponse);
+
+    /** Message length of BAD_REQUEST response: event or reservation */
+    static constexpr size_t BAD_REQUEST_LEN = message_size<ServerResponse, uint32_t>();
+
+    /** Message length of TICKETS response without the tickets: reservation and their number */
+    static constexpr size_t TICKETS_HEADER_LEN = message_size<ServerResponse, Database::reservation_id,
+            Database::tickets_t>();
+
+    /** Request types told apart by metrics, the last one stands for unknown types */
+    static constexpr std::array<const char*, 6> REQUEST_NAMES = {
+        "GET_EVENTS", "GET_RESERVATION", "GET_TICKETS", "GET_EVENTS_PAGE", "GET_RESERVATIONS", "UNKNOWN"
+    };
+
+    using metrics_t = Metrics<REQUEST_NAMES.size()>;
+    using payload_ptr = ReplayCache::payload_ptr;
+
+    /** One request of every LATENCY_SAMPLING of a type is timed, the clock costs more than most requests */
+    static constexpr uint64_t LATENCY_SAMPLING = 16;
+
+    /** Response written over the request buffer */
+    struct Response {
+        size_t length = 0; /** Octets at the beginning of the buffer, 0 if there is no response */
+        payload_ptr payload; /** Octets sent after the buffer without copying them, may be nullptr */
+        size_t payload_offset = 0; /** Number of leading payload octets to skip */
+    };
+
+    /** Default octets of TICKETS responses a worker keeps for retried GET_TICKETS requests */
+    static constexpr size_t REPLAY_CACHE_BUDGET = 4 << 20;
+
+    /** Fewer tickets are encoded again faster than a cache entry is made, so they are not cached */
+    static constexpr Database::tickets_t MIN_REPLAYED_TICKETS = 64;
+
+    /**
+     * @param database tables shared by all workers
+     * @param shard shard of the worker owning the handler, which holds its reservations of hot events
+     * @param metrics statistics of the worker owning the handler
+     * @param replay_budget octets of cached TICKETS responses, 0 disables the cache
+     */
+    RequestHandler(Database& database, size_t shard, WorkerMetrics<REQUEST_NAMES.size()>& metrics,
+                   size_t replay_budget = REPLAY_CACHE_BUDGET)
+            : database(database), shard(shard), metrics(metrics), replayed(replay_budget) {}
+
+    /**
+     * Handles a request and records its statistics, its latency only if it is sampled.
+     * @param request request of @p length octets in a buffer of MAX_DATAGRAM octets,
+     * overwritten with the response
+     * @param length request length
+     * @return response, of length 0 if the request is malformed
+     */
+    Response handle(char* request, size_t length) {
+        if (length == 0) {
+            debug("Received an empty request");
+            return {};
+        }
+
+        const Dispatch& dispatch = DISPATCH[static_cast<uint8_t>(request[0])];
+        RequestMetrics& request_metrics = metrics.requests[dispatch.metric];
+        bool sampled = request_metrics.requests.get() % LATENCY_SAMPLING == 0;
+        auto handling_start = sampled ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point{};
+
+        buffer = request;
+        response = {};
+
+        if (malformed_t malformed = this->dispatch_request(dispatch, length)) {
+            request_metrics.malformed_requests.add();
+            debug(malformed, "in a request of", length, "octets");
+            response = {};
+        } else if (response.length > 0 && static_cast<uint8_t>(buffer[0]) == BAD_REQUEST) {
+            /* The response overwrites the request */
+            request_metrics.bad_requests.add();
+        }
+
+        request_metrics.requests.add();
+
+        if (sampled) {
+            auto handling_time = std::chrono::steady_clock::now() - handling_start;
+            request_metrics.latency.record(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(handling_time).count()));
+        }
+
+        return std::move(response);
+    }
+
+    static std::string response_name(ServerResponse response) {
+        switch(response) {
+            case EVENTS:
+                return "EVENTS";
+            case RESERVATION:
+                return "RESERVATION";
+            case TICKETS:
+                return "TICKETS";
+            case EVENTS_PAGE:
+                return "EVENTS_PAGE";
+            case RESERVATIONS:
+                return "RESERVATIONS";
+            default:
+                return "BAD_REQUEST";
+        }
+    }
+
+    /**
+     * Reads events of a well-formed GET_RESERVATION or GET_RESERVATIONS request without handling it,
+     * so that admission control can look at them before the request reaches the database.
+     * @param request request
+     * @param length request length
+     * @param visit callable invoked with every Database::ReservationRequest
+     * @return number of visited events, 0 if the request reserves nothing or is malformed
+     */
+    template<typename Visitor>
+    static size_t reserved_events(const char* request, size_t length, Visitor&& visit) {
+        if (length == GET_RESERVATION_LEN && request[0] == GET_RESERVATION) {
+            visit(read_reservation_request(request, REQUEST_FIELDS));
+            return 1;
+        }
+
+        if (length < GET_RESERVATIONS_HEADER_LEN || request[0] != GET_RESERVATIONS)
+            return 0;
+
+        auto count = buffer_read<uint8_t>(request, REQUEST_FIELDS);
+
+        if (count == 0 || length != GET_RESERVATIONS_HEADER_LEN + count * BULK_REQUEST_LEN)
+            return 0;
+
+        for (size_t i = 0; i < count; i++) {
+            visit(read_reservation_request(request, GET_RESERVATIONS_HEADER_LEN + i * BULK_REQUEST_LEN));
+        }
+
+        return count;
+    }
+
+private:
+    using tickets_t      = Database::tickets_t;
+    using event_id       = Database::event_id;
+    using reservation_id = Database::reservation_id;
+    using cookie_t       = Database::cookie_t;
+
+    /** Message length of GET_EVENTS request */
+    static constexpr size_t GET_EVENTS_LEN      = message_size<ClientRequest>();
+
+    /** Message length of GET_RESERVATION request */
+    static constexpr size_t GET_RESERVATION_LEN = message_size<ClientRequest, event_id, tickets_t>();
+
+    /** Message length of GET_TICKETS request */
+    static constexpr size_t GET_TICKETS_LEN     = message_size<ClientRequest, reservation_id, cookie_t>();
+
+    /** Message length of GET_EVENTS_PAGE request */
+    static constexpr size_t GET_EVENTS_PAGE_LEN = message_size<ClientRequest, event_id>();
+
+    /** Message length of GET_RESERVATIONS request without its events: number of events */
+    static constexpr size_t GET_RESERVATIONS_HEADER_LEN = message_size<ClientRequest, uint8_t>();
+
+    /** Message length of a single event of GET_RESERVATIONS request: event and tickets */
+    static constexpr size_t BULK_REQUEST_LEN = message_size<event_id, tickets_t>();
+
+    /** Offset of the first field following the request type */
+    static constexpr size_t REQUEST_FIELDS = sizeof(ClientRequest);
+
+    /** Why a request is malformed, nullptr if it is well-formed and was handled */
+    using malformed_t = const char*;
+
+    /** How requests of a type are checked and handled */
+    struct Dispatch {
+        malformed_t (RequestHandler::*handle)(size_t request_len); /** nullptr for unknown types */
+        size_t length; /** Request length, the least one if the handler checks the rest */
+        bool exact; /** Whether the length is the only valid one */
+        size_t metric; /** Index in REQUEST_NAMES */
+        malformed_t invalid_length; /** Why a request of another length is malformed */
+    };
+
+    static Database::ReservationRequest read_reservation_request(const char* request, size_t offset) {
+        return {buffer_read<event_id>(request, offset), buffer_read<tickets_t>(request, offset + sizeof(event_id))};
+    }
+
+    Database& database; /** Tables shared with other workers */
+    size_t shard; /** Shard of the owning worker */
+    WorkerMetrics<REQUEST_NAMES.size()>& metrics; /** Statistics written only by the owning worker */
+
+    /** TICKETS responses of reservations bought through this handler, declared before the responses from its pool */
+    ReplayCache replayed;
+
+    char* buffer = nullptr; /** Currently handled request, overwritten with its response */
+    Response response; /** Response to the currently handled request */
+
+    /** Events of the currently handled GET_RESERVATIONS request and their reservations */
+    std::array<Database::ReservationRequest, MAX_BULK_RESERVATIONS> bulk_requests{};
+    std::array<Database::Reservation, MAX_BULK_RESERVATIONS> bulk_reservations{};
+
+    void send_response(size_t length, payload_ptr payload = nullptr, size_t payload_offset = 0) {
+        response = {length, std::move(payload), payload_offset};
+    }
+
+    malformed_t dispatch_request(const Dispatch& dispatch, size_t request_len) {
+        if (dispatch.handle == nullptr)
+            return "Unknown request type";
+
+        if (dispatch.exact ? request_len != dispatch.length : request_len < dispatch.length)
+            return dispatch.invalid_length;
+
+        return (this->*dispatch.handle)(request_len);
+    }
+
+    malformed_t handle_get_events_request(size_t) {
+        this->send_events();
+        return nullptr;
+    }
+
+    void send_events() {
+        size_t bytes = buffer_write(buffer, EVENTS);
+        this->send_response(bytes, database.events_snapshot());
+    }
+
+    malformed_t handle_get_events_page_request(size_t) {
+        auto cursor = buffer_read<event_id>(buffer, REQUEST_FIELDS);
+        auto page = database.events_page(cursor);
+
+        if (page.has_value()) {
+            this->send_events_page(page.value());
+        } else {
+            debug("Cursor", cursor, "is past the last event");
+            this->send_bad_request<event_id>(cursor);
+        }
+
+        return nullptr;
+    }
+
+    void send_events_page(const Database::EventsPage& page) {
+        size_t bytes = buffer_write(buffer, EVENTS_PAGE, page.next);
+        this->send_response(bytes, page.events, page.offset);
+    }
+
+    malformed_t handle_get_reservation_request(size_t) {
+        auto [event, tickets] = read_reservation_request(buffer, REQUEST_FIELDS);
+        auto reservation = database.reserve(event, tickets, shard);
+
+        if (reservation.has_value()) {
+            this->send_reservation(event, tickets, reservation.value());
+        } else {
+            this->send_bad_request<event_id>(event);
+        }
+
+        return nullptr;
+    }
+
+    void send_reservation(event_id event, tickets_t tickets, const Database::Reservation& reservation) {
+        size_t bytes = buffer_write(buffer, RESERVATION, reservation.id, event, tickets, reservation.cookie,
+                                    reservation.expiration_time);
+        this->send_response(bytes);
+    }
+
+    malformed_t handle_get_reservations_request(size_t request_len) {
+        auto count = buffer_read<uint8_t>(buffer, REQUEST_FIELDS);
+
+        if (count == 0 || request_len != GET_RESERVATIONS_HEADER_LEN + count * BULK_REQUEST_LEN)
+            return "GET_RESERVATIONS request has invalid length";
+
+        for (size_t i = 0; i < count; i++) {
+            bulk_requests[i] = read_reservation_request(buffer, GET_RESERVATIONS_HEADER_LEN + i * BULK_REQUEST_LEN);
+        }
+
+        auto unavailable = database.reserve_all(bulk_requests.data(), count, bulk_reservations.data());
+
+        if (unavailable.has_value()) {
+            this->send_bad_request<event_id>(unavailable.value());
+        } else {
+            this->send_reservations(count);
+        }
+
+        return nullptr;
+    }
+
+    void send_reservations(uint8_t count) {
+        size_t bytes = buffer_write(buffer, RESERVATIONS, count);
+
+        for (size_t i = 0; i < count; i++) {
+            const Database::Reservation& reservation = bulk_reservations[i];
+            bytes += buffer_write(buffer + bytes, reservation.id, bulk_requests[i].event, bulk_requests[i].tickets,
+                                  reservation.cookie, reservation.expiration_time);
+        }
+
+        this->send_response(bytes);
+    }
+
+    malformed_t handle_get_tickets_request(size_t) {
+        auto reservation = buffer_read<reservation_id>(buffer, REQUEST_FIELDS);
+        auto cookie = buffer_read<cookie_t>(buffer, REQUEST_FIELDS + sizeof(reservation));
+
+        if (auto tickets = replayed.find(reservation, cookie)) {
+            debug("Replaying tickets for reservation", reservation);
+            metrics.replayed_tickets.add();
+            this->send_response(buffer_write(buffer, TICKETS), std::move(tickets));
+            return nullptr;
+        }
+
+        bool purchased = database.purchase(reservation, cookie, [&](uint64_t first_ticket, tickets_t tickets,
+                                                                    Database::seconds_t kept_until) {
+            this->send_tickets(reservation, cookie, first_ticket, tickets, kept_until);
+        });
+
+        if (!purchased) {
+            this->send_bad_request<reservation_id>(reservation);
+        }
+
+        return nullptr;
+    }
+
+    void send_tickets(reservation_id reservation, const cookie_t& cookie, uint64_t first_ticket, tickets_t tickets,
+                      Database::seconds_t kept_until) {
+        debug("Sending", tickets, "tickets for reservation", reservation);
+
+        if (!replayed.enabled() || tickets < MIN_REPLAYED_TICKETS) {
+            size_t bytes = buffer_write(buffer, TICKETS, reservation, tickets);
+            bytes += tickets_write(buffer + bytes, first_ticket, tickets);
+            this->send_response(bytes);
+            return;
+        }
+
+        /* Encoded once into a payload which retries are answered with */
+        auto encoded = replayed.make_response(TICKETS_HEADER_LEN - sizeof(ServerResponse) + tickets * TICKET_LEN);
+        size_t bytes = buffer_write(encoded->data(), reservation, tickets);
+        tickets_write(encoded->data() + bytes, first_ticket, tickets);
+
+        payload_ptr payload = std::move(encoded);
+        replayed.insert(reservation, cookie, kept_until, payload);
+        this->send_response(buffer_write(buffer, TICKETS), std::move(payload));
+    }
+
+    template<typename T, std::enable_if_t<std::is_same_v<T, uint32_t>, bool> = true>
+    void send_bad_request(T data) {
+        if (data < Database::MIN_RESERVATION_ID) { /* If T is event_id */
+            debug("Illegal amount of tickets for event", data);
+        } else { /* If T is reservation_id */
+            debug("Invalid cookie or reservation", data, "does not exist");
+        }
+
+        size_t bytes = buffer_write(buffer, BAD_REQUEST, data);
+        this->send_response(bytes);
+    }
+
+    /** Checks and handler of every request type, indexed by its first octet */
+    static constexpr std::array<Dispatch, std::numeric_limits<uint8_t>::max() + 1> DISPATCH = [] {
+        std::array<Dispatch, std::numeric_limits<uint8_t>::max() + 1> table{};
+
+        for (Dispatch& unknown : table) {
+            unknown.metric = REQUEST_NAMES.size() - 1;
+        }
+
+        table[GET_EVENTS] = {&RequestHandler::handle_get_events_request, GET_EVENTS_LEN, true, 0,
+                             "GET_EVENTS request has invalid length"};
+        table[GET_RESERVATION] = {&RequestHandler::handle_get_reservation_request, GET_RESERVATION_LEN, true, 1,
+                                  "GET_RESERVATION request has invalid length"};
+        table[GET_TICKETS] = {&RequestHandler::handle_get_tickets_request, GET_TICKETS_LEN, true, 2,
+                              "GET_TICKETS request has invalid length"};
+        table[GET_EVENTS_PAGE] = {&RequestHandler::handle_get_events_page_request, GET_EVENTS_PAGE_LEN, true, 3,
+                                  "GET_EVENTS_PAGE request has invalid length"};
+        table[GET_RESERVATIONS] = {&RequestHandler::handle_get_reservations_request, GET_RESERVATIONS_HEADER_LEN,
+                                   false, 4, "GET_RESERVATIONS request is too short"};
+
+        return table;
+    }();
+};
+
+#endif //CINEMA_SERVER_REQUEST_HANDLER_H
@@ -0,0 +1,50 @@
+#ifndef CINEMA_SERVER_SEQLOCK_H
+#define CINEMA_SERVER_SEQLOCK_H
+
+#include <atomic>
+#include <thread>
+#include <cstdint>
+
+/**
+ * Sequence lock of data written by one thread at a time and read by any.
+ * A writer never waits for readers, it only makes the sequence odd while
+ * writing; a reader copies the data and copies it again if a write overlapped.
+ * The data must be atomics accessed in relaxed order, so an overlapped copy
+ * is discarded rather than a race.
+ */
+class SeqLock {
+public:
+    /** Runs @p write as a single change, writers must be serialized by the caller */
+    template<typename Write>
+    void write(Write&& write) {
+        uint64_t begin = sequence.load(std::memory_order_relaxed);
+
+        sequence.store(begin + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        write();
+        sequence.store(begin + 2, std::memory_order_release);
+    }
+
+    /** Runs @p read until no write overlapped it, @return its last result */
+    template<typename Read>
+    auto read(Read&& read) const {
+        while (true) {
+            uint64_t begin = sequence.load(std::memory_order_acquire);
+
+            if (begin % 2 == 0) {
+                auto result = read();
+                std::atomic_thread_fence(std::memory_order_acquire);
+
+                if (sequence.load(std::memory_order_relaxed) == begin)
+                    return result;
+            }
+
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    std::atomic<uint64_t> sequence = 0; /** Odd while a write is in progress */
+};
+
+#endif //CINEMA_SERVER_SEQLOCK_H
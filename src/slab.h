@@ -0,0 +1,187 @@
+#ifndef CINEMA_SERVER_SLAB_H
+#define CINEMA_SERVER_SLAB_H
+
+#include <limits>
+#include <algorithm>
+#include <vector>
+#include <cstdint>
+#include <optional>
+
+/**
+ * Dense table of objects addressed by their slot index. Released slots
+ * are recycled through a free list, so the table grows only when all
+ * slots are in use and a lookup is a single indexed load. Every slot
+ * counts its releases, so a handle made of a slot and its generation
+ * tells a recycled slot from the one it referred to. A slot may be pinned
+ * by references to its past generations kept elsewhere, the owner decides
+ * when a pinned slot is parked instead of being reused.
+ * @tparam T stored object
+ */
+template<typename T>
+class Slab {
+public:
+    using index_t = uint32_t;
+    using generation_t = uint32_t;
+
+    /** @param capacity maximal number of slots */
+    explicit Slab(index_t capacity = std::numeric_limits<index_t>::max()) : capacity(capacity) {}
+
+    /**
+     * Takes a free slot, reusing the most recently released one.
+     * @return slot index or std::nullopt if all slots are in use
+     */
+    std::optional<index_t> acquire() {
+        if (!free.empty()) {
+            index_t index = free.back();
+            free.pop_back();
+            slots[index].live = true;
+            return index;
+        }
+
+        if (slots.size() >= capacity)
+            return std::nullopt;
+
+        slots.push_back({T{}, 0, 0, true, false});
+
+        return static_cast<index_t>(slots.size() - 1);
+    }
+
+    /**
+     * Takes a given slot when restoring a saved table. The free list is
+     * stale until rebuild_free_list(), acquire() must not be called meanwhile.
+     * @param index slot index
+     * @param generation generation of the slot when it was saved
+     */
+    void restore(index_t index, generation_t generation) {
+        this->restore_slot(index);
+        slots[index].generation = generation;
+        slots[index].live = true;
+    }
+
+    /**
+     * Makes a slot not in use start at least at a given generation when restoring,
+     * see restore(); a slot in use keeps its generation.
+     */
+    void restore_generation(index_t index, generation_t generation) {
+        this->restore_slot(index);
+
+        if (!slots[index].live) {
+            slots[index].generation = std::max(slots[index].generation, generation);
+        }
+    }
+
+    /** Puts all slots not in use on the free list, the lowest one is reused first */
+    void rebuild_free_list() {
+        free.clear();
+        parked = 0;
+
+        for (size_t index = slots.size(); index-- > 0;) {
+            slots[index].parked = false;
+
+            if (!slots[index].live) {
+                free.push_back(static_cast<index_t>(index));
+            }
+        }
+    }
+
+    /** Invokes @p visit with the index of every slot in use */
+    template<typename Visitor>
+    void for_each(Visitor&& visit) const {
+        for (size_t index = 0; index < slots.size(); index++) {
+            if (slots[index].live) {
+                visit(static_cast<index_t>(index));
+            }
+        }
+    }
+
+    /** Returns a slot to the free list, its pins stay */
+    void release(index_t index) {
+        slots[index].value = T{};
+        slots[index].generation++;
+        slots[index].live = false;
+        free.push_back(index);
+    }
+
+    /** Takes a slot just acquired out of the table unused, it keeps its generation until unpark() */
+    void park(index_t index) {
+        slots[index].live = false;
+        slots[index].parked = true;
+        parked++;
+    }
+
+    /** Returns a parked slot to the free list, does nothing for other slots */
+    void unpark(index_t index) {
+        if (slots[index].parked) {
+            slots[index].parked = false;
+            parked--;
+            free.push_back(index);
+        }
+    }
+
+    /** Adds a reference to a past generation of a slot */
+    void pin(index_t index) {
+        this->restore_slot(index);
+        slots[index].pins++;
+    }
+
+    /** Drops a reference added by pin() */
+    void unpin(index_t index) {
+        slots[index].pins--;
+    }
+
+    /** Whether references to past generations of a slot are kept */
+    bool pinned(index_t index) const {
+        return slots[index].pins > 0;
+    }
+
+    /** Number of times the slot was released or renewed, wrapping around */
+    generation_t generation(index_t index) const {
+        return slots[index].generation;
+    }
+
+    /** Whether the slot is in use */
+    bool contains(index_t index) const {
+        return index < slots.size() && slots[index].live;
+    }
+
+    T& operator[](index_t index) {
+        return slots[index].value;
+    }
+
+    const T& operator[](index_t index) const {
+        return slots[index].value;
+    }
+
+    /** Number of slots in use */
+    size_t size() const {
+        return slots.size() - free.size() - parked;
+    }
+
+    /** Number of slots acquire() can still give */
+    size_t available() const {
+        return capacity - slots.size() + free.size();
+    }
+
+private:
+    struct Slot {
+        T value;
+        generation_t generation;
+        uint32_t pins; /** References to past generations, see pin() */
+        bool live;
+        bool parked; /** Neither in use nor free, see park() */
+    };
+
+    index_t capacity;
+    std::vector<Slot> slots;
+    std::vector<index_t> free; /** Released slots, most recent last */
+    size_t parked = 0; /** Slots neither in use nor free */
+
+    /** Grows the table to a slot when restoring, slots in between are not in use */
+    void restore_slot(index_t index) {
+        if (index >= slots.size()) {
+            slots.resize(static_cast<size_t>(index) + 1, {T{}, 0, 0, false, false});
+        }
+    }
+};
+
+#endif //CINEMA_SERVER_SLAB_H
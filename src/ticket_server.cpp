@@ -1,475 +1,777 @@
+#include <cerrno>
 #include <chrono>
-#include <random>
-#include <fstream>
-#include <unordered_set>
-
+#include <memory>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <climits>
+#include <cstring>
+#include <charconv>
+#include <optional>
+
+#include <fcntl.h>
+#include <sched.h>
+#include <csignal>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 
+#include "clock.h"
 #include "flags.h"
 #include "ensure.h"
-#include "buffer.h"
-
-namespace {
-    template<typename Number, std::enable_if_t<std::is_arithmetic_v<Number>, bool> = true>
-    constexpr bool is_between(Number value, Number min, Number max) noexcept {
-        return value >= min && value <= max;
-    }
-}
-
+#include "address.h"
+#include "catalog.h"
+#include "metrics.h"
+#include "database.h"
+#include "admission.h"
+#include "event_loop.h"
+#include "replication.h"
+#include "allocations.h"
+#include "admin_server.h"
+#include "request_handler.h"
+
+/** Socket layer of a worker, requests are handled by RequestHandler */
 class TicketServer {
 public:
-    enum ClientRequest : uint8_t {
-        GET_EVENTS      = 1, /** Request to list available events */
-        GET_RESERVATION = 3, /** Request to reserve tickets to an event */
-        GET_TICKETS     = 5  /** Request to buy reserved tickets */
+    static constexpr uint16_t MIN_PORT     = 0;
+    static constexpr uint16_t DEFAULT_PORT = 2022;
+    static constexpr uint16_t MAX_PORT     = 65535;
+
+    static constexpr uint16_t MIN_BATCH     = 1;
+    static constexpr uint16_t DEFAULT_BATCH = 32;
+    static constexpr uint16_t MAX_BATCH     = 1024;
+
+    static constexpr uint16_t MIN_WORKERS     = 1;
+    static constexpr uint16_t DEFAULT_WORKERS = 1;
+    static constexpr uint16_t MAX_WORKERS     = 256;
+
+    /** Addresses a worker listens on, each with a socket of its own */
+    static constexpr size_t MAX_LISTENERS = 16;
+
+    /** Admission control of a worker, a rate of 0 disables its limit */
+    struct Limits {
+        uint32_t client_rate = 0; /** Requests per second of a single client address and port */
+        uint32_t event_rate = 0; /** Reservations per second of a single event admitted by this worker */
     };
 
-    enum ServerResponse : uint8_t {
-        EVENTS      = 2,  /** Response to list available requests */
-        RESERVATION = 4,  /** Response to confirm ticket reservation */
-        TICKETS     = 6,  /** Response to send bought tickets */
-        BAD_REQUEST = 255 /** Response to an invalid request */
+    /** Sizes of socket buffers in octets, 0 keeps the kernel default */
+    struct SocketBuffers {
+        int send = 0;
+        int receive = 0;
     };
 
-    static constexpr uint32_t MIN_TIMEOUT     = 1;
-    static constexpr uint32_t DEFAULT_TIMEOUT = 5;
-    static constexpr uint32_t MAX_TIMEOUT     = 86400;
+    /** Responses a worker keeps while its socket is full, further ones are dropped */
+    static constexpr size_t BACKLOG_LEN = 4096;
+
+    /** Clients tracked by the limiter of a worker, the least recently limited ones are forgotten first */
+    static constexpr size_t CLIENT_SLOTS = 1 << 16;
+
+    /** Reservations a worker keeps waiting for their events */
+    static constexpr size_t ADMISSION_QUEUE_LEN = 4096;
+
+    /**
+     * Creates a worker serving requests on its own sockets, one per listening address.
+     * @param database tables shared by all workers
+     * @param shard index of the shard whose reservations this worker expires
+     * @param addresses listening addresses with their port, see listen_address()
+     * @param batch maximal number of datagrams handled per system call
+     * @param reuse_port whether other workers bind the same addresses
+     * @param cpu core the worker runs on and its sockets prefer, if pinned
+     * @param backend event loop receiving requests, see make_event_loop()
+     * @param buffers sizes of socket buffers
+     * @param limits admission control
+     * @param replay_budget octets of TICKETS responses cached for retries, see ReplayCache
+     * @param metrics statistics of all workers
+     */
+    TicketServer(Database& database, size_t shard, const std::vector<sockaddr_storage>& addresses, uint16_t batch,
+                 bool reuse_port, std::optional<uint16_t> cpu, const std::string& backend, const SocketBuffers& buffers, const Limits& limits,
+                 size_t replay_budget, RequestHandler::metrics_t& metrics)
+            : database(database), shard(shard), metrics(metrics.worker(shard)),
+              handler(database, shard, this->metrics, replay_budget), cpu(cpu) {
+        /* The any-address takes IPv4 too, unless an IPv4 address has a socket of its own */
+        bool dual_stack = std::none_of(addresses.begin(), addresses.end(), [](const sockaddr_storage& address) {
+            return address.ss_family == AF_INET;
+        });
 
-    static constexpr uint16_t MIN_PORT     = 0;
-    static constexpr uint16_t DEFAULT_PORT = 2022;
-    static constexpr uint16_t MAX_PORT     = 65535;
+        for (const sockaddr_storage& address : addresses) {
+            int socket_fd = this->bind_socket(address, reuse_port, dual_stack);
+            this->set_buffer(socket_fd, SO_SNDBUFFORCE, SO_SNDBUF, buffers.send, "Send buffer");
+            this->set_buffer(socket_fd, SO_RCVBUFFORCE, SO_RCVBUF, buffers.receive, "Receive buffer");
+            this->set_incoming_cpu(socket_fd);
+            debug("Starting listening on", address_string(address), "with event loop", backend);
+        }
 
-    TicketServer(const std::string& file, uint16_t port, uint32_t timeout) {
-        this->bind_socket(port);
-        this->set_timeout(timeout);
-        this->initialize_database(file);
-        debug("Starting listening on port", port);
+        this->set_batch(batch);
+        this->set_limits(limits, batch);
+        loop = make_event_loop(backend, sockets, batch);
     }
 
     ~TicketServer() {
-        ensure(close(socket_fd) != -1, "Failed to close socket", socket_fd);
+        for (int socket_fd : sockets) {
+            ensure(close(socket_fd) != -1, "Failed to close socket", socket_fd);
+        }
     }
 
     [[noreturn]] void start() {
+        this->pin_thread();
+        allocations::count(&metrics.allocations);
+
         while (true) {
-            sockaddr_in client{};
-            size_t read_length = this->get_request(&client);
+            auto writable = blocked && wait_writable ? std::optional(blocked_listener) : std::nullopt;
+            const std::vector<Datagram>& requests = loop->receive(this->poll_timeout(), writable);
+            Clock::tick();
+            this->expire_reservations();
+            this->flush_backlog();
 
-            if (read_length == 0) {
-                debug("Received an empty request");
-                continue;
-            }
+            uint64_t now = Clock::millis() * NANOS_PER_MILLI;
+            this->serve_deferred(now);
+
+            for (const Datagram& request : requests) {
+                debug("Received a message from", [&] {return TicketServer::get_client_address(request.client);});
+
+                if (!this->admit(request, now))
+                    continue;
 
-            try {
-                this->remove_expired_reservations();
-                this->handle_request(&client, read_length);
-            } catch (const std::invalid_argument& e) {
-                debug(e.what(), std::string(buffer, read_length));
+                auto response = handler.handle(request.data, request.length);
+
+                if (response.length > 0) {
+                    this->send_response(request.client, request.listener, request.data, response);
+                }
             }
+
+            this->send_responses();
+            loop->release();
         }
     }
 
-    static sockaddr_in get_address(uint16_t port) {
-        sockaddr_in address{};
+private:
+    using addr_ptr = sockaddr_storage*;
+    using payload_ptr = RequestHandler::payload_ptr;
+
+    static_assert(EventLoop::MAX_DATAGRAM == RequestHandler::MAX_DATAGRAM, "Responses overwrite requests");
+    static_assert(RequestHandler::MAX_REQUEST_LEN <= EventLoop::MAX_REQUEST, "Well-formed requests are received");
+
+
+    Database& database; /** Tables shared with other workers */
+    size_t shard; /** Shard expired by this worker */
+    bool expiration_pending = false; /** Whether the last expiration left some reservations */
+    WorkerMetrics<RequestHandler::REQUEST_NAMES.size()>& metrics; /** Statistics written only by this worker */
+    RequestHandler handler;
+
+    std::optional<uint16_t> cpu; /** Core of the worker, if pinned */
+    std::vector<int> sockets; /** UDP socket of every listening address, indexed as Datagram::listener */
+    std::unique_ptr<EventLoop> loop; /** Receives requests into its own buffers */
+
+    std::vector<iovec> response_vectors; /** Two vectors per response: buffer and payload */
+    std::vector<mmsghdr> responses;
+    std::vector<uint32_t> response_listeners; /** Socket sending each response */
+    std::vector<payload_ptr> payloads; /** Shared payloads kept alive until responses are sent */
+    size_t pending_responses = 0; /** Number of responses waiting for the next flush */
+
+    /** Response which did not fit into the socket, with a copy of its buffer */
+    struct QueuedResponse {
+        sockaddr_storage client;
+        uint32_t listener;
+        std::string head;
+        payload_ptr payload;
+        size_t payload_offset;
+    };
 
-        address.sin_family = AF_INET;
-        address.sin_port = htons(port);
-        address.sin_addr.s_addr = htonl(INADDR_ANY);
+    std::deque<QueuedResponse> backlog; /** Responses waiting for their sockets, oldest first */
+    bool blocked = false; /** Whether a socket took not all responses of the last flush */
+    uint32_t blocked_listener = 0; /** Socket which stopped the last flush */
+    bool wait_writable = false; /** Whether the socket tells when it takes responses again */
 
-        return address;
-    }
+    std::optional<TokenBuckets<uint64_t>> clients; /** Requests of every client, if limited */
+    std::optional<AdmissionQueue> admission; /** Reservations of every event, if limited */
+    std::vector<char> deferred_slots; /** Buffers of admitted deferred requests, MAX_DATAGRAM octets each */
+    std::vector<sockaddr_storage> deferred_clients; /** Senders of admitted deferred requests */
+
+    void set_batch(uint16_t batch) {
+        ensure(is_between(batch, MIN_BATCH, MAX_BATCH), "Batch size must be from", MIN_BATCH, "to", MAX_BATCH);
 
-    static uint64_t current_time() {
-        using namespace std::chrono;
-        return duration_cast<seconds>(system_clock::now().time_since_epoch()).count();
+        response_vectors.resize(2 * batch);
+        responses.resize(batch);
+        response_listeners.resize(batch);
+        payloads.resize(batch);
     }
 
-    static std::string response_name(ServerResponse response) {
-        switch(response) {
-            case EVENTS:
-                return "EVENTS";
-            case RESERVATION:
-                return "RESERVATION";
-            case TICKETS:
-                return "TICKETS";
-            default:
-                return "BAD_REQUEST";
+    void set_limits(const Limits& limits, uint16_t batch) {
+        if (limits.client_rate > 0) {
+            clients.emplace(limits.client_rate, limits.client_rate, CLIENT_SLOTS);
+        }
+
+        if (limits.event_rate > 0) {
+            admission.emplace(limits.event_rate, ADMISSION_QUEUE_LEN);
+            deferred_slots.resize(batch * RequestHandler::MAX_DATAGRAM);
+            deferred_clients.resize(batch);
         }
     }
 
-private:
-    using desclen_t      = uint8_t;
-    using tickets_t      = uint16_t;
-    using event_id       = uint32_t;
-    using reservation_id = uint32_t;
-    using seconds_t      = uint64_t;
-    using cookie_t       = std::string;
+    /**
+     * Creates a UDP socket bound to an address.
+     * @param dual_stack whether an IPv6 socket takes IPv4-mapped datagrams too
+     * @return the socket, also added to sockets
+     */
+    int bind_socket(const sockaddr_storage& address, bool reuse_port, bool dual_stack) {
+        int socket_fd = socket(address.ss_family, SOCK_DGRAM, 0);
+        ensure(socket_fd > 0, "Failed to create a socket for", address_string(address));
+        sockets.push_back(socket_fd);
+
+        if (reuse_port) { /* Let the kernel spread datagrams over sockets of all workers */
+            int enable = 1;
+            ensure(setsockopt(socket_fd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) != -1,
+                   "Failed to enable port sharing on socket", socket_fd);
+        }
 
-    using addr_ptr         = sockaddr_in*;
-    using event_data       = std::pair<event_id, tickets_t>;
-    using crypto_data      = std::pair<cookie_t, seconds_t>;
-    using reservation_data = std::pair<crypto_data, event_data>;
+        if (address.ss_family == AF_INET6) {
+            int only_ipv6 = dual_stack ? 0 : 1;
+            ensure(setsockopt(socket_fd, IPPROTO_IPV6, IPV6_V6ONLY, &only_ipv6, sizeof(only_ipv6)) != -1,
+                   "Failed to set the IPv6 mode of socket", socket_fd);
+        }
 
-    /** Message length of GET_EVENTS request */
-    static constexpr size_t GET_EVENTS_LEN = 1;
+        ensure(bind(socket_fd, reinterpret_cast<const sockaddr*>(&address), address_length(address)) != -1,
+               "Failed to listen on", address_string(address), "-", strerror(errno));
 
-    /** Message length of GET_RESERVATION request */
-    static constexpr size_t GET_RESERVATION_LEN = 7;
+        /* Responses which do not fit into the socket wait in the backlog instead */
+        ensure(fcntl(socket_fd, F_SETFL, fcntl(socket_fd, F_GETFL) | O_NONBLOCK) != -1,
+               "Failed to make socket", socket_fd, "non-blocking");
 
-    /** Maximum buffer size to store a single event information */
-    static constexpr size_t MAX_EVENT_DATA = 262;
+        return socket_fd;
+    }
 
-    /** Message length of GET_TICKETS request */
-    static constexpr size_t GET_TICKETS_LEN     = 53;
+    /** Prefers the socket for datagrams the kernel receives on the core of the worker, see pin_thread() */
+    void set_incoming_cpu(int socket_fd) const {
+        if (!cpu.has_value())
+            return;
 
-    /** Server buffer size */
-    static constexpr size_t MAX_DATAGRAM = 65507;
+        int incoming_cpu = cpu.value();
+        if (setsockopt(socket_fd, SOL_SOCKET, SO_INCOMING_CPU, &incoming_cpu, sizeof(incoming_cpu)) == -1) {
+            alert("Failed to prefer core", incoming_cpu, "for socket", socket_fd, strerror(errno));
+        }
+    }
 
-    /** Minimal possible ID of a reservation */
-    static constexpr reservation_id MIN_RESERVATION_ID = 1000000;
+    /**
+     * Runs the calling thread only on the core of the worker. With receive queues of the device
+     * steered to the same cores, a datagram is received, handled and answered on one core.
+     */
+    void pin_thread() const {
+        if (!cpu.has_value())
+            return;
 
-    /** Length of a cookie to confirm a reservation */
-    static constexpr size_t COOKIE_LEN = 48;
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu.value(), &cpus);
 
-    /** Character range for cookie */
-    static constexpr char MIN_COOKIE_CHAR = 33;
-    static constexpr char MAX_COOKIE_CHAR = 126;
+        if (sched_setaffinity(0, sizeof(cpus), &cpus) == -1) {
+            alert("Failed to pin worker", shard, "to core", cpu.value(), strerror(errno));
+        }
+    }
 
-    /** Maximal number of tickets to reserve in a single request */
-    static constexpr tickets_t MAX_TICKETS = 9357;
+    /**
+     * Sets the size of a socket buffer, past the system limit if privileged.
+     * @param socket_fd socket
+     * @param forced option ignoring net.core.wmem_max or rmem_max
+     * @param option option capped by them
+     * @param size octets, 0 keeps the default
+     * @param name name of the buffer in messages
+     */
+    void set_buffer(int socket_fd, int forced, int option, int size, const char* name) const {
+        if (size == 0)
+            return;
+
+        if (setsockopt(socket_fd, SOL_SOCKET, forced, &size, sizeof(size)) == -1) {
+            ensure(setsockopt(socket_fd, SOL_SOCKET, option, &size, sizeof(size)) != -1,
+                   "Failed to set", name, "of socket", socket_fd);
+        }
 
-    /** Character ranges for ticket codes */
-    static constexpr char MIN_TICKET_DIGIT = '0';
-    static constexpr char MAX_TICKET_DIGIT = '9';
-    static constexpr char MIN_TICKET_ALPHA = 'A';
-    static constexpr char MAX_TICKET_ALPHA = 'Z';
+        /* The kernel doubles the size to account for its bookkeeping */
+        int actual = 0;
+        auto length = static_cast<socklen_t>(sizeof(actual));
+        getsockopt(socket_fd, SOL_SOCKET, option, &actual, &length);
 
-    int socket_fd = -1; /** Socket for IPv4 UDP connection */
-    char buffer[MAX_DATAGRAM]; /** Communication buffer */
-    seconds_t timeout; /** Time measured in seconds for a reservation to be valid */
+        if (actual / 2 < size) {
+            info(name, "of socket", socket_fd, "is capped at", actual / 2, "octets by the system limit");
+        }
+    }
+
+    /** Gives milliseconds until the next second starts, 0 if expiration is behind or 1 if reservations wait */
+    int poll_timeout() const {
+        if (expiration_pending)
+            return 0;
 
-    /** Mapping of event id's to their names and number of available tickets */
-    std::unordered_map<event_id, std::pair<std::string, tickets_t>> events;
+        if ((admission.has_value() && !admission->empty()) || (blocked && !wait_writable))
+            return 1;
 
-    /** Mapping of reservation id's to <(cookie, expiration time), (event id, tickets)> */
-    std::map<reservation_id, reservation_data> reserved;
+        /* The clock was read just before the previous batch, which is close enough for one-second expiry */
+        return static_cast<int>(MILLIS_PER_SECOND - Clock::millis() % MILLIS_PER_SECOND);
+    }
 
-    /** Reservations expiring at the given time */
-    std::map<seconds_t, std::unordered_set<reservation_id>> expiration;
-    std::unordered_set<cookie_t> cookies; /** Cookies confirming reservations */
+    /**
+     * Sheds a request of a client over its rate before it is parsed. A reservation for an event
+     * over its rate is queued, a GET_RESERVATIONS is shed unless all its events have a token.
+     * @return whether to handle the request now
+     */
+    bool admit(const Datagram& request, uint64_t now) {
+        auto client_address = [&] {return TicketServer::get_client_address(request.client);};
+
+        if (clients.has_value() && !clients->take(address_key(*request.client), now)) {
+            debug("Shedding a request of", client_address, "over its rate");
+            metrics.shed_requests.add();
+            return false;
+        }
 
-    std::string next_ticket = "0000000"; /** Ticket code for the next purchase */
-    std::unordered_map<reservation_id, std::vector<std::string>> purchased; /** Purchase history */
+        if (!admission.has_value())
+            return true;
 
-    void set_timeout(uint32_t _timeout) {
-        ensure(is_between(_timeout, MIN_TIMEOUT, MAX_TIMEOUT), "Invalid timeout value");
-        this->timeout = _timeout;
-    };
+        bool admitted = true;
+        Database::ReservationRequest reservation{};
+        size_t events = RequestHandler::reserved_events(request.data, request.length, [&](const auto& requested) {
+            admitted = admitted && admission->has_token(requested.event, now);
+            reservation = requested;
+        });
 
-    void initialize_database(const std::string& file_db) {
-        std::ifstream file(file_db);
-        std::string name, tickets_count;
-        ensure(file.is_open(), "File", file_db, "does not exist");
+        if (events == 0)
+            return true;
 
-        for (event_id event = 0; getline(file, name); event++) {
-            if (getline(file, tickets_count)) {
-                events[event].first = name;
-                std::stringstream(tickets_count) >> events[event].second;
-            }
+        if (admitted) {
+            RequestHandler::reserved_events(request.data, request.length, [&](const auto& requested) {
+                admission->admit(requested.event, now);
+            });
+            return true;
         }
-    }
 
-    void bind_socket(uint16_t port) {
-        ensure(is_between(port, MIN_PORT, MAX_PORT), "Port must be from", MIN_PORT, "to", MAX_PORT);
-        this->socket_fd = socket(AF_INET, SOCK_DGRAM, 0); /* IPv4 UDP socket */
-        ensure(this->setup_address(get_address(port)) != -1, "Port", port, "requires root privileges");
-    }
+        if (events == 1 && admission->defer(*request.client, request.listener, reservation, now)) {
+            debug("Queueing a reservation of", client_address, "for event", reservation.event);
+            metrics.deferred_requests.add();
+        } else {
+            debug("Shedding a reservation of", client_address, "over the rate of its events");
+            metrics.shed_requests.add();
+        }
 
-    int setup_address(const sockaddr_in& address) const {
-        ensure(this->socket_fd > 0, "Failed to create a socket");
-        auto address_len = static_cast<socklen_t>(sizeof(address));
-        return bind(this->socket_fd, (sockaddr*) &address, address_len);
+        return false;
     }
 
+    /** Handles queued reservations whose events admit them again, before any new request takes their tokens */
+    void serve_deferred(uint64_t now) {
+        if (!admission.has_value() || admission->empty())
+            return;
 
-    size_t get_request(addr_ptr client) {
-        auto address_len = static_cast<socklen_t>(sizeof(*client));
-        ssize_t message_len = recvfrom(socket_fd, buffer, MAX_DATAGRAM, 0,
-                                       (sockaddr *) client, &address_len);
+        size_t served = 0;
+        size_t dropped = admission->drain(now, deferred_clients.size(), [&](const AdmissionQueue::Deferred& deferred) {
+            char* slot = deferred_slots.data() + served * RequestHandler::MAX_DATAGRAM;
+            size_t length = buffer_write(slot, RequestHandler::GET_RESERVATION, deferred.request.event,
+                                         deferred.request.tickets);
 
-        std::string client_address = TicketServer::get_client_address(client);
-        ensure(message_len >= 0, "Failed to receive a message from", client_address);
-        debug("Received a message from", client_address);
+            /* The queue reuses its entry, the response keeps a copy of the client */
+            deferred_clients[served] = deferred.client;
+            auto response = handler.handle(slot, length);
 
-        return static_cast<size_t>(message_len);
-    }
+            if (response.length > 0) {
+                this->send_response(&deferred_clients[served], deferred.listener, slot, response);
+            }
 
-    void send_response(addr_ptr client, size_t length) {
-        auto address_len = static_cast<socklen_t>(sizeof(*client));
-        ssize_t sent_len = sendto(socket_fd, buffer, length, 0,
-                                  (sockaddr*) client, address_len);
+            served++;
+        });
 
-        std::string client_address = TicketServer::get_client_address(client);
-        bool all_bytes_sent = sent_len == static_cast<ssize_t>(length);
+        metrics.shed_requests.add(dropped);
+        this->send_responses();
+    }
 
-        ensure(all_bytes_sent, "Failed to send a message to", client_address);
-        debug("Sent", response_name(static_cast<ServerResponse>(buffer[0])), "to", client_address);
+    void expire_reservations() {
+        size_t expired = database.expire_reservations(shard);
+        expiration_pending = expired == Database::EXPIRATION_BATCH;
+        metrics.expired_reservations.add(expired);
     }
 
-    static std::string get_client_address(addr_ptr client) {
-        char* client_ip = inet_ntoa(client->sin_addr);
-        uint16_t client_port = ntohs(client->sin_port);
-        return std::string(client_ip) + ":" + std::to_string(client_port);
+    /**
+     * Queues a response until the end of the batch.
+     * @param client receiver
+     * @param listener index of the socket sending the response
+     * @param buffer buffer of the request, overwritten with the response
+     * @param response response and its payload
+     */
+    void send_response(addr_ptr client, uint32_t listener, char* buffer, RequestHandler::Response& response) {
+        mmsghdr& message = responses[pending_responses];
+        iovec* vectors = &response_vectors[2 * pending_responses];
+        const payload_ptr& payload = response.payload;
+
+        vectors[0] = {buffer, response.length};
+        if (payload != nullptr) {
+            vectors[1] = {const_cast<char*>(payload->data()) + response.payload_offset,
+                          payload->size() - response.payload_offset};
+        }
+
+        message.msg_hdr = {};
+        message.msg_hdr.msg_name = client;
+        message.msg_hdr.msg_namelen = address_length(*client);
+        message.msg_hdr.msg_iov = vectors;
+        message.msg_hdr.msg_iovlen = payload == nullptr ? 1 : 2;
+
+        payloads[pending_responses] = std::move(response.payload);
+        response_listeners[pending_responses] = listener;
+        pending_responses++;
     }
 
-    void remove_expired_reservations() {
-        const seconds_t time = TicketServer::current_time();
-        std::vector<decltype(expiration)::iterator> expired;
+    /** Sends queued responses, those the socket cannot take now wait in the backlog */
+    void send_responses() {
+        size_t sent = backlog.empty() ? this->send_messages(pending_responses) : 0;
 
-        /* Iterate over expired reservations */
-        for (auto it = expiration.begin(); it->first < time && it != expiration.end(); it++) {
-            expired.emplace_back(it);
-            for (auto reservation : it->second) {
-                this->remove_reservation(reservation);
-            }
+        for (size_t i = sent; i < pending_responses; i++) {
+            this->queue_response(i);
         }
 
-        for (auto& expired_it : expired) {
-            expiration.erase(expired_it);
-        }
+        std::fill_n(payloads.begin(), pending_responses, nullptr);
+        pending_responses = 0;
     }
 
-    void remove_reservation(reservation_id reservation) {
-        auto reservation_it = reserved.find(reservation);
-        auto [crypto_info, event_info] = reservation_it->second;
-        auto [cookie, expiration_time] = crypto_info;
-        auto [event, tickets] = event_info;
+    /** Keeps a copy of a response which did not fit into the socket, or drops it if the backlog is full */
+    void queue_response(size_t index) {
+        const msghdr& header = responses[index].msg_hdr;
+
+        if (backlog.size() == BACKLOG_LEN) {
+            metrics.dropped_responses.add();
+            debug("Dropping a response to", [&] {return get_client_address(static_cast<addr_ptr>(header.msg_name));},
+                  "on a full backlog");
+            return;
+        }
 
-        cookies.erase(cookie);
-        reserved.erase(reservation_it);
-        events[event].second += tickets;
+        const payload_ptr& payload = payloads[index];
+        size_t payload_offset = payload == nullptr ? 0
+                : static_cast<const char*>(header.msg_iov[1].iov_base) - payload->data();
 
-        debug("Reservation", reservation, "has expired");
+        backlog.push_back({*static_cast<addr_ptr>(header.msg_name), response_listeners[index],
+                           std::string(static_cast<const char*>(header.msg_iov[0].iov_base), header.msg_iov[0].iov_len),
+                           payload, payload_offset});
+        metrics.queued_responses.add();
     }
 
-    void handle_request(addr_ptr client, size_t request_len) {
-        try {
-            switch (buffer[0]) {
-                case GET_EVENTS:
-                    handle_get_events_request(client, request_len);
-                    break;
-                case GET_RESERVATION:
-                    handle_get_reservation_request(client, request_len);
-                    break;
-                case GET_TICKETS:
-                    handle_get_tickets_request(client, request_len);
-                    break;
-                default:
-                    throw std::invalid_argument("Unknown request type");
+    /** Sends responses of the backlog, oldest first, until the socket is full again */
+    void flush_backlog() {
+        while (!backlog.empty()) {
+            size_t count = std::min(backlog.size(), responses.size());
+
+            for (size_t i = 0; i < count; i++) {
+                QueuedResponse& queued = backlog[i];
+                RequestHandler::Response response{queued.head.size(), queued.payload, queued.payload_offset};
+                this->send_response(&queued.client, queued.listener, queued.head.data(), response);
             }
-        } catch (const std::invalid_argument& e) {
-            throw e;
-        }
-    }
 
-    void handle_get_events_request(addr_ptr client, size_t request_len) {
-        if (request_len != GET_EVENTS_LEN) {
-            throw std::invalid_argument("GET_EVENTS request is too long");
+            size_t sent = this->send_messages(count);
+            std::fill_n(payloads.begin(), pending_responses, nullptr);
+            pending_responses = 0;
+            backlog.erase(backlog.begin(), backlog.begin() + static_cast<std::ptrdiff_t>(sent));
+
+            if (sent < count)
+                return;
         }
 
-        this->send_events(client);
+        blocked = false;
     }
 
-    void send_events(addr_ptr client) {
-        size_t packed_bytes = buffer_write(buffer, EVENTS);
+    /**
+     * Sends leading pending messages on their non-blocking sockets, a single sendmmsg
+     * per run of messages of one socket.
+     * @return number of leading messages sent or dropped, the rest did not fit into a socket
+     */
+    size_t send_messages(size_t count) {
+        size_t done = 0;
+
+        while (done < count) {
+            uint32_t listener = response_listeners[done];
+            size_t run = done + 1;
+            while (run < count && response_listeners[run] == listener) {
+                run++;
+            }
+
+            int sent = sendmmsg(sockets[listener], responses.data() + done, run - done, 0);
 
-        /* Naively pack as many events as we can */
-        for (auto& [event_id, event_info] : events) {
-            char portion[MAX_EVENT_DATA];
-            auto [description, tickets] = event_info;
-            size_t portion_bytes = buffer_write(portion, htonl(event_id), htons(tickets),
-                                                static_cast<desclen_t>(description.size()),
-                                                static_cast<std::string>(description));
+            if (sent < 0 && errno == EINTR)
+                continue;
 
-            if (portion_bytes + packed_bytes > MAX_DATAGRAM)
+            /* The socket buffer is full or, with ENOBUFS, the device queue, which POLLOUT does not tell */
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS)) {
+                blocked = true;
+                blocked_listener = listener;
+                wait_writable = errno != ENOBUFS;
                 break;
+            }
+
+            /* Any other error concerns only the first message, which can never be sent */
+            if (sent < 0) {
+                auto client = static_cast<addr_ptr>(responses[done].msg_hdr.msg_name);
+                alert("Failed to send a message to", get_client_address(client), strerror(errno));
+                metrics.dropped_responses.add();
+                done++;
+                continue;
+            }
+
+            for (size_t i = done; i < done + sent; i++) {
+                this->sent_message(responses[i]);
+            }
 
-            packed_bytes += buffer_write(buffer + packed_bytes, std::string(portion, portion_bytes));
+            done += sent;
         }
 
-        this->send_response(client, packed_bytes);
+        return done;
     }
 
-    void handle_get_reservation_request(addr_ptr client, size_t request_len) {
-        if (request_len != GET_RESERVATION_LEN) {
-            throw std::invalid_argument("GET_EVENTS request is too long");
-        }
+    void sent_message(const mmsghdr& message) {
+        const msghdr& header = message.msg_hdr;
+        auto client = static_cast<addr_ptr>(header.msg_name);
+        auto client_address = [client] {return TicketServer::get_client_address(client);};
 
-        auto event = htonl(*buffer_read<event_id>(buffer, 1));
-        auto tickets = htons(*buffer_read<tickets_t>(buffer, 1 + sizeof(event)));
-        auto event_it = events.find(event);
+        size_t length = 0;
+        for (size_t vector = 0; vector < header.msg_iovlen; vector++) {
+            length += header.msg_iov[vector].iov_len;
+        }
 
-        /* Check if event exists and server can provide the given number of tickets */
-        if (event_it != events.end() && valid_ticket_count(tickets, event_it->second.second)) {
-            this->reserve_tickets(client, event, tickets);
-        } else {
-            this->send_bad_request<event_id>(client, event);
+        if (message.msg_len != length) {
+            alert("Sent only", message.msg_len, "of", length, "octets to", client_address());
+            metrics.dropped_responses.add();
+            return;
         }
-    }
 
-    static bool valid_ticket_count(tickets_t requested, tickets_t available) {
-        return is_between(requested, static_cast<uint16_t>(1), std::min(MAX_TICKETS, available));
+        auto response = static_cast<RequestHandler::ServerResponse>(*static_cast<char*>(header.msg_iov[0].iov_base));
+        metrics.responses.add();
+        metrics.bytes_sent.add(length);
+        debug("Sent", [response] {return RequestHandler::response_name(response);}, "to", client_address);
     }
 
-    void reserve_tickets(addr_ptr client, event_id event, tickets_t tickets) {
-        auto [reservation, cookie, expiration_time] = this->create_reservation(event, tickets);
-        size_t bytes = buffer_write(buffer, RESERVATION, htonl(reservation), htonl(event),
-                                    htons(tickets), cookie);
-
-        bytes += buffer_write(buffer + bytes, htobe64(expiration_time));
-        this->send_response(client, bytes);
+    static std::string get_client_address(addr_ptr client) {
+        return address_string(*client);
     }
 
-    std::tuple<reservation_id, cookie_t, seconds_t> create_reservation(event_id event, tickets_t tickets) {
-        seconds_t expiration_time = timeout + TicketServer::current_time();
-        reservation_id reservation = this->generate_reservation_id();
-        cookie_t cookie = this->generate_cookie();
+};
 
-        events[event].second -= tickets;
-        reserved[reservation] = {{cookie, expiration_time}, {event, tickets}};
-        expiration[expiration_time].insert(reservation);
-        cookies.insert(cookie);
+/**
+ * Loads the events file again and swaps the events in, see Database::reload().
+ * A file which cannot be read keeps the current events.
+ * @return outcome, for the log and the admin reply
+ */
+std::string reload_events(Database& database, const std::string& file) {
+    struct stat status{};
+
+    if (stat(file.c_str(), &status) == -1 || !S_ISREG(status.st_mode) || access(file.c_str(), R_OK) == -1)
+        return "Failed to reload events, " + file + " is not a readable file";
+
+    auto load_start = std::chrono::steady_clock::now();
+    Catalog catalog = load_catalog(file);
+    size_t events = catalog.size();
+    database.reload(std::move(catalog));
+    std::chrono::duration<double, std::milli> load_time = std::chrono::steady_clock::now() - load_start;
+
+    return "Reloaded " + std::to_string(events) + " events from " + file + " in "
+           + std::to_string(load_time.count()) + " ms";
+}
 
-        debug("Created reservation", reservation, "for", tickets, "tickets to event", event);
+/** Reloads the events on every SIGHUP, which all other threads block */
+[[noreturn]] void reload_on_hangup(Database& database, const std::string& file, sigset_t signals) {
+    while (true) {
+        int signal = 0;
 
-        return {reservation, cookie, expiration_time};
+        if (sigwait(&signals, &signal) == 0) {
+            info(reload_events(database, file));
+        }
     }
+}
 
-    reservation_id generate_reservation_id() const {
-        if (reserved.empty())
-            return MIN_RESERVATION_ID;
+/** Events listed by a single answer to the admin command events, its lines fit into a datagram */
+constexpr size_t ADMIN_EVENTS_PAGE = 2048;
 
-        auto largest_reserved = reserved.rbegin()->first;
-        if (largest_reserved <= std::numeric_limits<reservation_id>::max() - 1)
-            return largest_reserved + 1;
+/** Parses the decimal argument of an admin command, an empty one gives @p missing */
+std::optional<uint32_t> admin_argument(std::string_view argument, std::optional<uint32_t> missing) {
+    if (argument.empty())
+        return missing;
 
-        auto smallest_reserved = reserved.begin()->first;
-        if (smallest_reserved >= std::numeric_limits<reservation_id>::min() + 1)
-            return smallest_reserved - 1;
+    uint32_t value = 0;
+    auto [end, error] = std::from_chars(argument.data(), argument.data() + argument.size(), value);
 
-        /* Find the smallest id which is not a key in the map */
-        auto last_in = [](auto& lhs, auto& rhs) {return lhs.first + 1 != rhs.first;};
-        return 1 + std::adjacent_find(reserved.begin(), reserved.end(), last_in)->first;
-    }
+    if (error != std::errc() || end != argument.data() + argument.size())
+        return std::nullopt;
 
-    cookie_t generate_cookie() const {
-        cookie_t cookie(COOKIE_LEN, 0);
-        std::mt19937 rng{std::random_device{}()};
-        std::uniform_int_distribution<char> pick(MIN_COOKIE_CHAR, MAX_COOKIE_CHAR);
+    return value;
+}
 
-        do { /* Randomize and preserve uniqueness */
-            std::generate_n(cookie.begin(), COOKIE_LEN, [&] {return pick(rng);});
-        } while (cookies.find(cookie) != cookies.end());
+/**
+ * Answers the admin command "events [first]" with a line of the id, available tickets and held
+ * reservations of every event from first on, the last line "next <event>" tells where to go on.
+ * Counts are read without locking the shards, see Database::event_counts().
+ */
+std::string query_events(Database& database, std::string_view argument) {
+    auto first = admin_argument(argument, 0);
+
+    if (!first.has_value())
+        return "Invalid first event\n";
+
+    std::string response;
+    for (const auto& counts : database.event_counts(first.value(), ADMIN_EVENTS_PAGE)) {
+        response += std::to_string(counts.event) + ' ' + std::to_string(counts.available) + ' '
+                    + std::to_string(counts.held) + '\n';
+    }
 
-        return cookie;
+    if (size_t next = first.value() + ADMIN_EVENTS_PAGE; next < database.event_count()) {
+        response += "next " + std::to_string(next) + '\n';
     }
 
-    void handle_get_tickets_request(addr_ptr client, size_t request_len) {
-        if (request_len != GET_TICKETS_LEN) {
-            throw std::invalid_argument("GET_TICKETS request is too long");
-        }
+    return response;
+}
 
-        auto reservation = htonl(*buffer_read<reservation_id>(buffer, 1));
-        auto cookie = buffer_to_string(buffer, 1 + sizeof(reservation), COOKIE_LEN);
-        auto reservation_it = reserved.find(reservation);
+/** Answers the admin command "expiring <seconds>" with held reservations and tickets expiring within that time */
+std::string query_expiring(Database& database, std::string_view argument) {
+    auto seconds = admin_argument(argument, std::nullopt);
 
-        /* Check if reservation exists and cookie match */
-        if (reservation_it != reserved.end() && cookie == reservation_it->second.first.first) {
-            auto [event, tickets_count] = reservation_it->second.second;
-            this->send_tickets(client, reservation, tickets_count);
-        } else {
-            this->send_bad_request<reservation_id>(client, reservation);
-        }
-    }
+    if (!seconds.has_value())
+        return "Usage: expiring <seconds>\n";
 
-    void send_tickets(addr_ptr client, reservation_id reservation, tickets_t tickets) {
-        size_t bytes = buffer_write(buffer, TICKETS, htonl(reservation), htons(tickets));
+    auto [reservations, tickets] = database.expiring_within(seconds.value());
+    return "reservations " + std::to_string(reservations) + "\ntickets " + std::to_string(tickets) + '\n';
+}
 
-        /* If client haven't sent a successful GET_TICKETS request */
-        if (purchased.find(reservation) == purchased.end()) {
-            this->assign_tickets(reservation, tickets);
-            this->disable_expiration(reservation);
-        }
+int main(int argc, char** argv) {
+    /* Blocked before any thread starts, so that threads inherit the mask and only the reloader takes it */
+    sigset_t hangup;
+    sigemptyset(&hangup);
+    sigaddset(&hangup, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &hangup, nullptr);
+
+    flag_map flags = create_flag_map(argc, argv, "ftpbwslajerqSRcHCLFEMK");
+
+    auto level = get_flag<int>(flags, "-l").value_or(MIN_LOG_LEVEL);
+    ensure(is_between(level, MIN_LOG_LEVEL, static_cast<int>(LOG_ERROR)),
+           "Log level must be from", MIN_LOG_LEVEL, "to", static_cast<int>(LOG_ERROR));
+    log_level.store(level);
+    LogSink::instance().start();
+
+    auto port = get_flag<uint16_t>(flags, "-p").value_or(TicketServer::DEFAULT_PORT);
+    ensure(is_between(port, TicketServer::MIN_PORT, TicketServer::MAX_PORT),
+           "Port must be from", TicketServer::MIN_PORT, "to", TicketServer::MAX_PORT);
+    auto hosts = get_flag_list<std::string>(flags, "-H");
+    ensure(hosts.size() <= TicketServer::MAX_LISTENERS, "At most", TicketServer::MAX_LISTENERS,
+           "listening addresses are allowed");
+
+    std::vector<sockaddr_storage> addresses;
+    for (const std::string& host : hosts.empty() ? std::vector<std::string>{ANY_IPV4} : hosts) {
+        addresses.push_back(listen_address(host, port));
+    }
 
-        std::for_each_n(purchased[reservation].begin(), tickets, [&](auto& ticket) {
-            bytes += buffer_write(buffer + bytes, ticket);
-        });
+    auto cpus = get_flag_list<uint16_t>(flags, "-C");
+    for (uint16_t cpu : cpus) {
+        ensure(cpu < CPU_SETSIZE, "Cores must be below", CPU_SETSIZE);
+    }
 
-        debug("Sending", tickets, "tickets for reservation", reservation);
-        this->send_response(client, bytes);
+    auto batch = get_flag<uint16_t>(flags, "-b").value_or(TicketServer::DEFAULT_BATCH);
+    auto workers = get_flag<uint16_t>(flags, "-w").value_or(TicketServer::DEFAULT_WORKERS);
+    auto backend = get_flag<std::string>(flags, "-e").value_or(BLOCKING_LOOP);
+    ensure(is_between(workers, TicketServer::MIN_WORKERS, TicketServer::MAX_WORKERS),
+           "Number of workers must be from", TicketServer::MIN_WORKERS, "to", TicketServer::MAX_WORKERS);
+
+    TicketServer::SocketBuffers buffers;
+    buffers.send = get_flag<int>(flags, "-S").value_or(0);
+    buffers.receive = get_flag<int>(flags, "-R").value_or(0);
+    ensure(is_between(buffers.send, 0, INT_MAX / 2) && is_between(buffers.receive, 0, INT_MAX / 2),
+           "Socket buffer sizes must be from 0 to", INT_MAX / 2);
+
+    auto file = get_flag_required<std::string>(flags, "-f");
+    auto load_start = std::chrono::steady_clock::now();
+    Catalog catalog = load_catalog(file);
+    std::chrono::duration<double, std::milli> load_time = std::chrono::steady_clock::now() - load_start;
+    info("Loaded", catalog.size(), "events from", file, "in", load_time.count(), "ms");
+
+    if (auto snapshot = get_flag<std::string>(flags, "-s"); snapshot.has_value()) {
+        save_catalog(catalog, snapshot.value());
+        info("Saved snapshot of events to", snapshot.value());
     }
 
-    void disable_expiration(reservation_id reservation) {
-        seconds_t expiration_time = reserved[reservation].first.second;
-        expiration[expiration_time].erase(reservation);
-        debug("Disabled expiration for reservation", reservation);
+    auto journal = get_flag<std::string>(flags, "-j");
+    auto leader = get_flag<std::string>(flags, "-F");
+    auto replication_port = get_flag<uint16_t>(flags, "-L");
+    ensure(!replication_port.has_value() || journal.has_value(), "Replicating to a follower needs a journal");
+
+    /* One shard per worker, every worker listens on its own socket and expires its own shard */
+    Database database(
+        std::move(catalog),
+        get_flag<uint32_t>(flags, "-t").value_or(Database::DEFAULT_TIMEOUT),
+        workers,
+        leader.has_value() ? std::nullopt : journal,
+        get_flag_list<Database::event_id>(flags, "-E"),
+        get_flag<uint32_t>(flags, "-M").value_or(Database::MAX_SHARD_RESERVATIONS),
+        get_flag<uint32_t>(flags, "-K").value_or(Database::BOUGHT_RETENTION)
+    );
+
+    /* A follower binds no client socket until it takes over from its lost leader */
+    if (leader.has_value()) {
+        ReplicationFollower follower(endpoint_address(leader.value()));
+        database.promote(follower.follow(database, workers), journal);
     }
 
-    void assign_tickets(reservation_id reservation, tickets_t ticket_count) {
-        std::generate_n(std::back_inserter(purchased[reservation]), ticket_count, [this] {
-            return this->generate_ticket();
+    std::unique_ptr<ReplicationLeader> replication;
+    if (replication_port.has_value()) {
+        replication = std::make_unique<ReplicationLeader>(replication_port.value(), [&] {
+            return database.replication_state();
+        });
+        database.on_journal_commit([&](const std::vector<std::string>& records) {
+            replication->ship(records);
         });
+        std::thread(&ReplicationLeader::start, replication.get()).detach();
     }
 
-    std::string generate_ticket() {
-        std::string ticket = next_ticket;
-
-        /* Increment last ticket code, digits are smaller than letters */
-        for (auto& letter : ticket) {
-            if (letter == MAX_TICKET_ALPHA) {
-                letter = MIN_TICKET_DIGIT;
-            } else {
-                if (letter == MAX_TICKET_DIGIT) {
-                    letter = MIN_TICKET_ALPHA;
-                } else {
-                    letter++;
-                }
-                break;
-            }
-        }
+    /* Clients stay with one worker, while the requests for an event are spread over all of them */
+    TicketServer::Limits limits;
+    limits.client_rate = get_flag<uint32_t>(flags, "-r").value_or(0);
+    limits.event_rate = (get_flag<uint32_t>(flags, "-q").value_or(0) + workers - 1) / workers;
+
+    /* A client retrying GET_TICKETS stays with one worker, so its cache holds the response */
+    auto replay_budget = get_flag<uint32_t>(flags, "-c").value_or(RequestHandler::REPLAY_CACHE_BUDGET);
+
+    RequestHandler::metrics_t metrics(workers, RequestHandler::REQUEST_NAMES);
+    std::vector<std::unique_ptr<TicketServer>> servers;
+    for (uint16_t i = 0; i < workers; i++) {
+        /* Workers take the given cores in turn */
+        auto cpu = cpus.empty() ? std::nullopt : std::optional(cpus[i % cpus.size()]);
+        servers.emplace_back(std::make_unique<TicketServer>(database, i, addresses, batch, workers > 1, cpu,
+                                                            backend, buffers, limits, replay_budget, metrics));
+    }
 
-        std::swap(ticket, next_ticket);
+    std::unique_ptr<AdminServer> admin;
+    if (auto admin_port = get_flag<uint16_t>(flags, "-a"); admin_port.has_value()) {
+        admin = std::make_unique<AdminServer>(admin_port.value(), [&](std::string_view command) -> std::string {
+            std::string_view name = command.substr(0, command.find(' '));
+            std::string_view argument = command.substr(std::min(command.size(), name.size() + 1));
 
-        return ticket;
-    }
+            if (command == "reload")
+                return reload_events(database, file) + "\n";
 
-    template<typename T, std::enable_if_t<std::is_same_v<T, uint32_t>, bool> = true>
-    void send_bad_request(addr_ptr client, T data) {
-        if (data < MIN_RESERVATION_ID) { /* If T is event_id */
-            debug("Illegal amount of tickets for event", data);
-        } else { /* If T is reservation_id */
-            debug("Invalid cookie or reservation", data, "does not exist");
-        }
+            if (name == "events")
+                return query_events(database, argument);
 
-        size_t bytes = buffer_write(buffer, BAD_REQUEST, htonl(data));
-        this->send_response(client, bytes);
+            if (name == "expiring")
+                return query_expiring(database, argument);
+
+            if (command != "metrics")
+                return "Unknown command\n";
+
+            return metrics.prometheus()
+                   + prometheus_value("reservations", "gauge", "Reservations held, neither expired nor bought",
+                                      database.held_count())
+                   + prometheus_value("bought_reservations", "gauge", "Bought reservations kept for retries",
+                                      database.bought_count())
+                   + prometheus_value("dropped_log_lines_total", "counter", "Log lines dropped on a full ring",
+                                      LogSink::instance().dropped_lines());
+        });
+        std::thread(&AdminServer::start, admin.get()).detach();
     }
-};
 
-int main(int argc, char** argv) {
-    flag_map flags = create_flag_map(argc, argv, "ftp");
+    std::thread(reload_on_hangup, std::ref(database), file, hangup).detach();
 
-    TicketServer server(
-        get_flag_required<std::string>(flags, "-f"),
-        get_flag<uint16_t>(flags, "-p").value_or(TicketServer::DEFAULT_PORT),
-        get_flag<uint32_t>(flags, "-t").value_or(TicketServer::DEFAULT_TIMEOUT)
-    );
+    for (uint16_t i = 1; i < workers; i++) {
+        std::thread(&TicketServer::start, servers[i].get()).detach();
+    }
 
-    server.start();
+    servers.front()->start();
 
     return EXIT_SUCCESS;
 }
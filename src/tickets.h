@@ -0,0 +1,71 @@
+#ifndef CINEMA_SERVER_TICKETS_H
+#define CINEMA_SERVER_TICKETS_H
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+
+/** Length of a ticket code */
+constexpr size_t TICKET_LEN = 7;
+
+namespace {
+    /** Ticket digits in increasing order, digits are smaller than letters */
+    constexpr char TICKET_DIGITS[] = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    constexpr uint64_t TICKET_BASE = sizeof(TICKET_DIGITS) - 1;
+    constexpr uint64_t TICKET_PAIR_BASE = TICKET_BASE * TICKET_BASE;
+
+    /** Number of distinct ticket codes, after which codes start over */
+    constexpr uint64_t TICKET_SPACE = TICKET_PAIR_BASE * TICKET_PAIR_BASE * TICKET_PAIR_BASE * TICKET_BASE;
+
+    /** Two consecutive digits of every number below TICKET_PAIR_BASE, least significant first */
+    constexpr std::array<std::array<char, 2>, TICKET_PAIR_BASE> build_ticket_pairs() {
+        std::array<std::array<char, 2>, TICKET_PAIR_BASE> pairs{};
+
+        for (uint64_t value = 0; value < TICKET_PAIR_BASE; value++) {
+            pairs[value][0] = TICKET_DIGITS[value % TICKET_BASE];
+            pairs[value][1] = TICKET_DIGITS[value / TICKET_BASE];
+        }
+
+        return pairs;
+    }
+
+    constexpr auto TICKET_PAIRS = build_ticket_pairs();
+}
+
+/**
+ * Writes the code of the ticket with a given number, the first character
+ * being the least significant digit. Consecutive numbers give the codes
+ * "0000000", "1000000", ..., "Z000000", "0100000" and so on.
+ * @param dest buffer of at least TICKET_LEN octets
+ * @param number ticket number
+ * @return TICKET_LEN
+ */
+inline size_t ticket_write(char* dest, uint64_t number) {
+    number %= TICKET_SPACE;
+
+    memcpy(dest, TICKET_PAIRS[number % TICKET_PAIR_BASE].data(), 2);
+    number /= TICKET_PAIR_BASE;
+    memcpy(dest + 2, TICKET_PAIRS[number % TICKET_PAIR_BASE].data(), 2);
+    number /= TICKET_PAIR_BASE;
+    memcpy(dest + 4, TICKET_PAIRS[number % TICKET_PAIR_BASE].data(), 2);
+    dest[6] = TICKET_DIGITS[number / TICKET_PAIR_BASE];
+
+    return TICKET_LEN;
+}
+
+/**
+ * Writes codes of consecutive tickets.
+ * @param dest buffer of at least @p count * TICKET_LEN octets
+ * @param first number of the first ticket
+ * @param count number of tickets
+ * @return number of written octets
+ */
+inline size_t tickets_write(char* dest, uint64_t first, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        ticket_write(dest + i * TICKET_LEN, first + i);
+    }
+
+    return count * TICKET_LEN;
+}
+
+#endif //CINEMA_SERVER_TICKETS_H
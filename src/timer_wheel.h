@@ -0,0 +1,124 @@
+#ifndef CINEMA_SERVER_TIMER_WHEEL_H
+#define CINEMA_SERVER_TIMER_WHEEL_H
+
+#include <limits>
+#include <vector>
+#include <cstdint>
+
+#include "slab.h"
+
+/**
+ * Hashed timing wheel with a resolution of one second. Timers are kept
+ * in a bucket per second of the span, so scheduling and cancelling are O(1)
+ * and advancing the clock only touches buckets of the elapsed seconds.
+ * Buckets are lists linked through a slab of timers, so once the slab has
+ * grown to the most timers pending at once, scheduling never allocates.
+ * @tparam Key identifier of a timer
+ */
+template<typename Key>
+class TimerWheel {
+public:
+    /** Position of a timer inside the wheel, valid until the timer fires or is cancelled */
+    using handle = uint32_t;
+
+    /**
+     * Creates an empty wheel.
+     * @param span maximal distance in seconds between the current time and a timer
+     * @param now current time in seconds
+     */
+    TimerWheel(uint64_t span, uint64_t now) : buckets(span + 1), current(now) {}
+
+    /**
+     * Schedules a timer.
+     * @param time time to fire, at most span seconds from now
+     * @param key timer identifier
+     * @return handle to cancel the timer with
+     */
+    handle schedule(uint64_t time, Key key) {
+        Bucket& bucket = this->bucket(time);
+        handle timer = timers.acquire().value();
+
+        timers[timer] = {time, key, bucket.last, NO_TIMER};
+        (bucket.last == NO_TIMER ? bucket.first : timers[bucket.last].next) = timer;
+        bucket.last = timer;
+
+        return timer;
+    }
+
+    /** Cancels a pending timer in O(1). */
+    void cancel(handle timer) {
+        const Timer& cancelled = timers[timer];
+        Bucket& bucket = this->bucket(cancelled.time);
+
+        (cancelled.previous == NO_TIMER ? bucket.first : timers[cancelled.previous].next) = cancelled.next;
+        (cancelled.next == NO_TIMER ? bucket.last : timers[cancelled.next].previous) = cancelled.previous;
+        timers.release(timer);
+    }
+
+    /**
+     * Fires timers scheduled before @p now, at most @p budget of them,
+     * so a burst of timers is spread over several calls.
+     * @param now current time in seconds
+     * @param budget maximal number of timers to fire
+     * @param fire callable invoked with the key of every fired timer
+     * @return true if some timers scheduled before @p now are still pending
+     */
+    template<typename Callback>
+    bool advance(uint64_t now, size_t budget, Callback&& fire) {
+        /* After a long pause every bucket is visited at most once */
+        if (now > current + buckets.size()) {
+            current = now - buckets.size();
+        }
+
+        for (; current < now; current++) {
+            for (handle timer = this->bucket(current).first; timer != NO_TIMER;) {
+                auto [time, key, previous, next] = timers[timer];
+
+                if (time >= now) { /* Wrapped around, belongs to a later turn */
+                    timer = next;
+                    continue;
+                }
+
+                if (budget == 0)
+                    return true;
+
+                this->cancel(timer);
+                budget--;
+                fire(key);
+                timer = next;
+            }
+        }
+
+        return false;
+    }
+
+    /** Number of pending timers */
+    size_t size() const {
+        return timers.size();
+    }
+
+private:
+    static constexpr handle NO_TIMER = std::numeric_limits<handle>::max();
+
+    struct Timer {
+        uint64_t time;
+        Key key;
+        handle previous; /** Neighbours in the bucket, NO_TIMER at its ends */
+        handle next;
+    };
+
+    struct Bucket {
+        handle first = NO_TIMER; /** Earliest scheduled timer */
+        handle last = NO_TIMER;
+    };
+
+    std::vector<Bucket> buckets;
+    uint64_t current; /** Earliest second whose bucket was not fully fired */
+    Slab<Timer> timers;
+
+    Bucket& bucket(uint64_t time) {
+        return buckets[time % buckets.size()];
+    }
+};
+
+#endif //CINEMA_SERVER_TIMER_WHEEL_H
@@ -0,0 +1,217 @@
+#ifndef CINEMA_SERVER_URING_H
+#define CINEMA_SERVER_URING_H
+
+#include <ctime>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "ensure.h"
+
+/**
+ * Minimal io_uring over raw system calls: a submission and a completion
+ * ring shared with the kernel, and a ring of provided buffers the kernel
+ * picks receive buffers from. Used by a single thread.
+ */
+class Uring {
+public:
+    /** @param entries number of submission entries, the completion ring is twice as large */
+    explicit Uring(unsigned entries) {
+        io_uring_params params{};
+        fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        ensure(fd >= 0, "Failed to set up io_uring:", strerror(errno));
+        ensure((params.features & IORING_FEAT_SINGLE_MMAP) && (params.features & IORING_FEAT_EXT_ARG),
+               "io_uring of this kernel is too old");
+
+        size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        ring_size = std::max(sq_size, cq_size);
+        sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+
+        ring = static_cast<char*>(this->map(ring_size, IORING_OFF_SQ_RING));
+        sqes = static_cast<io_uring_sqe*>(this->map(sqes_size, IORING_OFF_SQES));
+
+        sq_head = reinterpret_cast<unsigned*>(ring + params.sq_off.head);
+        sq_tail = reinterpret_cast<unsigned*>(ring + params.sq_off.tail);
+        sq_mask = *reinterpret_cast<unsigned*>(ring + params.sq_off.ring_mask);
+        sq_array = reinterpret_cast<unsigned*>(ring + params.sq_off.array);
+        sq_entries = params.sq_entries;
+
+        cq_head = reinterpret_cast<unsigned*>(ring + params.cq_off.head);
+        cq_tail = reinterpret_cast<unsigned*>(ring + params.cq_off.tail);
+        cq_mask = *reinterpret_cast<unsigned*>(ring + params.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(ring + params.cq_off.cqes);
+    }
+
+    Uring(const Uring&) = delete;
+    Uring& operator=(const Uring&) = delete;
+
+    ~Uring() {
+        if (buffers != nullptr) {
+            munmap(buffers, buffers_size);
+        }
+
+        munmap(sqes, sqes_size);
+        munmap(ring, ring_size);
+        close(fd);
+    }
+
+    /**
+     * Queues a submission, sent with the next enter().
+     * @param fill callable filling the zeroed entry
+     * @return false if the submission ring is full
+     */
+    template<typename Fill>
+    bool submit(Fill&& fill) {
+        unsigned tail = *sq_tail;
+
+        if (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == sq_entries)
+            return false;
+
+        io_uring_sqe* sqe = &sqes[tail & sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        fill(sqe);
+
+        sq_array[tail & sq_mask] = tail & sq_mask;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        unsubmitted++;
+
+        return true;
+    }
+
+    /**
+     * Sends queued submissions and waits for a completion.
+     * @param wait whether to wait for a completion
+     * @param timeout_ms longest wait, negative for no limit
+     */
+    void enter(bool wait, int timeout_ms) {
+        timespec timeout{timeout_ms / 1000, static_cast<long>(timeout_ms % 1000) * 1000000};
+        io_uring_getevents_arg argument{};
+        argument.sigmask_sz = _NSIG / 8;
+        argument.ts = timeout_ms < 0 ? 0 : reinterpret_cast<uint64_t>(&timeout);
+
+        unsigned flags = IORING_ENTER_EXT_ARG | (wait ? IORING_ENTER_GETEVENTS : 0);
+        long submitted = syscall(__NR_io_uring_enter, fd, unsubmitted, wait ? 1 : 0, flags,
+                                 &argument, sizeof(argument));
+
+        if (submitted < 0) {
+            ensure(errno == ETIME || errno == EINTR || errno == EBUSY, "Failed to enter io_uring:", strerror(errno));
+            return;
+        }
+
+        unsubmitted -= static_cast<unsigned>(submitted);
+    }
+
+    /**
+     * Consumes completions.
+     * @param limit maximal number of consumed completions
+     * @param visit callable invoked with every completion
+     * @return number of consumed completions
+     */
+    template<typename Visitor>
+    size_t complete(size_t limit, Visitor&& visit) {
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        size_t completed = 0;
+
+        for (; head != tail && completed < limit; head++, completed++) {
+            visit(cqes[head & cq_mask]);
+        }
+
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        return completed;
+    }
+
+    /**
+     * Registers a ring of equal buffers the kernel selects receive buffers from.
+     * @param group buffer group used by submissions with IOSQE_BUFFER_SELECT
+     * @param count number of buffers, a power of two
+     * @param size octets per buffer
+     */
+    void provide_buffers(uint16_t group, uint16_t count, size_t size) {
+        buffer_count = count;
+        buffer_size = size;
+        buffers_size = count * (sizeof(io_uring_buf) + size);
+
+        void* memory = mmap(nullptr, buffers_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        ensure(memory != MAP_FAILED, "Failed to allocate io_uring buffers");
+        buffers = static_cast<char*>(memory);
+        buffer_ring = reinterpret_cast<io_uring_buf_ring*>(buffers);
+
+        io_uring_buf_reg registration{};
+        registration.ring_addr = reinterpret_cast<uint64_t>(buffer_ring);
+        registration.ring_entries = count;
+        registration.bgid = group;
+        ensure(syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &registration, 1) == 0,
+               "Failed to register io_uring buffers:", strerror(errno));
+
+        for (uint16_t id = 0; id < count; id++) {
+            this->recycle(id);
+        }
+
+        this->publish_buffers();
+    }
+
+    /** Gives a provided buffer */
+    char* buffer(uint16_t id) const {
+        return buffers + buffer_count * sizeof(io_uring_buf) + id * buffer_size;
+    }
+
+    /** Returns a buffer to the kernel, visible after publish_buffers() */
+    void recycle(uint16_t id) {
+        /* Not bufs[]: its flexible array declaration is offset by an empty struct in C++ */
+        io_uring_buf& entry = reinterpret_cast<io_uring_buf*>(buffers)[(buffer_tail + recycled) & (buffer_count - 1)];
+        entry.addr = reinterpret_cast<uint64_t>(this->buffer(id));
+        entry.len = static_cast<uint32_t>(buffer_size);
+        entry.bid = id;
+        recycled++;
+    }
+
+    void publish_buffers() {
+        buffer_tail = static_cast<uint16_t>(buffer_tail + recycled);
+        recycled = 0;
+        __atomic_store_n(&buffer_ring->tail, buffer_tail, __ATOMIC_RELEASE);
+    }
+
+private:
+    int fd = -1;
+
+    char* ring = nullptr;
+    size_t ring_size = 0;
+    io_uring_sqe* sqes = nullptr;
+    size_t sqes_size = 0;
+
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned sq_mask = 0, sq_entries = 0;
+    unsigned unsubmitted = 0; /** Queued submissions not passed to the kernel yet */
+
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    char* buffers = nullptr; /** Ring of buffer descriptors followed by the buffers */
+    size_t buffers_size = 0;
+    io_uring_buf_ring* buffer_ring = nullptr;
+    uint16_t buffer_count = 0;
+    size_t buffer_size = 0;
+    uint16_t buffer_tail = 0;
+    uint16_t recycled = 0; /** Buffers recycled since the last publish_buffers() */
+
+    void* map(size_t size, off_t offset) const {
+        void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+        ensure(mapping != MAP_FAILED, "Failed to map io_uring");
+        return mapping;
+    }
+};
+
+#endif //CINEMA_SERVER_URING_H
@@ -7,9 +7,12 @@ class Printable:
 
 class Response255Exception(Exception): pass
 
+END_OF_EVENTS = (1 << 32) - 1
+
 class Client:
     def __init__(self, server_ip='localhost', server_port=DEFAULT_PORT):
-        self.socket = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        family = socket.AF_INET6 if ':' in server_ip else socket.AF_INET
+        self.socket = socket.socket(family, socket.SOCK_DGRAM)
         self.server_addr = (server_ip, server_port)
 
     def send_message(self, message):
@@ -22,7 +25,22 @@ class Client:
         self.send_message(struct.pack('!B', 1))
         data = self.receive_message()
         assert struct.unpack('!B', data[0:1])[0] == 2
-        data = data[1:]
+        return self.parse_events(data[1:])
+
+    # returns events and the cursor of the next page, END_OF_EVENTS after the last one
+    def get_events_page(self, cursor):
+        self.send_message(struct.pack('!BI', 7, cursor))
+        data = self.receive_message()
+        message_type = struct.unpack('!B', data[0:1])[0]
+        assert message_type == 8 or message_type == 255
+        if message_type == 255:
+            assert struct.unpack('!I', data[1:])[0] == cursor
+            raise Response255Exception(cursor)
+        next_cursor = struct.unpack('!I', data[1:5])[0]
+        return self.parse_events(data[5:]), next_cursor
+
+    @staticmethod
+    def parse_events(data):
         ret = []
         while data:
             class EventInfo(Printable): pass
@@ -51,6 +69,33 @@ class Client:
         info.cookie = info.cookie.decode('utf-8')
         return info
 
+    # reserves (event_id, ticket_count) pairs all at once, returns their reservations in the same order
+    def get_reservations(self, requests):
+        message = struct.pack('!BB', 9, len(requests))
+        for event_id, ticket_count in requests:
+            message += struct.pack('!IH', event_id, ticket_count)
+        self.send_message(message)
+        data = self.receive_message()
+        message_type = struct.unpack('!B', data[0:1])[0]
+        assert message_type == 10 or message_type == 255
+        if message_type == 255:
+            event_id = struct.unpack('!I', data[1:])[0]
+            raise Response255Exception(event_id)
+        count = struct.unpack('!B', data[1:2])[0]
+        assert count == len(requests) and len(data) == 2 + count * (4 + 4 + 2 + 48 + 8)
+
+        ret = []
+        for i in range(count):
+            class ReservationInfo(Printable): pass
+            info = ReservationInfo()
+            offset = 2 + i * 66
+            info.reservation_id, info.event_id, info.ticket_count, info.cookie, info.expiration_time = struct.unpack('!IIH48sQ', data[offset : offset + 66])
+            for c in info.cookie:
+                assert 33 <= c and c <= 126
+            info.cookie = info.cookie.decode('utf-8')
+            ret.append(info)
+        return ret
+
     def get_tickets(self, reservation_id, cookie):
         self.send_message(struct.pack('!BI48s', 5, reservation_id, cookie.encode()))
         data = self.receive_message()
@@ -1,4 +1,4 @@
-import subprocess, time, psutil, sys
+import subprocess, threading, time, psutil, sys
 
 SERVER = 'localhost'
 # SERVER = 'students.mimuw.edu.pl'
@@ -36,8 +36,8 @@ def min_unused_server_port():
         if not is_port_in_use_on_server(port):
             return port
 
-# server_kill_timeout is in ms
-def start_server_with_params(params, server_kill_timeout=5000):
+# server_kill_timeout is in ms, with log=True the server's stderr is piped for a ServerLog
+def start_server_with_params(params, server_kill_timeout=5000, log=False):
     debug = is_debug()
     args = [EXECUTABLE] + params
 
@@ -61,7 +61,10 @@ def start_server_with_params(params, server_kill_timeout=5000):
             if debug:
                 print(f'Redirected form port {old_port} to {port}')
 
-    if debug:
+    if log:
+        server = subprocess.Popen(args,
+            stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True)
+    elif debug:
         server = subprocess.Popen(args)
     else:
         server = subprocess.Popen(args,
@@ -79,6 +82,29 @@ def start_server_with_params(params, server_kill_timeout=5000):
 def start_server(events_filename, timeout=5, port=DEFAULT_PORT):
     return start_server_with_params(['-f', events_filename, '-p', str(port), '-t', str(timeout)])
 
+# collects the lines a server started with log=True writes to stderr
+class ServerLog:
+    def __init__(self, server):
+        self.lines = []
+        self.reader = threading.Thread(target=self.read, args=(server.stderr,), daemon=True)
+        self.reader.start()
+
+    def read(self, stream):
+        for line in stream:
+            self.lines.append(line.rstrip('\n'))
+
+    def contains(self, text):
+        return any(text in line for line in self.lines)
+
+    # returns seconds until a line containing text was written, timeout is in seconds
+    def wait_for(self, text, timeout):
+        start_time = time.time()
+        while not self.contains(text):
+            if time.time() > start_time + timeout:
+                raise TimeoutException("waiting for log line timed out: " + text)
+            time.sleep(0.01)
+        return time.time() - start_time
+
 def get_return_code_of_server_with_params(params):
     try:
         server = start_server_with_params(params)
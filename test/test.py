@@ -5,6 +5,33 @@ from test_limits import test_limits
 from test_empty_file import test_empty_file
 from test_reservation_timing_out import test_reservation_timing_out
 from test_invalid_requests import test_invalid_requests
+from test_throughput import test_throughput
+from test_workers import test_workers
+from test_events_cache import test_events_cache
+from test_expiration import test_expiration
+from test_reservation_ids import test_reservation_ids
+from test_ticket_codes import test_ticket_codes
+from test_snapshot import test_snapshot
+from test_dense_events import test_dense_events
+from test_paging import test_paging
+from test_cookies import test_cookies
+from test_log_levels import test_log_levels
+from test_metrics import test_metrics
+from test_load_generator import test_load_generator
+from test_journal import test_journal
+from test_event_loops import test_event_loops
+from test_bulk_reservation import test_bulk_reservation
+from test_admission import test_admission
+from test_coarse_clock import test_coarse_clock
+from test_backpressure import test_backpressure
+from test_replay_cache import test_replay_cache
+from test_listeners import test_listeners
+from test_reload import test_reload
+from test_allocations import test_allocations
+from test_introspection import test_introspection
+from test_replication import test_replication
+from test_hot_events import test_hot_events
+from test_held_reservations import test_held_reservations
 
 import os
 
@@ -16,7 +43,34 @@ if __name__ == '__main__':
         test_limits,
         test_reservation_timing_out,
         test_empty_file,
-        test_invalid_requests
+        test_invalid_requests,
+        test_throughput,
+        test_workers,
+        test_events_cache,
+        test_expiration,
+        test_reservation_ids,
+        test_ticket_codes,
+        test_snapshot,
+        test_dense_events,
+        test_paging,
+        test_cookies,
+        test_log_levels,
+        test_metrics,
+        test_load_generator,
+        test_journal,
+        test_event_loops,
+        test_bulk_reservation,
+        test_admission,
+        test_coarse_clock,
+        test_backpressure,
+        test_replay_cache,
+        test_listeners,
+        test_reload,
+        test_allocations,
+        test_introspection,
+        test_replication,
+        test_hot_events,
+        test_held_reservations
     ]
     
     try:
@@ -0,0 +1,82 @@
+from basic_client import Client, Response255Exception
+from server_wrap import start_server_with_params, DEFAULT_PORT
+from event_files.generate_file import generate_file
+from test_metrics import ADMIN_PORT, scrape
+
+import socket, struct, time
+
+CLIENT_RATE = 5
+EVENT_RATE = 5
+
+def admission_events(file):
+    file.write('premiere\n1000\nmatinee\n1000\n')
+
+def burst(message, count, wait=0.3):
+    """Sends all messages from one client at once, gives the number of responses and the time of the last one"""
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    s.settimeout(wait)
+    start = time.time()
+    for _ in range(count):
+        s.sendto(message, ('localhost', DEFAULT_PORT))
+
+    answered, last = 0, 0
+    try:
+        while True:
+            s.recvfrom(1 << 16)
+            answered += 1
+            last = time.time() - start
+    except socket.timeout:
+        pass
+    s.close()
+    return answered, last
+
+def test_admission():
+    # Every client may send a burst of CLIENT_RATE requests, the rest is shed without a response
+    server = start_server_with_params(['-f', generate_file(admission_events), '-r', str(CLIENT_RATE),
+                                       '-a', str(ADMIN_PORT)])
+    answered, _ = burst(struct.pack('!B', 1), 20)
+    assert answered == CLIENT_RATE
+    assert len(Client().get_events()) == 2 # another client is not limited
+    assert scrape()['ticket_server_shed_requests_total'] == 20 - CLIENT_RATE
+
+    time.sleep(1.1) # the bucket refills
+    answered, _ = burst(struct.pack('!B', 1), 3)
+    assert answered == 3
+    server.terminate()
+    server.communicate()
+
+    # Reservations above the rate of an event wait and are answered as the event admits them
+    server = start_server_with_params(['-f', generate_file(admission_events), '-q', str(EVENT_RATE),
+                                       '-a', str(ADMIN_PORT)])
+    answered, last = burst(struct.pack('!BIH', 3, 0, 1), EVENT_RATE + 3, wait=0.5)
+    assert answered == EVENT_RATE + 3
+    assert last >= 2.5 / EVENT_RATE
+    assert scrape()['ticket_server_deferred_requests_total'] == 3
+
+    # Other events and requests are not held up
+    client = Client()
+    client.get_reservation(1, 1)
+    assert [e.ticket_count for e in client.get_events()] == [1000 - EVENT_RATE - 3, 999]
+
+    # Requests waiting longer than a second are dropped
+    time.sleep(1.1)
+    answered, _ = burst(struct.pack('!BIH', 3, 0, 1), EVENT_RATE + 10, wait=1.5)
+    assert EVENT_RATE + 3 <= answered < EVENT_RATE + 10
+    assert scrape()['ticket_server_shed_requests_total'] == EVENT_RATE + 10 - answered
+
+    # GET_RESERVATIONS is not queued, it is shed unless all its events have a token
+    time.sleep(1.1)
+    drain = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    for _ in range(EVENT_RATE):
+        drain.sendto(struct.pack('!BIH', 3, 0, 1), ('localhost', DEFAULT_PORT))
+    answered, _ = burst(struct.pack('!BBIHIH', 9, 2, 1, 1, 0, 1), 1, wait=0.1)
+    assert answered == 0
+    drain.close()
+    time.sleep(1.1)
+    assert len(client.get_reservations([(1, 1), (0, 1)])) == 2
+
+    server.terminate()
+    server.communicate()
+
+if __name__ == '__main__':
+    test_admission()
@@ -0,0 +1,75 @@
+from basic_client import Client, Response255Exception
+from server_wrap import start_server_with_params
+from event_files.generate_file import generate_file
+from test_metrics import ADMIN_PORT, scrape
+
+import time
+
+COUNTER = 'ticket_server_allocations_total'
+MIN_REPLAYED_TICKETS = 64
+REPLAY_BUDGET = 8192 # octets, evicting cached responses after a few purchases
+
+def allocations_events(file):
+    file.write('premiere\n1000\nmatinee\n1000\ngala\n10000\n')
+
+def reserve(client, count):
+    return [client.get_reservation(i % 2, 1) for i in range(count)]
+
+# Bought tickets are encoded into a response cached for retries
+def buy_cached(client, count):
+    for _ in range(count):
+        r = client.get_reservation(2, MIN_REPLAYED_TICKETS)
+        tickets = client.get_tickets(r.reservation_id, r.cookie)
+        assert client.get_tickets(r.reservation_id, r.cookie).tickets == tickets.tickets
+
+def test_allocations():
+    # Debug logging formats its lines, so it is disabled
+    server = start_server_with_params(['-f', generate_file(allocations_events), '-t', '1', '-l', '1',
+                                       '-a', str(ADMIN_PORT), '-c', str(REPLAY_BUDGET)])
+    client = Client()
+
+    # Grows the tables to the reservations held at once, their slots are freed on expiry
+    reserve(client, 200)
+    buy_cached(client, 20)
+    time.sleep(2.5)
+    before = scrape()[COUNTER]
+    assert before > 0
+
+    # Reservations, purchases, their retries and refused requests reuse the grown tables
+    for r in reserve(client, 100)[::2]:
+        tickets = client.get_tickets(r.reservation_id, r.cookie)
+        assert client.get_tickets(r.reservation_id, r.cookie).tickets == tickets.tickets
+        try:
+            client.get_tickets(r.reservation_id, 'x' * 48)
+            assert False
+        except Response255Exception:
+            pass
+    try:
+        client.get_reservation(0, 5000)
+        assert False
+    except Response255Exception:
+        pass
+    assert scrape()[COUNTER] == before
+
+    # Cached responses reuse the memory of evicted ones
+    buy_cached(client, 20)
+    assert scrape()[COUNTER] == before
+
+    # The listing is copied once after a change, later requests share it
+    client.get_events()
+    before = scrape()[COUNTER]
+    for _ in range(10):
+        client.get_events()
+    assert scrape()[COUNTER] == before
+
+    # A listing published after every reservation reuses the memory of the one it replaces
+    for i in range(10):
+        client.get_reservation(i % 2, 1)
+        client.get_events()
+    before = scrape()[COUNTER]
+    for i in range(50):
+        client.get_reservation(i % 2, 1)
+        client.get_events()
+    assert scrape()[COUNTER] == before
+
+    server.terminate()
@@ -0,0 +1,37 @@
+from basic_client import Client
+from server_wrap import start_server_with_params
+from event_files.generate_file import generate_file
+from test_metrics import ADMIN_PORT, scrape
+
+import socket, struct, time
+
+BURST = 2000
+
+def backpressure_events(file):
+    # GET_EVENTS responses of about 60 KB, a few of them fill the smallest socket buffer
+    for i in range(240):
+        file.write('x' * 240 + '\n' + str(i) + '\n')
+
+def test_backpressure():
+    server = start_server_with_params(['-f', generate_file(backpressure_events), '-S', '4096', '-R', '65536',
+                                       '-a', str(ADMIN_PORT)])
+
+    # A client flooding the server without reading its responses
+    flood = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    flood.setsockopt(socket.SOL_SOCKET, socket.SO_RCVBUF, 4096)
+    for _ in range(BURST):
+        flood.sendto(struct.pack('!B', 1), ('localhost', 2022))
+    time.sleep(0.5)
+
+    # The server keeps serving, every response was either sent, kept or dropped
+    assert server.poll() is None
+    assert len(Client().get_events()) == 240
+    values = scrape()
+    assert values['ticket_server_responses_total'] >= 1
+    assert values['ticket_server_queued_responses_total'] >= 0
+    assert values['ticket_server_dropped_responses_total'] >= 0
+    assert values['ticket_server_responses_total'] + values['ticket_server_dropped_responses_total'] \
+        <= values['ticket_server_requests_total{type="GET_EVENTS"}']
+
+    flood.close()
+    server.terminate()
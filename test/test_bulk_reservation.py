@@ -0,0 +1,90 @@
+from basic_client import Client, Response255Exception
+from server_wrap import start_server_with_params
+from event_files.generate_file import generate_file
+
+import socket, struct
+
+WORKERS = 4
+
+def bulk_reservation_events(file):
+    for i in range(300):
+        file.write('showing ' + str(i) + '\n' + str(10) + '\n')
+
+def ticket_counts(client):
+    return {e.event_id: e.ticket_count for e in client.get_events()}
+
+def test_bulk_requests():
+    server = start_server_with_params(['-f', generate_file(bulk_reservation_events), '-w', str(WORKERS)])
+    client = Client()
+
+    # Events of every shard, and one event twice
+    requests = [(0, 3), (1, 4), (2, 5), (3, 6), (7, 2), (0, 7)]
+    reservations = client.get_reservations(requests)
+    assert [(r.event_id, r.ticket_count) for r in reservations] == requests
+    ids = [r.reservation_id for r in reservations]
+    assert len(set(ids)) == len(ids)
+
+    counts = ticket_counts(client)
+    assert counts[0] == 0 and counts[1] == 6 and counts[2] == 5 and counts[3] == 4 and counts[7] == 8
+
+    # All or nothing: a failing event leaves the others untouched
+    for failing in [[(4, 1), (0, 1)], [(5, 2), (5, 9)], [(6, 1), (300, 1)], [(8, 0)], [(9, 11)]]:
+        try:
+            client.get_reservations(failing)
+            assert False
+        except Response255Exception as e:
+            assert e.args[0] == failing[-1][0]
+        assert ticket_counts(client) == counts
+
+    # Every reservation is bought on its own
+    tickets = set()
+    for r in reservations:
+        info = client.get_tickets(r.reservation_id, r.cookie)
+        assert info.ticket_count == r.ticket_count
+        tickets.update(info.tickets)
+    assert len(tickets) == sum(t for _, t in requests)
+
+    # Malformed requests are ignored
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    s.settimeout(0.5)
+    for message in [struct.pack('!B', 9), struct.pack('!BB', 9, 0), struct.pack('!BBIH', 9, 2, 1, 1),
+                    struct.pack('!BBIHB', 9, 1, 1, 1, 0)]:
+        s.sendto(message, client.server_addr)
+        try:
+            s.recvfrom(1 << 16)
+            assert False
+        except socket.timeout:
+            pass
+
+    # The largest request fits a datagram both ways
+    reservations = client.get_reservations([(i, 1) for i in range(10, 265)])
+    assert len(reservations) == 255
+
+    server.terminate()
+    server.communicate()
+
+def test_free_ids_per_shard():
+    held = 4 # reservations held at once by every worker
+    server = start_server_with_params(['-f', generate_file(bulk_reservation_events), '-w', str(WORKERS),
+                                       '-M', str(held)])
+    client = Client()
+
+    # Every worker only needs ids for its own requests, two of each
+    assert len(client.get_reservations([(i, 1) for i in range(2 * WORKERS)])) == 2 * WORKERS
+
+    # A worker left with two ids refuses three requests
+    try:
+        client.get_reservations([(100 + WORKERS * i, 1) for i in range(3)])
+        assert False
+    except Response255Exception:
+        pass
+
+    server.terminate()
+    server.communicate()
+
+def test_bulk_reservation():
+    test_bulk_requests()
+    test_free_ids_per_shard()
+
+if __name__ == '__main__':
+    test_bulk_reservation()
@@ -0,0 +1,36 @@
+from basic_client import Client, Response255Exception
+from server_wrap import start_server_with_params
+import time
+
+EVENT_LOOPS = ['blocking', 'busy_poll', 'io_uring']
+TIMEOUT = 2
+
+# the clock is cached with a resolution of a second, expiration_time is whole seconds
+def assert_expires_in(reservation, timeout):
+    now = time.time()
+    assert now + timeout - 1.5 <= reservation.expiration_time <= now + timeout + 1.5
+
+def test_coarse_clock():
+    for loop in EVENT_LOOPS:
+        server = start_server_with_params(['-f', 'event_files/simple_events', '-t', str(TIMEOUT), '-e', loop])
+        client = Client()
+        event = next(e for e in client.get_events() if e.ticket_count >= 2)
+
+        held = client.get_reservation(event.event_id, 1)
+        assert_expires_in(held, TIMEOUT)
+
+        # After a period without traffic the cached clock is not stale
+        time.sleep(TIMEOUT + 1)
+        bought = client.get_reservation(event.event_id, 1)
+        assert_expires_in(bought, TIMEOUT)
+        try:
+            client.get_tickets(held.reservation_id, held.cookie)
+            assert False
+        except Response255Exception:
+            pass
+
+        time.sleep(1)
+        assert client.get_tickets(bought.reservation_id, bought.cookie).ticket_count == 1
+
+        server.terminate()
+        server.wait()
@@ -0,0 +1,34 @@
+from basic_client import Client, Response255Exception
+from server_wrap import start_server
+from event_files.generate_file import generate_file
+
+RESERVATIONS = 3000
+
+def cookies_events(file):
+    file.write('concert\n' + str(RESERVATIONS) + '\n')
+
+def test_cookies():
+    server = start_server(generate_file(cookies_events))
+    client = Client()
+
+    reservations = [client.get_reservation(0, 1) for _ in range(RESERVATIONS)]
+    cookies = [r.cookie for r in reservations]
+    assert len(set(cookies)) == RESERVATIONS
+    assert all(33 <= ord(c) <= 126 for cookie in cookies for c in cookie)
+
+    # A cookie differing in a single random character is rejected
+    r = reservations[0]
+    forged = r.cookie[:-1] + ('!' if r.cookie[-1] != '!' else '~')
+    try:
+        client.get_tickets(r.reservation_id, forged)
+        assert False
+    except Response255Exception:
+        pass
+
+    assert client.get_tickets(r.reservation_id, r.cookie).ticket_count == 1
+
+    server.terminate()
+    server.communicate()
+
+if __name__ == '__main__':
+    test_cookies()
@@ -0,0 +1,37 @@
+from basic_client import Client, Response255Exception
+from server_wrap import start_server_with_params
+from event_files.generate_file import generate_file
+
+EVENTS = 50
+
+def description(event):
+    return 'show ' + 'x' * event
+
+def dense_events(file):
+    for i in range(EVENTS):
+        file.write(description(i) + '\n' + str(i + 1) + '\n')
+
+def test_dense_events():
+    server = start_server_with_params(['-f', generate_file(dense_events), '-w', '4'])
+    client = Client()
+
+    events = client.get_events()
+    assert [e.event_id for e in events] == list(range(EVENTS))
+    assert [e.description for e in events] == [description(i) for i in range(EVENTS)]
+    assert [e.ticket_count for e in events] == [i + 1 for i in range(EVENTS)]
+
+    # The first and the last id index the arrays, ids past them are refused
+    client.get_reservation(0, 1)
+    client.get_reservation(EVENTS - 1, EVENTS)
+    for event_id in [EVENTS, EVENTS + 1, (1 << 32) - 1]:
+        try:
+            client.get_reservation(event_id, 1)
+            assert False
+        except Response255Exception:
+            pass
+
+    # Only the counts of reserved events change, whichever shard owns them
+    counts = [e.ticket_count for e in client.get_events()]
+    assert counts == [0] + [i + 1 for i in range(1, EVENTS - 1)] + [0]
+
+    server.terminate()
@@ -0,0 +1,39 @@
+from basic_client import Client, Response255Exception
+from server_wrap import start_server_with_params
+from event_files.generate_file import generate_file
+
+EVENT_LOOPS = ['blocking', 'busy_poll', 'io_uring']
+
+def event_loops_events(file):
+    for i in range(10):
+        file.write('concert ' + str(i) + '\n' + str(i + 1) + '\n')
+
+def test_event_loops():
+    events_file = generate_file(event_loops_events)
+
+    for loop in EVENT_LOOPS:
+        server = start_server_with_params(['-f', events_file, '-e', loop, '-w', '2', '-b', '4'])
+        client = Client()
+
+        events = client.get_events()
+        assert sorted((e.event_id, e.ticket_count) for e in events) == [(i, i + 1) for i in range(10)]
+
+        reservation = client.get_reservation(9, 10)
+        try:
+            client.get_reservation(9, 1)
+            assert False
+        except Response255Exception:
+            pass
+
+        tickets = client.get_tickets(reservation.reservation_id, reservation.cookie)
+        assert len(set(tickets.tickets)) == 10
+
+        # Bursts larger than the batch are received over several rounds
+        for _ in range(50):
+            assert len(client.get_events()) == 10
+
+        server.terminate()
+        server.communicate()
+
+if __name__ == '__main__':
+    test_event_loops()
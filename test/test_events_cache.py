@@ -0,0 +1,31 @@
+from basic_client import Client
+from server_wrap import start_server
+from event_files.generate_file import generate_file
+import time
+
+def events_cache_events(file):
+    for i in range(3):
+        file.write('show ' + str(i) + '\n10\n')
+
+def ticket_counts(client):
+    return [e.ticket_count for e in client.get_events()]
+
+def test_events_cache():
+    server = start_server(generate_file(events_cache_events), timeout=1)
+    client = Client()
+
+    assert ticket_counts(client) == [10, 10, 10]
+    assert ticket_counts(client) == [10, 10, 10]
+
+    # The cached listing follows every reservation at once
+    client.get_reservation(0, 3)
+    assert ticket_counts(client) == [7, 10, 10]
+    bought = client.get_reservation(1, 4)
+    client.get_tickets(bought.reservation_id, bought.cookie)
+    assert ticket_counts(client) == [7, 6, 10]
+
+    # Expired tickets are listed again, bought ones are not
+    time.sleep(2.5)
+    assert ticket_counts(client) == [10, 6, 10]
+
+    server.terminate()
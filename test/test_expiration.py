@@ -0,0 +1,20 @@
+from basic_client import Client
+from server_wrap import start_server_with_params, ServerLog
+from event_files.generate_file import generate_file
+
+def expiration_events(file):
+    file.write('concert\n100\n')
+
+def test_expiration():
+    server = start_server_with_params(['-f', generate_file(expiration_events), '-t', '1'], log=True)
+    log = ServerLog(server)
+    client = Client()
+
+    # The reservation expires within its timeout and a second of the wheel, with no traffic
+    r = client.get_reservation(0, 10)
+    expired = 'Reservation ' + str(r.reservation_id) + ' has expired'
+    assert not log.contains(expired)
+    assert log.wait_for(expired, 3) < 2.5
+
+    server.terminate()
+    server.wait()
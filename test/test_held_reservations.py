@@ -0,0 +1,97 @@
+from basic_client import Client, Response255Exception
+from server_wrap import start_server_with_params
+from event_files.generate_file import generate_file
+from test_journal import crash
+
+import os, time, tempfile
+
+HELD = 4 # reservations held at once by the worker
+ROUNDS = 5
+
+def held_events(file):
+    file.write('premiere\n1000\n')
+
+def start(journal, params=[]):
+    return start_server_with_params(['-f', generate_file(held_events), '-M', str(HELD), '-j', journal] + params)
+
+def check_full(client):
+    try:
+        client.get_reservation(0, 1)
+        assert False
+    except Response255Exception:
+        pass
+
+def test_reused_slots():
+    journal = os.path.join(tempfile.mkdtemp(), 'journal')
+    server = start(journal)
+    client = Client()
+
+    # Only held reservations fill the worker, bought ones leave their slots to new ids
+    bought = {}
+    for _ in range(ROUNDS):
+        reservations = [client.get_reservation(0, 1) for _ in range(HELD)]
+        check_full(client)
+
+        for r in reservations:
+            assert r.reservation_id not in bought
+            bought[r.reservation_id] = (r.cookie, client.get_tickets(r.reservation_id, r.cookie).tickets)
+    assert len(bought) == ROUNDS * HELD
+
+    held = [client.get_reservation(0, 1) for _ in range(HELD - 1)]
+    crash(server)
+
+    # Restored slots skip the ids of bought reservations, which are still sent their tickets
+    server = start(journal)
+    client = Client()
+
+    for reservation_id, (cookie, tickets) in bought.items():
+        assert client.get_tickets(reservation_id, cookie).tickets == tickets
+
+    r = client.get_reservation(0, 1)
+    assert r.reservation_id not in bought and r.reservation_id not in [h.reservation_id for h in held]
+    check_full(client)
+
+    server.terminate()
+    server.communicate()
+
+def check_pruned(client, reservation):
+    try:
+        client.get_tickets(reservation.reservation_id, reservation.cookie)
+        assert False
+    except Response255Exception:
+        pass
+
+def test_pruned_reservations():
+    journal = os.path.join(tempfile.mkdtemp(), 'journal')
+    params = ['-t', '1', '-K', '1']
+    server = start(journal, params)
+    client = Client()
+
+    # Bought reservations are forgotten a second after they would have expired
+    reservations = [client.get_reservation(0, 1) for _ in range(HELD)]
+    for r in reservations:
+        client.get_tickets(r.reservation_id, r.cookie)
+    time.sleep(4)
+
+    for r in reservations:
+        check_pruned(client, r)
+
+    # A restart forgets purchases past their retention as well
+    later = [client.get_reservation(0, 1) for _ in range(HELD)]
+    for r in later:
+        client.get_tickets(r.reservation_id, r.cookie)
+    crash(server)
+
+    time.sleep(4)
+    server = start(journal, params)
+    client = Client()
+
+    for r in reservations + later:
+        check_pruned(client, r)
+
+    server.terminate()
+    server.communicate()
+
+def test_held_reservations():
+    test_reused_slots()
+    test_pruned_reservations()
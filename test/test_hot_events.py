@@ -0,0 +1,108 @@
+from basic_client import Client, Response255Exception
+from server_wrap import start_server_with_params, get_return_code_of_server_with_params
+from event_files.generate_file import generate_file
+from test_journal import crash
+
+import os, random, signal, tempfile, threading, time
+
+WORKERS = 4
+CLIENTS = 16
+HOT_TICKETS = 500
+TICKETS = 100
+TIMEOUT = 5
+RELOAD_WAIT = 0.5 # seconds, much longer than a reload and its compaction
+MIN_RESERVATION_ID = 1000000
+
+def hot_events_events(file):
+    file.write('blockbuster\n' + str(HOT_TICKETS) + '\n')
+    for i in range(1, 4):
+        file.write('indie ' + str(i) + '\n' + str(TICKETS) + '\n')
+
+def params(journal, hot=True):
+    return (['-f', generate_file(hot_events_events), '-w', str(WORKERS), '-t', str(TIMEOUT), '-j', journal]
+            + (['-E', '0'] if hot else []))
+
+def counts(client):
+    return {e.event_id: e.ticket_count for e in client.get_events()}
+
+# Reserves the hot event until it is sold out, smaller reservations are tried last
+def reserve_until_sold_out(client, seed, reservations):
+    rng = random.Random(seed)
+    while True:
+        try:
+            reservations.append(client.get_reservation(0, rng.randint(1, 5)))
+        except Response255Exception:
+            try:
+                reservations.append(client.get_reservation(0, 1))
+            except Response255Exception:
+                return
+
+def test_hot_events():
+    journal = os.path.join(tempfile.mkdtemp(), 'journal')
+    server = start_server_with_params(params(journal))
+    client = Client()
+
+    # Reserved together with an ordinary event, in the shard of the hot one
+    bulk = client.get_reservations([(0, 10), (1, 5)])
+
+    # Clients of all workers reserve the hot event at once, none of its tickets is sold twice
+    clients = [Client() for _ in range(CLIENTS)]
+    reserved = [[] for _ in clients]
+    threads = [threading.Thread(target=reserve_until_sold_out, args=(c, i, reserved[i]))
+               for i, c in enumerate(clients)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+
+    reservations = [r for rs in reserved for r in rs]
+    assert sum(r.ticket_count for r in reservations) + bulk[0].ticket_count == HOT_TICKETS
+    assert counts(client) == {0: 0, 1: TICKETS - 5, 2: TICKETS, 3: TICKETS}
+
+    # Workers hold reservations of the hot event in their own shards
+    shards = set((r.reservation_id - MIN_RESERVATION_ID) % WORKERS for r in reservations)
+    assert len(shards) > 1
+
+    # A bulk reservation with the sold out event takes nothing
+    try:
+        client.get_reservations([(1, 1), (0, 1)])
+        assert False
+    except Response255Exception as e:
+        assert e.args[0] == 0
+    assert counts(client)[1] == TICKETS - 5
+
+    bought = {r.reservation_id: client.get_tickets(r.reservation_id, r.cookie).tickets
+              for r in reservations[::2]}
+    sold = sum(len(tickets) for tickets in bought.values())
+    crash(server)
+
+    # The journal holds reservations of the hot event in shards of other events
+    assert get_return_code_of_server_with_params(params(journal, hot=False)) == 1
+
+    server = start_server_with_params(params(journal))
+    client = Client()
+    assert counts(client)[0] == 0
+    for r in reservations[::2]:
+        assert client.get_tickets(r.reservation_id, r.cookie).tickets == bought[r.reservation_id]
+
+    # Tickets of expired reservations go back to the shared count
+    time.sleep(TIMEOUT + 1)
+    assert counts(client) == {0: HOT_TICKETS - sold, 1: TICKETS, 2: TICKETS, 3: TICKETS}
+
+    # A reload puts the events file's tickets on sale, less held ones, and compacts the journal
+    # while shards of several workers hold tickets of the hot event
+    held = [c.get_reservation(0, 2) for c in clients]
+    assert len(set((r.reservation_id - MIN_RESERVATION_ID) % WORKERS for r in held)) > 1
+    server.send_signal(signal.SIGHUP)
+    time.sleep(RELOAD_WAIT)
+    crash(server)
+
+    server = start_server_with_params(params(journal))
+    client = Client()
+    assert counts(client)[0] == HOT_TICKETS - 2 * len(held)
+
+    server.terminate()
+    server.communicate()
+
+if __name__ == '__main__':
+    test_hot_events()
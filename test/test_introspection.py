@@ -0,0 +1,62 @@
+from basic_client import Client
+from server_wrap import start_server_with_params
+from event_files.generate_file import generate_file
+from test_metrics import ADMIN_PORT, admin_command
+
+import time
+
+EVENT_COUNT = 2050
+
+def introspection_events(file):
+    for event in range(EVENT_COUNT):
+        file.write('show ' + str(event) + '\n' + str(event % 100) + '\n')
+
+def events(first=None):
+    command = b'events' if first is None else b'events ' + str(first).encode()
+    lines = admin_command(command).splitlines()
+    counts = {}
+    for line in lines:
+        if line.startswith('next '):
+            continue
+        event, available, held = map(int, line.split())
+        counts[event] = (available, held)
+    nexts = [int(line.split()[1]) for line in lines if line.startswith('next ')]
+    return counts, nexts[0] if nexts else None
+
+def expiring(seconds):
+    reservations, tickets = admin_command(b'expiring ' + str(seconds).encode()).splitlines()
+    return int(reservations.split()[1]), int(tickets.split()[1])
+
+def test_introspection():
+    server = start_server_with_params(['-f', generate_file(introspection_events), '-t', '2', '-w', '2',
+                                       '-a', str(ADMIN_PORT)])
+    client = Client()
+    client.get_events() # workers answer once the admin socket is bound
+
+    # Events are listed in pages which fit into a datagram
+    counts, next = events()
+    assert next == 2048 and len(counts) == 2048 and counts[7] == (7, 0)
+    counts, next = events(next)
+    assert next is None and sorted(counts) == [2048, 2049] and counts[2049] == (49, 0)
+
+    held = [client.get_reservation(50, 10), client.get_reservation(50, 5), client.get_reservation(51, 1)]
+    counts, _ = events()
+    assert counts[50] == (35, 2) and counts[51] == (50, 1)
+    assert expiring(3) == (3, 16)
+    assert expiring(0) == (0, 0)
+
+    # Bought tickets are not held any more and never expire
+    client.get_tickets(held[0].reservation_id, held[0].cookie)
+    counts, _ = events()
+    assert counts[50] == (35, 1)
+    assert expiring(3) == (2, 6)
+
+    time.sleep(3.5)
+    counts, _ = events()
+    assert counts[50] == (40, 0) and counts[51] == (51, 0)
+    assert expiring(3) == (0, 0)
+
+    assert admin_command(b'events x') == 'Invalid first event\n'
+    assert admin_command(b'expiring') == 'Usage: expiring <seconds>\n'
+
+    server.terminate()
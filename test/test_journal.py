@@ -0,0 +1,88 @@
+from basic_client import Client, Response255Exception
+from server_wrap import start_server_with_params
+from event_files.generate_file import generate_file
+
+import os, signal, tempfile, time
+
+TICKETS = 1000
+RESERVATIONS = 50
+COMMIT_WAIT = 0.1 # seconds, much longer than a group commit
+
+def journal_events(file):
+    for i in range(10):
+        file.write('event ' + str(i) + '\n' + str(TICKETS) + '\n')
+
+def start(journal, timeout=60):
+    return start_server_with_params(['-f', generate_file(journal_events), '-t', str(timeout), '-j', journal])
+
+# Kills the server without letting it flush anything
+def crash(server):
+    time.sleep(COMMIT_WAIT)
+    server.send_signal(signal.SIGKILL)
+    server.communicate()
+
+def test_journal():
+    journal = os.path.join(tempfile.mkdtemp(), 'journal')
+    server = start(journal)
+    client = Client()
+
+    reservations = [client.get_reservation(i % 10, 3) for i in range(RESERVATIONS)]
+    bought = {r.reservation_id: client.get_tickets(r.reservation_id, r.cookie).tickets
+              for r in reservations[:RESERVATIONS // 2]}
+    crash(server)
+
+    # Restarted twice: from the journal, then from the snapshot compacted at the first start
+    for _ in range(2):
+        server = start(journal)
+        client = Client()
+
+        # Ticket counts stay taken by held and bought reservations
+        events = client.get_events()
+        assert all(e.ticket_count == TICKETS - 3 * RESERVATIONS // 10 for e in events)
+
+        # Bought tickets are sent again, not sold twice
+        for r in reservations[:RESERVATIONS // 2]:
+            assert client.get_tickets(r.reservation_id, r.cookie).tickets == bought[r.reservation_id]
+
+        # Forged cookies are still rejected
+        try:
+            client.get_tickets(reservations[0].reservation_id, 'x' * 48)
+            assert False
+        except Response255Exception:
+            pass
+
+        crash(server)
+
+    # Held reservations can be bought after a restart, with tickets never sold before
+    server = start(journal)
+    client = Client()
+    sold = set(t for tickets in bought.values() for t in tickets)
+    for r in reservations[RESERVATIONS // 2:]:
+        tickets = client.get_tickets(r.reservation_id, r.cookie).tickets
+        assert sold.isdisjoint(tickets)
+        sold.update(tickets)
+
+    # New reservations do not reuse ids of restored ones
+    fresh = client.get_reservation(0, 1)
+    assert fresh.reservation_id not in [r.reservation_id for r in reservations]
+
+    server.terminate()
+    server.communicate()
+
+    # Reservations which expired while the server was down give their tickets back
+    journal = os.path.join(tempfile.mkdtemp(), 'journal')
+    server = start(journal, timeout=1)
+    client = Client()
+    client.get_reservation(0, 5)
+    crash(server)
+    time.sleep(2)
+
+    server = start(journal, timeout=1)
+    client = Client()
+    assert client.get_events()[0].ticket_count == TICKETS
+
+    server.terminate()
+    server.communicate()
+
+if __name__ == '__main__':
+    test_journal()
@@ -0,0 +1,33 @@
+from basic_client import Client
+from server_wrap import start_server_with_params
+from event_files.generate_file import generate_file
+
+def listeners_events(file):
+    file.write('premiere\n100\nmatinee\n100\n')
+
+def check_clients(clients):
+    # A reservation made over one address is bought over any other
+    for i, client in enumerate(clients):
+        r = client.get_reservation(i % 2, 1)
+        other = clients[(i + 1) % len(clients)]
+        assert other.get_tickets(r.reservation_id, r.cookie).ticket_count == 1
+        assert len(client.get_events()) == 2
+
+def test_dual_stack():
+    server = start_server_with_params(['-f', generate_file(listeners_events), '-H', '::'])
+    check_clients([Client('127.0.0.1'), Client('::1')])
+    server.terminate()
+    server.communicate()
+
+def test_several_addresses(backend):
+    # Every worker listens on both addresses and runs on the only core
+    server = start_server_with_params(['-f', generate_file(listeners_events), '-H', '127.0.0.1,::1',
+                                       '-w', '2', '-C', '0', '-e', backend])
+    check_clients([Client('127.0.0.1'), Client('::1')] * 4)
+    server.terminate()
+    server.communicate()
+
+def test_listeners():
+    test_dual_stack()
+    for backend in ['blocking', 'busy_poll', 'io_uring']:
+        test_several_addresses(backend)
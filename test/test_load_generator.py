@@ -0,0 +1,64 @@
+from server_wrap import start_server, start_server_with_params
+from event_files.generate_file import generate_file
+
+import subprocess
+
+LOAD_GENERATOR = '../load_generator'
+EVENT_COUNT = 100
+
+def load_generator_events(file):
+    for i in range(EVENT_COUNT):
+        file.write('event ' + str(i) + '\n' + str(60000) + '\n')
+
+# Runs the generator and gives the columns of its report rows by request type
+def run_load_generator(params):
+    output = subprocess.run([LOAD_GENERATOR] + params, capture_output=True, text=True, timeout=30)
+    assert output.returncode == 0, output.stderr
+
+    rows = {}
+    for line in output.stdout.splitlines()[1:]:
+        columns = line.split()
+        rows[columns[0]] = {
+            'sent': int(columns[1]),
+            'answered': int(columns[2]),
+            'qps': float(columns[3]),
+            'bad': float(columns[4].rstrip('%')),
+            'timeouts': int(columns[5]),
+            'unexpected': int(columns[6]),
+        }
+    return rows
+
+def test_load_generator():
+    server = start_server(generate_file(load_generator_events), timeout=60)
+
+    # Closed loop with batches in flight, reservations are bought afterwards
+    rows = run_load_generator(['-d', '1', '-c', '4', '-b', '4', '-m', '1:4:4'])
+    assert rows['total']['answered'] > 0
+    assert rows['total']['timeouts'] == 0 and rows['total']['unexpected'] == 0
+    assert rows['GET_TICKETS']['answered'] > 0 and rows['GET_TICKETS']['bad'] == 0
+    assert rows['GET_EVENTS']['bad'] == 0
+
+    # Open loop sends about the requested rate
+    rows = run_load_generator(['-d', '1', '-c', '4', '-r', '1000', '-m', '0:1:1', '-e', str(EVENT_COUNT)])
+    assert 800 <= rows['total']['sent'] <= 1100
+    assert rows['total']['unexpected'] == 0
+
+    # Half of the targeted events do not exist, so their reservations are rejected
+    rows = run_load_generator(['-d', '1', '-c', '2', '-m', '0:1:0', '-e', str(2 * EVENT_COUNT)])
+    assert 0 < rows['GET_RESERVATION']['bad'] < 100
+
+    server.terminate()
+    server.communicate()
+
+    # Reservations queued by admission are answered after later listings, over IPv6
+    server = start_server_with_params(['-f', generate_file(load_generator_events), '-H', '::1', '-q', '50',
+                                       '-t', '60'])
+    rows = run_load_generator(['-a', '::1', '-d', '1', '-c', '2', '-b', '8', '-m', '1:1:0', '-e', '1'])
+    assert rows['GET_EVENTS']['answered'] > 0 and rows['GET_RESERVATION']['answered'] > 0
+    assert rows['total']['unexpected'] == 0
+
+    server.terminate()
+    server.communicate()
+
+if __name__ == '__main__':
+    test_load_generator()
@@ -0,0 +1,33 @@
+from basic_client import Client
+from server_wrap import start_server_with_params, get_return_code_of_server_with_params, ServerLog
+import time
+
+EVENTS_FILE = 'event_files/simple_events'
+
+# returns the lines logged by a server at the given level while answering one request
+def logged_lines(level):
+    server = start_server_with_params(['-f', EVENTS_FILE, '-l', str(level)], log=True)
+    log = ServerLog(server)
+    Client().get_events()
+
+    # The asynchronous sink writes lines in batches
+    time.sleep(0.5)
+    server.terminate()
+    server.wait()
+    log.reader.join()
+    return log.lines
+
+def test_log_levels():
+    lines = logged_lines(2)
+    assert not any(line.startswith('INFO') or line.startswith('DEBUG') for line in lines)
+
+    lines = logged_lines(1)
+    assert any(line.startswith('INFO: Loaded') for line in lines)
+    assert not any(line.startswith('DEBUG') for line in lines)
+
+    lines = logged_lines(0)
+    assert any(line.startswith('INFO: Loaded') for line in lines)
+    assert any(line.startswith('DEBUG: Received a message from') for line in lines)
+
+    assert get_return_code_of_server_with_params(['-f', EVENTS_FILE, '-l', '3']) == 1
+    assert get_return_code_of_server_with_params(['-f', EVENTS_FILE, '-l', '-1']) == 1
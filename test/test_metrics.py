@@ -0,0 +1,68 @@
+from basic_client import Client, Response255Exception
+from server_wrap import start_server_with_params, DEFAULT_PORT
+from event_files.generate_file import generate_file
+
+import socket, struct, time
+
+ADMIN_PORT = DEFAULT_PORT + 1
+
+def metrics_events(file):
+    file.write('opera\n10\nballet\n0\n')
+
+def admin_command(command):
+    with socket.socket(socket.AF_INET, socket.SOCK_DGRAM) as admin:
+        admin.settimeout(1)
+        admin.sendto(command, ('localhost', ADMIN_PORT))
+        return admin.recvfrom(1 << 16)[0].decode()
+
+def scrape():
+    values = {}
+    for line in admin_command(b'metrics').splitlines():
+        if line and not line.startswith('#'):
+            name, value = line.rsplit(' ', 1)
+            values[name] = float(value)
+    return values
+
+def test_metrics():
+    server = start_server_with_params(['-f', generate_file(metrics_events), '-t', '1', '-a', str(ADMIN_PORT)])
+    client = Client()
+
+    client.get_events()
+    r = client.get_reservation(0, 3)
+    client.get_tickets(r.reservation_id, r.cookie)
+    client.get_reservation(0, 2)
+    try:
+        client.get_reservation(1, 1)
+        assert False
+    except Response255Exception:
+        pass
+    client.send_message(struct.pack('!BB', 1, 1)) # malformed, no response
+
+    time.sleep(2.5) # let the second reservation expire
+    values = scrape()
+
+    assert values['ticket_server_requests_total{type="GET_EVENTS"}'] == 2
+    assert values['ticket_server_requests_total{type="GET_RESERVATION"}'] == 3
+    assert values['ticket_server_requests_total{type="GET_TICKETS"}'] == 1
+    assert values['ticket_server_bad_requests_total{type="GET_RESERVATION"}'] == 1
+    assert values['ticket_server_malformed_requests_total{type="GET_EVENTS"}'] == 1
+    assert values['ticket_server_responses_total'] == 5
+    assert values['ticket_server_sent_bytes_total'] > 0
+    assert values['ticket_server_expired_reservations_total'] == 1
+    assert values['ticket_server_reservations'] == 0
+    assert values['ticket_server_bought_reservations'] == 1
+    # The first request of every 16 of a type is timed
+    assert values['ticket_server_request_duration_seconds_count{type="GET_RESERVATION"}'] == 1
+    assert values['ticket_server_request_duration_seconds_bucket{type="GET_RESERVATION",le="+Inf"}'] == 1
+
+    # Histogram buckets are cumulative
+    buckets = [v for k, v in values.items() if k.startswith('ticket_server_request_duration_seconds_bucket{type="GET_EVENTS"')]
+    assert buckets == sorted(buckets) and buckets[-1] == 1
+
+    assert admin_command(b'nonsense') == 'Unknown command\n'
+
+    server.terminate()
+    server.communicate()
+
+if __name__ == '__main__':
+    test_metrics()
@@ -0,0 +1,61 @@
+from basic_client import Client, Response255Exception, END_OF_EVENTS
+from server_wrap import start_server
+from event_files.generate_file import generate_file
+
+MAX_DATAGRAM_SIZE = 65507
+EVENT_COUNT = 20000
+
+def paging_events(file):
+    for i in range(EVENT_COUNT):
+        file.write('event ' + str(i) + ' ' * (i % 50) + '\n' + str(i % 1000) + '\n')
+
+def all_pages(client, cursor=0):
+    events = []
+    pages = 0
+    while cursor != END_OF_EVENTS:
+        page, cursor = client.get_events_page(cursor)
+        events += page
+        pages += 1
+    return events, pages
+
+def test_paging():
+    server = start_server(generate_file(paging_events))
+    client = Client()
+
+    # Every event is listed exactly once, in order of ids
+    events, pages = all_pages(client)
+    assert [e.event_id for e in events] == list(range(EVENT_COUNT))
+    assert all(e.ticket_count == e.event_id % 1000 for e in events)
+    assert pages > 1
+
+    # GET_EVENTS is still a single datagram, the same as the first page or longer
+    first_page, _ = client.get_events_page(0)
+    listed = client.get_events()
+    assert [e.event_id for e in listed[:len(first_page)]] == [e.event_id for e in first_page]
+
+    # Ticket counts changed by reservations are visible on their page
+    event = EVENT_COUNT - 7
+    client.get_reservation(event, 5)
+    events, _ = all_pages(client)
+    assert events[event].ticket_count == event % 1000 - 5
+
+    # A cursor inside a page gives the rest of the page
+    _, second = client.get_events_page(0)
+    middle, next_cursor = client.get_events_page(second - 3)
+    assert [e.event_id for e in middle] == [second - 3, second - 2, second - 1]
+    assert next_cursor == second
+
+    # Cursor equal to the number of events gives an empty last page
+    assert client.get_events_page(EVENT_COUNT) == ([], END_OF_EVENTS)
+
+    try:
+        client.get_events_page(EVENT_COUNT + 1)
+        assert False
+    except Response255Exception:
+        pass
+
+    server.terminate()
+    server.communicate()
+
+if __name__ == '__main__':
+    test_paging()
@@ -0,0 +1,56 @@
+from basic_client import Client, Response255Exception
+from server_wrap import start_server_with_params
+from test_metrics import ADMIN_PORT, admin_command
+
+import os, signal, tempfile, time
+
+def write_events(path, events):
+    with open(path, 'w') as file:
+        for description, tickets in events:
+            file.write(description + '\n' + str(tickets) + '\n')
+
+def counts(client):
+    return [(e.description, e.ticket_count) for e in client.get_events()]
+
+def test_reload():
+    path = os.path.join(tempfile.mkdtemp(), 'reload_events')
+    write_events(path, [('premiere', 10), ('matinee', 10)])
+    server = start_server_with_params(['-f', path, '-t', '1', '-w', '2', '-a', str(ADMIN_PORT)])
+    client = Client()
+
+    held = client.get_reservation(0, 4)
+    bought = client.get_reservation(1, 2)
+    tickets = client.get_tickets(bought.reservation_id, bought.cookie)
+
+    # Counts in the file are tickets on sale: held ones are taken from them, sold ones are not
+    write_events(path, [('premiere again', 10), ('matinee', 10), ('late show', 5)])
+    assert admin_command(b'reload').startswith('Reloaded 3 events')
+    assert counts(client) == [('premiere again', 6), ('matinee', 10), ('late show', 5)]
+
+    # Reservations made before the reload are bought as usual
+    assert client.get_tickets(held.reservation_id, held.cookie).ticket_count == 4
+    assert client.get_tickets(bought.reservation_id, bought.cookie).tickets == tickets.tickets
+    late = client.get_reservation(2, 5)
+
+    # An event removed with its reservation held
+    write_events(path, [('premiere', 7)])
+    server.send_signal(signal.SIGHUP)
+    time.sleep(0.5)
+    assert counts(client) == [('premiere', 7)]
+    try:
+        client.get_reservation(2, 1)
+        assert False
+    except Response255Exception:
+        pass
+
+    time.sleep(2.5) # the removed event's reservation expires
+    assert server.poll() is None
+    assert counts(client) == [('premiere', 7)]
+
+    # A missing file keeps the events
+    os.remove(path)
+    assert admin_command(b'reload').startswith('Failed')
+    assert counts(client) == [('premiere', 7)]
+
+    server.terminate()
+    server.communicate()
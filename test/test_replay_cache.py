@@ -0,0 +1,65 @@
+from basic_client import Client, Response255Exception
+from server_wrap import start_server_with_params
+from event_files.generate_file import generate_file
+from test_metrics import ADMIN_PORT, scrape
+
+import time
+
+def replay_cache_events(file):
+    file.write('premiere\n1000\n')
+
+def test_replayed_tickets():
+    server = start_server_with_params(['-f', generate_file(replay_cache_events), '-a', str(ADMIN_PORT)])
+    client = Client()
+
+    r = client.get_reservation(0, 500)
+    bought = client.get_tickets(r.reservation_id, r.cookie)
+    assert bought.ticket_count == 500 and len(set(bought.tickets)) == 500
+
+    # Retries are answered from the cache with the same tickets
+    for _ in range(3):
+        retry = client.get_tickets(r.reservation_id, r.cookie)
+        assert retry.reservation_id == bought.reservation_id and retry.tickets == bought.tickets
+    assert scrape()['ticket_server_replayed_tickets_total'] == 3
+
+    # A cached response still needs the cookie of its reservation
+    try:
+        client.get_tickets(r.reservation_id, 'x' * 48)
+        assert False
+    except Response255Exception:
+        pass
+
+    # Few tickets are encoded again instead of cached
+    small = client.get_reservation(0, 2)
+    assert client.get_tickets(small.reservation_id, small.cookie).tickets == \
+        client.get_tickets(small.reservation_id, small.cookie).tickets
+    assert scrape()['ticket_server_replayed_tickets_total'] == 3
+
+    server.terminate()
+    server.communicate()
+
+def test_pruned_replays():
+    server = start_server_with_params(['-f', generate_file(replay_cache_events), '-a', str(ADMIN_PORT),
+                                       '-t', '1', '-K', '1', '-c', str(1 << 30)])
+    client = Client()
+
+    r = client.get_reservation(0, 500)
+    client.get_tickets(r.reservation_id, r.cookie)
+    client.get_tickets(r.reservation_id, r.cookie)
+    assert scrape()['ticket_server_replayed_tickets_total'] == 1
+
+    # Once the reservation is pruned its cached response is dropped as well
+    time.sleep(4)
+    try:
+        client.get_tickets(r.reservation_id, r.cookie)
+        assert False
+    except Response255Exception:
+        pass
+    assert scrape()['ticket_server_replayed_tickets_total'] == 1
+
+    server.terminate()
+    server.communicate()
+
+def test_replay_cache():
+    test_replayed_tickets()
+    test_pruned_replays()
@@ -0,0 +1,118 @@
+from basic_client import Client
+from server_wrap import start_server_with_params, is_port_in_use, EXECUTABLE, DEFAULT_PORT
+from event_files.generate_file import generate_file
+from test_journal import COMMIT_WAIT, crash
+
+import os, signal, socket, subprocess, tempfile, time
+
+TICKETS = 1000
+RESERVATIONS = 40
+REPLICATION_PORT = 2030
+TAKEOVER_TIMEOUT = 5 # seconds, much longer than the failover timeout
+FOLLOWER_PORT = 2025 # a stopped leader keeps its client port
+
+def replication_events(file):
+    for i in range(10):
+        file.write('event ' + str(i) + '\n' + str(TICKETS) + '\n')
+
+def params(journal):
+    return ['-f', generate_file(replication_events), '-t', '60', '-j', journal]
+
+def reserve(client, count):
+    return [client.get_reservation(i % 10, 2) for i in range(count)]
+
+def check(client, reservations, bought):
+    events = client.get_events()
+    assert all(e.ticket_count == TICKETS - 2 * len(reservations) // 10 for e in events)
+    for r in reservations:
+        if r.reservation_id in bought:
+            assert client.get_tickets(r.reservation_id, r.cookie).tickets == bought[r.reservation_id]
+
+def follow(journal, port=DEFAULT_PORT):
+    return subprocess.Popen([EXECUTABLE] + params(journal) + ['-p', str(port), '-F', '127.0.0.1:' + str(REPLICATION_PORT)],
+                            stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+
+def wait_for_takeover(follower, port):
+    start = time.time()
+    while not is_port_in_use(port):
+        assert time.time() < start + TAKEOVER_TIMEOUT and follower.poll() is None
+        time.sleep(0.05)
+
+# A leader which stops answering keeps its connection open, the follower takes over once it is silent
+def check_silent_leader(directory):
+    leader = start_server_with_params(params(os.path.join(directory, 'silent_leader'))
+                                      + ['-L', str(REPLICATION_PORT)])
+    client = Client()
+    reservations = reserve(client, RESERVATIONS)
+    follower = follow(os.path.join(directory, 'silent_follower'), FOLLOWER_PORT)
+    time.sleep(0.5)
+
+    leader.send_signal(signal.SIGSTOP)
+    wait_for_takeover(follower, FOLLOWER_PORT)
+    check(Client(server_port=FOLLOWER_PORT), reservations, {})
+
+    leader.send_signal(signal.SIGKILL)
+    leader.communicate()
+    follower.terminate()
+    follower.communicate()
+
+# A frame longer than any state is refused, the follower connects again instead of allocating it
+def check_corrupt_leader(directory):
+    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as leader:
+        leader.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        leader.bind(('127.0.0.1', REPLICATION_PORT))
+        leader.listen(1)
+        leader.settimeout(TAKEOVER_TIMEOUT)
+        follower = follow(os.path.join(directory, 'corrupt_follower'), FOLLOWER_PORT)
+
+        connection, _ = leader.accept()
+        connection.sendall(bytes([1]) + (1 << 62).to_bytes(8, 'big'))
+        connection.close()
+        leader.accept()[0].close()
+
+        assert follower.poll() is None and not is_port_in_use(FOLLOWER_PORT)
+        follower.terminate()
+        follower.communicate()
+
+def test_replication():
+    directory = tempfile.mkdtemp()
+    leader = start_server_with_params(params(os.path.join(directory, 'leader'))
+                                      + ['-L', str(REPLICATION_PORT)])
+    client = Client()
+
+    # Reservations before the follower connects come with the state, later ones as records
+    reservations = reserve(client, RESERVATIONS // 2)
+    follower = follow(os.path.join(directory, 'follower'))
+    time.sleep(0.5)
+    reservations += reserve(client, RESERVATIONS // 2)
+    bought = {r.reservation_id: client.get_tickets(r.reservation_id, r.cookie).tickets
+              for r in reservations[::2]}
+
+    # The follower binds the port of clients only once the leader is lost
+    assert follower.poll() is None
+    crash(leader)
+    wait_for_takeover(follower, DEFAULT_PORT)
+
+    # Bought tickets are sent again and held reservations are bought with tickets never sold
+    client = Client()
+    check(client, reservations, bought)
+    sold = set(t for tickets in bought.values() for t in tickets)
+    for r in reservations[1::2]:
+        tickets = client.get_tickets(r.reservation_id, r.cookie).tickets
+        assert sold.isdisjoint(tickets)
+        sold.update(tickets)
+        bought[r.reservation_id] = tickets
+
+    # The promoted follower journals its own changes
+    crash(follower)
+    follower = start_server_with_params(params(os.path.join(directory, 'follower')))
+    check(Client(), reservations, bought)
+
+    follower.terminate()
+    follower.communicate()
+
+    check_silent_leader(directory)
+    check_corrupt_leader(directory)
+
+if __name__ == '__main__':
+    test_replication()
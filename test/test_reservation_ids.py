@@ -0,0 +1,52 @@
+from basic_client import Client, Response255Exception
+from server_wrap import start_server_with_params
+from event_files.generate_file import generate_file
+import time
+
+EVENTS = 4
+RESERVATIONS = 100
+MIN_RESERVATION_ID = 1000000
+
+def reservation_ids_events(file):
+    for i in range(EVENTS):
+        file.write('show ' + str(i) + '\n' + str(RESERVATIONS) + '\n')
+
+def assert_refused(client, reservation_id, cookie):
+    try:
+        client.get_tickets(reservation_id, cookie)
+        assert False
+    except Response255Exception:
+        pass
+
+def reserve_all(client):
+    return [client.get_reservation(i % EVENTS, 1) for i in range(RESERVATIONS)]
+
+def test_reservation_ids():
+    server = start_server_with_params(['-f', generate_file(reservation_ids_events), '-t', '1', '-w', '2'])
+    client = Client()
+
+    reservations = reserve_all(client)
+    ids = [r.reservation_id for r in reservations]
+    assert len(set(ids)) == RESERVATIONS
+    assert min(ids) >= MIN_RESERVATION_ID
+
+    # Ids outside of the held slots and cookies of other slots are refused
+    cookie = reservations[0].cookie
+    for reservation_id in [0, MIN_RESERVATION_ID - 1, max(ids) + 1, max(ids) + 1000, (1 << 32) - 1]:
+        assert_refused(client, reservation_id, cookie)
+    assert_refused(client, reservations[1].reservation_id, cookie)
+
+    bought = reservations[:RESERVATIONS // 2]
+    tickets = [client.get_tickets(r.reservation_id, r.cookie).tickets for r in bought]
+
+    # Slots of expired reservations are reused, bought ones keep answering
+    time.sleep(2.5)
+    for r in reservations[RESERVATIONS // 2:]:
+        assert_refused(client, r.reservation_id, r.cookie)
+    again = reserve_all(client)
+    assert len(set(r.reservation_id for r in again)) == RESERVATIONS
+    assert not set(r.reservation_id for r in again) & set(r.reservation_id for r in bought)
+    for r, t in zip(bought, tickets):
+        assert client.get_tickets(r.reservation_id, r.cookie).tickets == t
+
+    server.terminate()
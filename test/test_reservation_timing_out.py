@@ -48,6 +48,21 @@ def test_receive_after_timeout(client):
     except Response255Exception:
         pass
 
+def test_expired_id_not_reused(client):
+    event = get_event(client)
+    expired = client.get_reservation(event.event_id, 1)
+
+    time.sleep(3)
+    # The slot of the expired reservation is reused under a new id, its old id stays invalid
+    r = client.get_reservation(event.event_id, 1)
+    assert r.reservation_id != expired.reservation_id
+    try:
+        client.get_tickets(expired.reservation_id, r.cookie)
+        assert False
+    except Response255Exception:
+        pass
+    assert client.get_tickets(r.reservation_id, r.cookie).ticket_count == 1
+
 def test_reservation_timing_out():
     server = start_server('event_files/simple_events', timeout=2)
     client = Client()
@@ -55,5 +70,6 @@ def test_reservation_timing_out():
     test_are_tickets_returned(client)
     test_tickets_received(client)
     test_receive_after_timeout(client)
+    test_expired_id_not_reused(client)
 
     server.terminate()
@@ -0,0 +1,80 @@
+from basic_client import Client
+from server_wrap import start_server_with_params, get_return_code_of_server_with_params
+from event_files.generate_file import generate_file
+
+import os, struct, tempfile
+
+HEADER_LEN = 20 # magic, version, event count and byte order
+
+def snapshot_events(file):
+    for i in range(200):
+        file.write('film ' + str(i) + '\n' + str(i * 7 % 300) + '\n')
+    # Leading blanks, counts above the limit, missing counts and no final newline
+    file.write('\n  12\nbig\n99999999\nnothing\n\nlast\n5')
+
+def events_of(params):
+    server = start_server_with_params(params)
+    events = sorted((e.event_id, e.description, e.ticket_count) for e in Client().get_events())
+    server.terminate()
+    server.communicate()
+    return events
+
+# Writes a copy of a snapshot with some description offsets replaced
+def corrupt_offsets(snapshot, replaced):
+    with open(snapshot, 'rb') as file:
+        data = bytearray(file.read())
+    events = struct.unpack_from('=I', data, HEADER_LEN - 8)[0]
+    for index, offset in replaced.items():
+        struct.pack_into('=I', data, HEADER_LEN + 2 * events + 4 * index, offset)
+
+    return write_copy(snapshot, data)
+
+def write_copy(snapshot, data):
+    copy = snapshot + '.copy'
+    with open(copy, 'wb') as file:
+        file.write(data)
+    return copy
+
+# Writes a copy of a snapshot with the byte order word of the other byte order
+def swap_byte_order(snapshot):
+    with open(snapshot, 'rb') as file:
+        data = bytearray(file.read())
+    data[HEADER_LEN - 4:HEADER_LEN] = data[HEADER_LEN - 4:HEADER_LEN][::-1]
+    return write_copy(snapshot, data)
+
+def test_snapshot():
+    text = generate_file(snapshot_events)
+    snapshot = os.path.join(tempfile.mkdtemp(), 'snapshot')
+
+    from_text = events_of(['-f', text, '-s', snapshot])
+    assert os.path.exists(snapshot)
+    assert (200, '', 12) in from_text
+    assert (201, 'big', 65535) in from_text
+    assert (202, 'nothing', 0) in from_text
+    assert (203, 'last', 5) in from_text
+
+    # Events loaded from the snapshot are exactly those loaded from text
+    assert events_of(['-f', snapshot]) == from_text
+
+    # Offsets not starting at 0 or decreasing are refused rather than sliced
+    for replaced in [{0: 1}, {1: 1 << 20}]:
+        corrupt = corrupt_offsets(snapshot, replaced)
+        assert get_return_code_of_server_with_params(['-f', corrupt]) == 1
+        os.remove(corrupt)
+
+    # Snapshots of another byte order are parsed as text
+    foreign = swap_byte_order(snapshot)
+    server = start_server_with_params(['-f', foreign])
+    client = Client()
+    client.send_message(struct.pack('!B', 1))
+    # EVENTS, then the first event: id, ticket count and description length
+    assert client.receive_message()[8:16] == b'CSEVENTS'
+    server.terminate()
+    server.communicate()
+    os.remove(foreign)
+
+    os.remove(snapshot)
+    os.rmdir(os.path.dirname(snapshot))
+
+if __name__ == '__main__':
+    test_snapshot()
@@ -0,0 +1,52 @@
+from server_wrap import start_server_with_params
+from event_files.generate_file import generate_file
+from test_load_generator import run_load_generator
+
+import os
+
+DURATION = 2 # seconds per measurement
+CLIENTS = 8
+WINDOW = 32 # requests in flight per client
+SINGLE_BATCH = 1
+LARGE_BATCH = 64
+EVENT_COUNT = 16
+ATTEMPTS = 3 # measurements of each batch size at most
+
+def throughput_events(file):
+    for i in range(EVENT_COUNT):
+        file.write('event ' + str(i) + '\n' + str(1000) + '\n')
+
+# Keeps WINDOW reservations in flight per client, so the server always has
+# a backlog of datagrams to pick up in one go. Nearly all target nonexistent
+# events and are answered with BAD_REQUEST. Returns replies per second.
+def measure_throughput(batch):
+    server = start_server_with_params(['-f', generate_file(throughput_events), '-b', str(batch), '-l', '1'])
+    rows = run_load_generator(['-d', str(DURATION), '-c', str(CLIENTS), '-b', str(WINDOW), '-m', '0:1:0',
+                               '-e', str(1 << 20)])
+    server.terminate()
+    server.communicate()
+
+    assert rows['total']['answered'] > 0
+    return rows['total']['qps']
+
+def test_throughput():
+    # On a single core the generator competes with the server, so there is no gain to check
+    if len(os.sched_getaffinity(0)) < 2:
+        print('  skipped on a single core')
+        return
+
+    # Best of a few runs of each, so a short stall of the machine does not hide the gain
+    single, batched = 0, 0
+    for _ in range(ATTEMPTS):
+        single = max(single, measure_throughput(SINGLE_BATCH))
+        batched = max(batched, measure_throughput(LARGE_BATCH))
+
+        print('  batch %d: %.0f req/s, batch %d: %.0f req/s, gain x%.2f'
+              % (SINGLE_BATCH, single, LARGE_BATCH, batched, batched / single))
+        if batched > single:
+            break
+
+    assert batched > single
+
+if __name__ == '__main__':
+    test_throughput()
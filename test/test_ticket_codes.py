@@ -0,0 +1,41 @@
+from basic_client import Client
+from server_wrap import start_server_with_params
+from event_files.generate_file import generate_file
+
+EVENTS = 2
+TICKETS = 3000
+SIZES = [1, 35, 36, 37, 100, 500, 1296]
+
+def ticket_codes_events(file):
+    for i in range(EVENTS):
+        file.write('show ' + str(i) + '\n' + str(TICKETS) + '\n')
+
+# codes are base-36 numbers with the least significant digit first
+def ticket_number(code):
+    return int(code[::-1], 36)
+
+def test_ticket_codes():
+    server = start_server_with_params(['-f', generate_file(ticket_codes_events), '-w', '2'])
+    client = Client()
+
+    bought = []
+    for event in range(EVENTS):
+        for size in SIZES:
+            r = client.get_reservation(event, size)
+            tickets = client.get_tickets(r.reservation_id, r.cookie)
+            assert tickets.ticket_count == size and len(tickets.tickets) == size
+            bought.append((r, tickets.tickets))
+
+    # Tickets of a reservation are consecutive, across digit boundaries too
+    codes = []
+    for _, tickets in bought:
+        numbers = [ticket_number(code) for code in tickets]
+        assert numbers == list(range(numbers[0], numbers[0] + len(numbers)))
+        codes += tickets
+    assert len(set(codes)) == len(codes) == EVENTS * sum(SIZES)
+
+    # Retries encode the same codes again
+    for r, tickets in bought:
+        assert client.get_tickets(r.reservation_id, r.cookie).tickets == tickets
+
+    server.terminate()
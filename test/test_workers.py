@@ -0,0 +1,66 @@
+from basic_client import Client, Response255Exception
+from server_wrap import start_server_with_params
+from event_files.generate_file import generate_file
+
+import random
+
+WORKERS = 4
+CLIENTS = 16
+TICKETS_PER_EVENT = 100
+
+def workers_events(file):
+    for i in range(40):
+        file.write('show ' + str(i) + '\n' + str(TICKETS_PER_EVENT) + '\n')
+
+def test_workers():
+    server = start_server_with_params(['-f', generate_file(workers_events), '-w', str(WORKERS)])
+
+    # Every client has its own source port, so the kernel spreads them over workers
+    clients = [Client() for _ in range(CLIENTS)]
+    events = clients[0].get_events()
+    assert sorted(e.event_id for e in events) == list(range(40))
+
+    random.seed(0)
+    reservations = []
+    reserved_per_event = {e.event_id: 0 for e in events}
+
+    for i in range(400):
+        client = random.choice(clients)
+        event = random.choice(events).event_id
+        count = random.randint(1, 5)
+        try:
+            r = client.get_reservation(event, count)
+            reserved_per_event[event] += count
+            reservations.append(r)
+        except Response255Exception:
+            assert reserved_per_event[event] + count > TICKETS_PER_EVENT
+
+    ids = [r.reservation_id for r in reservations]
+    assert len(set(ids)) == len(ids)
+
+    # Ticket counts seen by any worker reflect reservations made through all of them
+    for client in clients:
+        for e in client.get_events():
+            assert e.ticket_count == TICKETS_PER_EVENT - reserved_per_event[e.event_id]
+
+    tickets = set()
+    for r in reservations:
+        info = random.choice(clients).get_tickets(r.reservation_id, r.cookie)
+        assert info.ticket_count == r.ticket_count
+        for ticket in info.tickets:
+            assert ticket not in tickets
+            tickets.add(ticket)
+
+    # Reservation id of one shard is not accepted with a cookie of another
+    if len(reservations) > 1:
+        try:
+            clients[0].get_tickets(reservations[0].reservation_id, reservations[1].cookie)
+            assert False
+        except Response255Exception:
+            pass
+
+    server.terminate()
+    server.communicate()
+
+if __name__ == '__main__':
+    test_workers()